@@ -75,6 +75,10 @@ ifeq ($(HAL_AUTODETECT),true)
     KERNELFLINGER_CFLAGS += -DHAL_AUTODETECT
 endif
 
+ifeq ($(KERNELFLINGER_ALLOC_PROFILE),true)
+    KERNELFLINGER_CFLAGS += -DALLOC_PROFILE
+endif
+
 ifeq ($(TARGET_USE_USERFASTBOOT),true)
     $(error Userfastboot is not supported anymore)
 endif
@@ -93,6 +93,10 @@ LOCAL_SRC_FILES := \
     libavb_ab/avb_ab_flow.c \
     libavb/avb_sha256.c
 
+ifneq ($(TARGET_BUILD_VARIANT),user)
+    LOCAL_SRC_FILES += libavb_user/uefi_avb_bench.c
+endif
+
 LOCAL_C_INCLUDES := \
 	$(addprefix $(LOCAL_PATH)/,../libkernelflinger) \
 	$(addprefix $(LOCAL_PATH)/,../libsslsupport)
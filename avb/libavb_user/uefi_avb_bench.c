@@ -0,0 +1,221 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <efi.h>
+#include <efilib.h>
+
+#include "libavb/avb_sha.h"
+#include "uefi_avb_bench.h"
+#include "uefi_avb_ops.h"
+#include "uefi_avb_util.h"
+#include "lib.h"
+#include "slot.h"
+#include "timer.h"
+
+#define BENCH_ITERATIONS 3
+#define BENCH_SHA_SIZE (4 * 1024 * 1024)
+#define BENCH_VBMETA_MAX_SIZE (64 * 1024)
+#define BENCH_NAME_MAX_SIZE 32
+
+static const char* const BENCH_PARTITIONS[] = {
+    "boot", "vendor_boot", "acpi", "acpio"};
+
+static struct {
+  AvbIOResult (*read_from_partition)(AvbOps* ops,
+                                     const char* partition,
+                                     int64_t offset,
+                                     size_t num_bytes,
+                                     void* buffer,
+                                     size_t* out_num_read);
+  uint64_t io_us;
+  uint64_t io_bytes;
+  size_t io_requests;
+} io;
+
+static AvbIOResult timed_read_from_partition(AvbOps* ops,
+                                             const char* partition,
+                                             int64_t offset,
+                                             size_t num_bytes,
+                                             void* buffer,
+                                             size_t* out_num_read) {
+  AvbIOResult ret;
+  uint64_t start = boottime_in_usec();
+
+  ret = io.read_from_partition(
+      ops, partition, offset, num_bytes, buffer, out_num_read);
+
+  io.io_us += boottime_in_usec() - start;
+  io.io_requests++;
+  if (ret == AVB_IO_RESULT_OK) {
+    io.io_bytes += *out_num_read;
+  }
+  return ret;
+}
+
+/* Returns the SHA-256 throughput in bytes per second. */
+static uint64_t sha256_rate(void) {
+  AvbSHA256Ctx ctx;
+  uint8_t* buf;
+  uint64_t start, us;
+
+  buf = avb_calloc(BENCH_SHA_SIZE);
+  if (!buf) {
+    return 0;
+  }
+
+  start = boottime_in_usec();
+  avb_sha256_init(&ctx);
+  avb_sha256_update(&ctx, buf, BENCH_SHA_SIZE);
+  (void)avb_sha256_final(&ctx);
+  us = boottime_in_usec() - start;
+
+  avb_free(buf);
+  return us ? (uint64_t)BENCH_SHA_SIZE * 1000000 / us : 0;
+}
+
+/* Returns the time spent verifying the vbmeta signature of SUFFIX. */
+static uint64_t vbmeta_verify_time(AvbOps* ops, const char* suffix) {
+  char name[BENCH_NAME_MAX_SIZE];
+  AvbVBMetaVerifyResult ret;
+  uint8_t* vbmeta;
+  size_t size;
+  uint64_t start, us = 0;
+
+  if (!avb_str_concat(
+          name, sizeof(name), "vbmeta", 6, suffix, avb_strlen(suffix))) {
+    return 0;
+  }
+
+  vbmeta = avb_malloc(BENCH_VBMETA_MAX_SIZE);
+  if (!vbmeta) {
+    return 0;
+  }
+
+  if (io.read_from_partition(
+          ops, name, 0, BENCH_VBMETA_MAX_SIZE, vbmeta, &size) ==
+      AVB_IO_RESULT_OK) {
+    start = boottime_in_usec();
+    ret = avb_vbmeta_image_verify(vbmeta, size, NULL, NULL);
+    us = boottime_in_usec() - start;
+    if (ret != AVB_VBMETA_VERIFY_RESULT_OK) {
+      avb_errorv(
+          name, ": ", avb_vbmeta_verify_result_to_string(ret), "\n", NULL);
+    }
+  }
+
+  avb_free(vbmeta);
+  return us;
+}
+
+void uefi_avb_bench(void) {
+  const char* requested[ARRAY_SIZE(BENCH_PARTITIONS) + 1];
+  char name[BENCH_NAME_MAX_SIZE];
+  struct uefi_avb_alloc_stats stats;
+  AvbSlotVerifyData* slot_data;
+  AvbSlotVerifyResult ret;
+  const char* suffix = "";
+  uint64_t start, total_us, sha_rate, sha_us, rsa_us;
+  uint64_t partition_size;
+  size_t i, n = 0;
+  AvbOps* ops;
+
+  if (!boottime_in_usec()) {
+    error(L"No TSC frequency, cannot run the benchmark");
+    return;
+  }
+
+  ops = uefi_avb_ops_new();
+  if (!ops) {
+    error(L"Failed to allocate the AVB operations");
+    return;
+  }
+
+  io.read_from_partition = ops->read_from_partition;
+  ops->read_from_partition = timed_read_from_partition;
+
+  if (use_slot()) {
+    suffix = slot_get_active();
+    if (!suffix) {
+      suffix = "";
+    }
+  }
+
+  for (i = 0; i < ARRAY_SIZE(BENCH_PARTITIONS); i++) {
+    if (!avb_str_concat(name,
+                        sizeof(name),
+                        BENCH_PARTITIONS[i],
+                        avb_strlen(BENCH_PARTITIONS[i]),
+                        suffix,
+                        avb_strlen(suffix))) {
+      continue;
+    }
+    if (ops->get_size_of_partition(ops, name, &partition_size) ==
+        AVB_IO_RESULT_OK) {
+      requested[n++] = BENCH_PARTITIONS[i];
+    }
+  }
+  requested[n] = NULL;
+
+  sha_rate = sha256_rate();
+  rsa_us = vbmeta_verify_time(ops, suffix);
+
+  for (i = 0; i < BENCH_ITERATIONS; i++) {
+    io.io_us = io.io_bytes = 0;
+    io.io_requests = 0;
+    uefi_avb_reset_alloc_stats();
+    slot_data = NULL;
+
+    start = boottime_in_usec();
+    ret = avb_slot_verify(ops,
+                          requested,
+                          suffix,
+                          AVB_SLOT_VERIFY_FLAGS_ALLOW_VERIFICATION_ERROR,
+                          AVB_HASHTREE_ERROR_MODE_RESTART,
+                          &slot_data);
+    total_us = boottime_in_usec() - start;
+
+    uefi_avb_get_alloc_stats(&stats);
+    if (slot_data) {
+      avb_slot_verify_data_free(slot_data);
+    }
+
+    sha_us = sha_rate ? io.io_bytes * 1000000 / sha_rate : 0;
+    info(L"avb run %ld: %a, total %ld us, I/O %ld us (%ld KiB in %ld reads)",
+         i,
+         avb_slot_verify_result_to_string(ret),
+         total_us,
+         io.io_us,
+         io.io_bytes / 1024,
+         io.io_requests);
+    info(L"avb run %ld: SHA-256 ~%ld us, RSA ~%ld us, %ld allocations (%ld KiB)",
+         i,
+         sha_us,
+         rsa_us,
+         stats.count,
+         stats.bytes / 1024);
+  }
+
+  ops->read_from_partition = io.read_from_partition;
+  uefi_avb_ops_free(ops);
+}
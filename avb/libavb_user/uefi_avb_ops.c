@@ -28,6 +28,8 @@
 #include "uefi_avb_util.h"
 #include "vars.h"
 #include "gpt.h"
+#include "misc_cache.h"
+#include "prefetch.h"
 #include "lib.h"
 #include "log.h"
 #include "security.h"
@@ -55,6 +57,18 @@ static AvbIOResult read_from_partition(__attribute__((unused)) AvbOps* ops,
   avb_assert(buf != NULL);
   avb_assert(out_num_read != NULL);
 
+  /* The A/B metadata is served from the misc partition cache. */
+  if (!avb_strcmp(partition_name, "misc") && offset_from_partition >= 0 &&
+      misc_cache_covers(offset_from_partition, num_bytes)) {
+    efi_ret = misc_cache_read(offset_from_partition, buf, num_bytes);
+    if (EFI_ERROR(efi_ret)) {
+      *out_num_read = 0;
+      return AVB_IO_RESULT_ERROR_IO;
+    }
+    *out_num_read = num_bytes;
+    return AVB_IO_RESULT_OK;
+  }
+
   label = stra_to_str((const CHAR8 *)partition_name);
 
   if (!label) {
@@ -65,6 +79,7 @@ static AvbIOResult read_from_partition(__attribute__((unused)) AvbOps* ops,
   efi_ret = gpt_get_partition_by_label(label, &gpart, LOGICAL_UNIT_USER);
   if (EFI_ERROR(efi_ret)) {
     error(L"Partition %s not found", label);
+    FreePool((VOID *)label);
     return AVB_IO_RESULT_ERROR_NO_SUCH_PARTITION;
   }
 
@@ -75,6 +90,7 @@ static AvbIOResult read_from_partition(__attribute__((unused)) AvbOps* ops,
   if (offset_from_partition < 0) {
     if ((-offset_from_partition) > partition_size) {
       avb_error("Offset outside range.\n");
+      FreePool((VOID *)label);
       return AVB_IO_RESULT_ERROR_RANGE_OUTSIDE_PARTITION;
     }
     offset_from_partition = partition_size - (-offset_from_partition);
@@ -88,6 +104,13 @@ static AvbIOResult read_from_partition(__attribute__((unused)) AvbOps* ops,
   else
     *out_num_read = num_bytes;
 
+  prefetch_record(label, offset_from_partition, *out_num_read);
+  if (prefetch_read(label, offset_from_partition, *out_num_read, buf)) {
+    FreePool((VOID *)label);
+    return AVB_IO_RESULT_OK;
+  }
+  FreePool((VOID *)label);
+
   efi_ret = uefi_call_wrapper(
       gpart.dio->ReadDisk,
       5,
@@ -119,6 +142,13 @@ static AvbIOResult write_to_partition(__attribute__((unused)) AvbOps* ops,
   avb_assert(partition_name != NULL);
   avb_assert(buf != NULL);
 
+  /* Served by the write-through misc cache. */
+  if (!avb_strcmp(partition_name, "misc") && offset_from_partition >= 0 &&
+      misc_cache_covers(offset_from_partition, num_bytes)) {
+    efi_ret = misc_cache_write(offset_from_partition, buf, num_bytes);
+    return EFI_ERROR(efi_ret) ? AVB_IO_RESULT_ERROR_IO : AVB_IO_RESULT_OK;
+  }
+
   label = stra_to_str((const CHAR8 *)partition_name);
   if (!label) {
     error(L"out of memory");
@@ -104,6 +104,17 @@ void avb_printv_ui(const char* message, ...) {
 }
 #endif
 
+static struct uefi_avb_alloc_stats alloc_stats;
+
+void uefi_avb_get_alloc_stats(struct uefi_avb_alloc_stats* stats) {
+  *stats = alloc_stats;
+}
+
+void uefi_avb_reset_alloc_stats(void) {
+  alloc_stats.count = 0;
+  alloc_stats.bytes = 0;
+}
+
 void* avb_malloc_(size_t size) {
   EFI_STATUS err;
   void* x;
@@ -114,6 +125,8 @@ void* avb_malloc_(size_t size) {
     return NULL;
   }
 
+  alloc_stats.count++;
+  alloc_stats.bytes += size;
   return x;
 }
 
@@ -38,4 +38,15 @@ bool uefi_avb_utf8_to_ucs2(const uint8_t* utf8_data,
                            size_t ucs2_data_capacity_num_bytes,
                            size_t* out_ucs2_data_num_bytes);
 
+/* Number and total size of the avb_malloc_() calls since the last
+ * uefi_avb_reset_alloc_stats() call.
+ */
+struct uefi_avb_alloc_stats {
+  size_t count;
+  size_t bytes;
+};
+
+void uefi_avb_get_alloc_stats(struct uefi_avb_alloc_stats* stats);
+void uefi_avb_reset_alloc_stats(void);
+
 #endif /* UEFI_AVB_UTIL_H_ */
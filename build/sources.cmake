@@ -186,13 +186,19 @@ set(LIB_KERNELFLINGER_SOURCES
 	${LIB_KERNELFLINGER_SOURCE}/acpi.c
 	${LIB_KERNELFLINGER_SOURCE}/acpi_image.c
 	${LIB_KERNELFLINGER_SOURCE}/lib.c
+	${LIB_KERNELFLINGER_SOURCE}/arena.c
+	${LIB_KERNELFLINGER_SOURCE}/alloc_prof.c
 	${LIB_KERNELFLINGER_SOURCE}/options.c
 	${LIB_KERNELFLINGER_SOURCE}/vars.c
 	${LIB_KERNELFLINGER_SOURCE}/log.c
 	${LIB_KERNELFLINGER_SOURCE}/em.c
 	${LIB_KERNELFLINGER_SOURCE}/gpt.c
+	${LIB_KERNELFLINGER_SOURCE}/misc_cache.c
+	${LIB_KERNELFLINGER_SOURCE}/handoff.c
+	${LIB_KERNELFLINGER_SOURCE}/prefetch.c
 	${LIB_KERNELFLINGER_SOURCE}/storage.c
 	${LIB_KERNELFLINGER_SOURCE}/pci.c
+	${LIB_KERNELFLINGER_SOURCE}/mp.c
 	${LIB_KERNELFLINGER_SOURCE}/mmc.c
 	${LIB_KERNELFLINGER_SOURCE}/ufs.c
 	${LIB_KERNELFLINGER_SOURCE}/sdcard.c
@@ -203,6 +209,7 @@ set(LIB_KERNELFLINGER_SOURCES
 	${LIB_KERNELFLINGER_SOURCE}/smbios.c
 	${LIB_KERNELFLINGER_SOURCE}/oemvars.c
 	${LIB_KERNELFLINGER_SOURCE}/text_parser.c
+	${LIB_KERNELFLINGER_SOURCE}/drbg.c
 	${LIB_KERNELFLINGER_SOURCE}/watchdog.c
 	${LIB_KERNELFLINGER_SOURCE}/life_cycle.c
 	${LIB_KERNELFLINGER_SOURCE}/qsort.c
@@ -132,6 +132,21 @@ struct BERT_TABLE {
 	UINT64 region;			/* Physical address of BERT region */
 };
 
+/* MCFG (PCI Express memory mapped configuration space base address
+ * description table) as defined in the PCI Firmware specification */
+struct MCFG_ALLOCATION {
+	UINT64 base;			/* ECAM base address of bus 0 */
+	UINT16 segment;			/* PCI segment group number */
+	UINT8 start_bus;		/* First decoded bus number */
+	UINT8 end_bus;			/* Last decoded bus number */
+	UINT32 reserved;
+};
+
+struct MCFG_TABLE {
+	struct ACPI_DESC_HEADER header;
+	UINT64 reserved;
+	struct MCFG_ALLOCATION allocation[];
+};
 
 struct ACPI_INFO {
 	UINT32 MediaId;
@@ -0,0 +1,91 @@
+/*
+ * Copyright (c) 2020, Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef _ALLOC_PROF_H_
+#define _ALLOC_PROF_H_
+
+#include <efi.h>
+#include <efiapi.h>
+
+/* When kernelflinger is built with ALLOC_PROFILE, the pool allocation
+ * functions are redirected to the allocation profiler which accounts
+ * the allocations per call site.  The memory allocated and freed by the
+ * gnu-efi library itself is not accounted. */
+
+struct alloc_site {
+	const char *file;
+	UINT32 line;
+	UINTN count;
+	UINTN bytes;
+	UINTN live_count;
+	UINTN live_bytes;
+};
+
+struct alloc_prof_stats {
+	UINTN allocs;
+	UINTN frees;
+	UINTN live_bytes;
+	UINTN peak_bytes;
+	UINTN untracked;
+};
+
+#ifdef ALLOC_PROFILE
+/* The gnu-efi prototypes must be parsed before the macros below are
+ * defined, whatever the include order of the including file. */
+#include <efilib.h>
+
+VOID *alloc_prof_alloc(UINTN size, BOOLEAN zero, const char *file, UINT32 line);
+VOID *alloc_prof_realloc(VOID *old, UINTN old_size, UINTN new_size,
+			 const char *file, UINT32 line);
+VOID alloc_prof_free(VOID *ptr);
+
+#ifndef ALLOC_PROF_NO_WRAP
+#define AllocatePool(size)						\
+	alloc_prof_alloc(size, FALSE, __FILE__, __LINE__)
+#define AllocateZeroPool(size)						\
+	alloc_prof_alloc(size, TRUE, __FILE__, __LINE__)
+#define ReallocatePool(old, old_size, new_size)				\
+	alloc_prof_realloc(old, old_size, new_size, __FILE__, __LINE__)
+#define FreePool(ptr)							\
+	alloc_prof_free(ptr)
+#endif
+#endif
+
+/* Calls CALLBACK on the allocation call sites, sorted by decreasing
+ * live bytes and then by decreasing allocated bytes.  Returns
+ * EFI_UNSUPPORTED if the profiler is not built in. */
+EFI_STATUS alloc_prof_report(void (*callback)(struct alloc_site *site,
+					      VOID *context),
+			     VOID *context);
+EFI_STATUS alloc_prof_get_stats(struct alloc_prof_stats *stats);
+void alloc_prof_reset(void);
+
+#endif	/* _ALLOC_PROF_H_ */
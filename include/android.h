@@ -391,9 +391,56 @@ EFI_STATUS get_bootimage_blob(VOID *bootimage, enum blobtype btype, VOID **blob,
 /* Get a pointer and size to the 2ndstage area of a boot image */
 EFI_STATUS get_bootimage_2nd(VOID *bootimage, VOID **second, UINT32 *size);
 
-EFI_STATUS prepend_command_line(CHAR16 **cmdline, CHAR16 *fmt, ...);
+/* Kernel command line under construction.  The content lives in the
+ * middle of BUF so that both prepending and appending a fragment only
+ * move the fragment itself, the buffer grows geometrically.  The
+ * content is always NUL terminated. */
+struct cmdline {
+        CHAR8 *buf;
+        UINTN size;
+        UINTN start;            /* Offset of the first character */
+        UINTN end;              /* Offset of the NUL terminator */
+#ifndef USER
+        CHAR16 *reference;      /* See android_check_command_line() */
+#endif
+};
+
+EFI_STATUS cmdline_init(struct cmdline *cmdline, const CHAR8 *str);
+void cmdline_free(struct cmdline *cmdline);
+
+/* Insert the formatted fragment followed by a space at the beginning
+ * of the command line. */
+EFI_STATUS prepend_command_line(struct cmdline *cmdline, CHAR16 *fmt, ...);
+/* Same as prepend_command_line() for a raw CHAR8 string, no
+ * intermediate CHAR16 copy is made. */
+EFI_STATUS prepend_command_line_str(struct cmdline *cmdline, const CHAR8 *str);
+/* Insert a space followed by the formatted fragment at the end of the
+ * command line. */
+EFI_STATUS append_command_line(struct cmdline *cmdline, CHAR16 *fmt, ...);
+
+static inline CHAR8 *cmdline_str(struct cmdline *cmdline)
+{
+        return cmdline->buf + cmdline->start;
+}
+
+static inline UINTN cmdline_len(struct cmdline *cmdline)
+{
+        return cmdline->end - cmdline->start;
+}
+
+#ifndef USER
+/* Sets up the kernel command line of BOOTIMAGE for BOOT_TARGET and
+ * returns a copy of it along with REFERENCE, the line the former
+ * implementation built by rebuilding the whole CHAR16 string for
+ * every fragment.  Both must be freed by the caller. */
+EFI_STATUS android_check_command_line(IN UINT8 *bootimage,
+                                      IN UINT8 *vendorbootimage,
+                                      IN enum boot_target boot_target,
+                                      OUT CHAR8 **cmdline,
+                                      OUT CHAR16 **reference);
+#endif
 
-EFI_STATUS prepend_slot_command_line(CHAR16 **cmdline16,
+EFI_STATUS prepend_slot_command_line(struct cmdline *cmdline,
                                      enum boot_target boot_target,
                                      VBDATA *vb_data);
 
@@ -27,7 +27,8 @@ AvbOps *avb_init(void);
 
 bool avb_update_stored_rollback_indexes_for_slot(AvbOps* ops, AvbSlotVerifyData* slot_data);
 
-EFI_STATUS prepend_slot_command_line(CHAR16 **cmdline16,
+struct cmdline;
+EFI_STATUS prepend_slot_command_line(struct cmdline *cmdline,
         enum boot_target boot_target,
         VBDATA *vb_data);
 
@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2020, Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef _ARENA_H_
+#define _ARENA_H_
+
+#include <efi.h>
+#include <efiapi.h>
+
+/* The arena is a bump allocator for short-lived allocations.  A scope
+ * is opened by arena_push() and everything allocated since is released
+ * at once by arena_pop().  Arena allocations must not be given to
+ * FreePool() and must not outlive the scope they were made in.
+ *
+ *	arena_mark_t mark = arena_push();
+ *	label = arena_stra_to_str(argv[1]);
+ *	...
+ *	arena_pop(mark);
+ */
+
+typedef UINTN arena_mark_t;
+
+struct arena_stats {
+	UINTN size;
+	UINTN used;
+	UINTN peak;
+	UINTN allocs;
+	UINTN failures;
+};
+
+/* Opens a new scope, the backing store is allocated on first use. */
+arena_mark_t arena_push(void);
+/* Releases all the allocations made since the matching arena_push(). */
+void arena_pop(arena_mark_t mark);
+/* Returns NULL if there is no open scope or if the arena is full. */
+VOID *arena_alloc(UINTN size);
+CHAR16 *arena_stra_to_str(const CHAR8 *stra);
+CHAR8 *arena_str_to_stra(const CHAR16 *str);
+void arena_get_stats(struct arena_stats *stats);
+void arena_free(void);
+
+#endif	/* _ARENA_H_ */
@@ -52,6 +52,17 @@ struct fastboot_cmd {
 	fastboot_handle handle;
 };
 
+/* Command table kept sorted by name so that commands are looked up
+   with a binary search.  Registering a command does not allocate
+   memory, a command registered with an already used name replaces
+   the previous one.  */
+#define FASTBOOT_MAX_CMDS 64
+
+struct cmdlist {
+	struct fastboot_cmd *cmds[FASTBOOT_MAX_CMDS];
+	UINTN count;
+};
+
 typedef struct cmdlist *cmdlist_t;
 
 struct download_buffer {
@@ -62,10 +73,18 @@ struct download_buffer {
 
 struct download_buffer *fastboot_download_buffer(void);
 
+/* Append data to the buffer the host can fetch with the "upload"
+   command right after the current command.  fastboot_stage_line()
+   appends STR followed by a newline and can be used as a
+   parse_text_buffer() callback.  */
+EFI_STATUS fastboot_stage(const void *data, UINTN size);
+EFI_STATUS fastboot_stage_line(char *str, void *context);
+void fastboot_stage_free(void);
+
 struct fastboot_cmd *fastboot_get_root_cmd(const char *name);
 EFI_STATUS fastboot_register(struct fastboot_cmd *cmd);
-EFI_STATUS fastboot_register_into(cmdlist_t *list, struct fastboot_cmd *cmd);
-void fastboot_cmdlist_unregister(cmdlist_t *list);
+EFI_STATUS fastboot_register_into(cmdlist_t list, struct fastboot_cmd *cmd);
+void fastboot_cmdlist_unregister(cmdlist_t list);
 void fastboot_run_cmd(cmdlist_t list, const char *name, INTN argc, CHAR8 **argv);
 void fastboot_run_root_cmd(const char *name, INTN argc, CHAR8 **argv);
 
@@ -75,6 +94,27 @@ void fastboot_fail(const char *fmt, ...);
 void fastboot_info(const char *fmt, ...);
 EFI_STATUS fastboot_info_long_string(char *str, void *context);
 
+/* Transfer statistics recorded by the fastboot core for the
+   transport benchmark.  */
+#define XFER_HIST_BUCKETS 16
+
+struct fastboot_xfer_stats {
+	BOOLEAN rx;
+	UINT64 start;		/* us */
+	UINT64 last;		/* us */
+	UINT64 bytes;
+	UINTN requests;
+	UINTN max_queued;
+	/* Bucket N counts the transfers completed between 2^N and
+	   2^(N+1) us after the previous one.  */
+	UINTN hist[XFER_HIST_BUCKETS];
+};
+
+/* Record the next download (RX) or the next upload (!RX) into
+   STATS.  The recording stops at the end of the transfer
+   or when called with a NULL STATS.  */
+void fastboot_xfer_stats_arm(struct fastboot_xfer_stats *stats, BOOLEAN rx);
+
 EFI_STATUS fastboot_set_command_buffer(char *buffer, UINTN size);
 EFI_STATUS fastboot_start(void **bootimage, void **efiimage,
 			  UINTN *imagesize, enum boot_target *target);
@@ -85,4 +125,11 @@ EFI_STATUS refresh_partition_var(void);
 
 void fastboot_reboot(enum boot_target target, CHAR16 *msg);
 
+#ifndef USER
+/* Flash pipeline benchmark against a memory backed block device */
+void fastboot_flash_bench(void);
+/* Command dispatch benchmark on a scripted command stream */
+void fastboot_dispatch_bench(void);
+#endif
+
 #endif	/* _FASTBOOT_H_ */
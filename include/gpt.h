@@ -97,11 +97,18 @@ EFI_STATUS gpt_refresh(void);
 EFI_STATUS gpt_get_root_disk(struct gpt_partition_interface *gpart, logical_unit_t log_unit);
 EFI_STATUS gpt_get_partition_uuid(const CHAR16 *label, EFI_GUID *uuid, logical_unit_t log_unit);
 EFI_STATUS gpt_get_partition_type(const CHAR16 *label, EFI_GUID *type, logical_unit_t log_unit);
-EFI_STATUS gpt_swap_partition(const CHAR16 *label1, const CHAR16 *label2, logical_unit_t log_unit);
+EFI_STATUS gpt_swap_partition(const CHAR16 *label1, const CHAR16 *label2, logical_unit_t log_unit,
+			      UINT64 *written);
 EFI_STATUS gpt_sync(void);
 EFI_STATUS gpt_get_partition_handle(const CHAR16 *label, logical_unit_t log_unit, EFI_HANDLE *handle);
 EFI_STATUS gpt_get_header(struct gpt_header **header, UINTN *size, logical_unit_t log_unit);
 EFI_STATUS gpt_get_partitions(struct gpt_partition **partitions, UINTN *size, logical_unit_t log_unit);
+/* Expose and seed the cached partition table of the user logical
+ * unit, used to hand the partition table over to the next stage. */
+EFI_STATUS gpt_get_cache(EFI_HANDLE *disk, struct gpt_header **header,
+			 struct gpt_partition **partitions, UINTN *count);
+EFI_STATUS gpt_set_cache(EFI_HANDLE disk, struct gpt_header *header,
+			 struct gpt_partition *partitions, UINTN count);
 
 UINT64 get_partition_start(struct gpt_partition_interface *gparti);
 UINT64 get_partition_size(struct gpt_partition_interface *gparti);
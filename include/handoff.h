@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) 2020, Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef _HANDOFF_H_
+#define _HANDOFF_H_
+
+#include <efi.h>
+#include <efiapi.h>
+#include "gpt.h"
+
+/* kfld hands the boot device, the partition table of the user
+ * logical unit and the misc partition content it has already read
+ * over to kernelflinger through an EFI configuration table.
+ * Kernelflinger adopts it instead of identifying the storage and
+ * reading the disk again. */
+
+#define KFLD_HANDOFF_GUID \
+	{ 0xa574b6c0, 0xc5b1, 0x4c31, { 0x8c, 0x38, 0xde, 0x1b, 0x20, 0x28, 0x5c, 0x8c } }
+
+#define KFLD_HANDOFF_MAGIC	0x464f4448	/* "HDOF" */
+#define KFLD_HANDOFF_VERSION	1
+
+struct kfld_handoff {
+	UINT32 magic;
+	UINT32 version;
+	UINT32 size;			/* Including the variable length data */
+	UINT32 crc32;			/* Computed with this field set to 0 */
+	UINT32 storage_type;
+	UINT32 nb_partitions;
+	UINT32 misc_size;
+	UINT32 device_path_size;
+	EFI_HANDLE disk;		/* Disk of the user logical unit */
+	struct gpt_header gpt_hd;
+	/* Followed by the partition entries, the misc content and the
+	 * device path of DISK. */
+	UINT8 data[];
+};
+
+/* Installs the handoff.  It is called by kfld right before it starts
+ * kernelflinger. */
+EFI_STATUS handoff_publish(void);
+
+/* Removes and frees the handoff if the started image did not adopt
+ * it. */
+void handoff_withdraw(void);
+
+/* Validates the handoff, if any, and seeds the storage, partition
+ * table and misc caches from it.  DEVICE is the handle the image was
+ * loaded from, it must belong to the handed over disk. */
+EFI_STATUS handoff_adopt(EFI_HANDLE device);
+
+#endif	/* _HANDOFF_H_ */
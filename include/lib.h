@@ -249,6 +249,7 @@ void sort_memory_map(void *descr, UINTN nr_descr, UINTN descr_sz);
 UINT64 efi_time_to_ctime(EFI_TIME *time);
 
 VOID cpuid(UINT32 op, UINT32 reg[4]);
+VOID cpuid_count(UINT32 op, UINT32 count, UINT32 reg[4]);
 
 EFI_STATUS generate_random_numbers(CHAR8 *data, UINTN size);
 
@@ -260,5 +261,8 @@ EFI_STATUS string_to_argv(char *str, INTN *argc, CHAR8 *argv[], UINTN max_argc,
                           const char *first_delim, const char *delim);
 
 int is_running_on_kvm(void);
+
+/* Must come last, it may redirect the pool allocation functions. */
+#include <alloc_prof.h>
 #endif
 
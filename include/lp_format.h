@@ -0,0 +1,109 @@
+/*
+ * Copyright (c) 2020, Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef _LP_FORMAT_H_
+#define _LP_FORMAT_H_
+
+#include <efi.h>
+
+/* On-disk layout of the Android dynamic partitions metadata, as
+ * written by lpmake at the beginning of the super partition.  Only
+ * the fields needed by the bootloader are described. */
+
+#define LP_PARTITION_RESERVED_BYTES	4096
+#define LP_METADATA_GEOMETRY_MAGIC	0x616c4467
+#define LP_METADATA_GEOMETRY_SIZE	4096
+#define LP_METADATA_HEADER_MAGIC	0x414C5030
+#define LP_METADATA_MAJOR_VERSION	10
+#define LP_SECTOR_SIZE			512
+#define LP_NAME_LEN			36
+
+/* Offset of the primary metadata of slot 0. */
+#define LP_PRIMARY_METADATA_OFFSET \
+	(LP_PARTITION_RESERVED_BYTES + 2 * LP_METADATA_GEOMETRY_SIZE)
+
+#define LP_TARGET_TYPE_LINEAR	0
+#define LP_TARGET_TYPE_ZERO	1
+
+struct lp_geometry {
+	UINT32 magic;
+	UINT32 struct_size;
+	UINT8 checksum[32];
+	UINT32 metadata_max_size;
+	UINT32 metadata_slot_count;
+	UINT32 logical_block_size;
+} __attribute__((packed));
+
+struct lp_table_descriptor {
+	UINT32 offset;
+	UINT32 num_entries;
+	UINT32 entry_size;
+} __attribute__((packed));
+
+struct lp_header {
+	UINT32 magic;
+	UINT16 major_version;
+	UINT16 minor_version;
+	UINT32 header_size;
+	UINT8 header_checksum[32];
+	UINT32 tables_size;
+	UINT8 tables_checksum[32];
+	struct lp_table_descriptor partitions;
+	struct lp_table_descriptor extents;
+	struct lp_table_descriptor groups;
+	struct lp_table_descriptor block_devices;
+} __attribute__((packed));
+
+struct lp_partition {
+	char name[LP_NAME_LEN];
+	UINT32 attributes;
+	UINT32 first_extent_index;
+	UINT32 num_extents;
+	UINT32 group_index;
+} __attribute__((packed));
+
+struct lp_extent {
+	UINT64 num_sectors;
+	UINT32 target_type;
+	UINT64 target_data;
+	UINT32 target_source;
+} __attribute__((packed));
+
+struct lp_block_device {
+	UINT64 first_logical_sector;
+	UINT32 alignment;
+	UINT32 alignment_offset;
+	UINT64 size;
+	char partition_name[LP_NAME_LEN];
+	UINT32 flags;
+} __attribute__((packed));
+
+#endif	/* _LP_FORMAT_H_ */
@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) 2020, Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef _MISC_CACHE_H_
+#define _MISC_CACHE_H_
+
+#include <efi.h>
+#include <efiapi.h>
+
+/* The beginning of the misc partition is read once and cached.  The
+ * BCB and the A/B metadata are served from this cache.  Writes are
+ * written through: the modified sectors are written back right away
+ * in a single aligned write so that no halt, die or reset path can
+ * lose them. */
+
+/* Returns TRUE if the [OFFSET, OFFSET + SIZE[ range of the misc
+ * partition is handled by the cache, loading it if needed. */
+BOOLEAN misc_cache_covers(UINT64 offset, UINT64 size);
+
+EFI_STATUS misc_cache_read(UINTN offset, VOID *data, UINTN size);
+EFI_STATUS misc_cache_write(UINTN offset, const VOID *data, UINTN size);
+
+/* Expose and seed the cache content, used to hand the misc partition
+ * content over to the next stage.  The content is only valid until the
+ * next cache operation. */
+EFI_STATUS misc_cache_get(const VOID **data, UINTN *size);
+EFI_STATUS misc_cache_set(const VOID *data, UINTN size);
+
+/* Drops the cache content, including the modified sectors.  It must
+ * be called when the misc partition has been written directly, or
+ * when the partition table has changed. */
+void misc_cache_invalidate(void);
+
+#endif	/* _MISC_CACHE_H_ */
@@ -35,7 +35,14 @@
 
 #include <efi.h>
 
+struct oemvars_stats {
+	UINTN written;
+	UINTN unchanged;
+};
+
 EFI_STATUS flash_oemvars(VOID *data, UINTN size);
+/* Statistics of the last flash_oemvars*() call */
+void oemvars_get_stats(struct oemvars_stats *stats);
 EFI_STATUS flash_oemvars_silent_write_error(VOID *data, UINTN size,
 					    const EFI_GUID *restricted_guid);
 
@@ -44,6 +44,18 @@ typedef struct _pci_device_ids
 	UINT16 device_id;
 } pci_device_ids_t;
 
+#define PCI_CLASS_NETWORK	0x02
+#define PCI_CLASS_SERIAL	0x0C
+#define PCI_SUBCLASS_USB	0x03
+#define PCI_IF_USB_DEVICE	0xFE
+
+typedef struct _pci_class_code
+{
+	UINT8 prog_if;
+	UINT8 sub_class;
+	UINT8 base_class;
+} pci_class_code_t;
+
 /**
  * get_pci_device_path:
  * @p - Pointer to a EFI_DEVICE_PATH structure
@@ -57,30 +69,90 @@ typedef struct _pci_device_ids
 PCI_DEVICE_PATH *get_pci_device_path(EFI_DEVICE_PATH *p);
 
 /**
- * get_pci_device:
- * @p - Pointer to a EFI_DEVICE_PATH structure
- * @p_pciio - A corresponding EFI_PCI_IO_PROTOCOL handle if a PCI device was
- *            found in the Device Path parameter
+ * get_pci_ids:
+ * @pciio - The EFI_PCI_IO_PROTOCOL handle for a device
+ * @ids - Vendor and Device Ids
  *
- * Queries a Device Path to check if support the PciIoProtocol
+ * Reads the Vendor and Device IDs from the PCI configuration space
  *
  * Returns:
- * EFI_SUCCESS if the input path contains a PCI device
- * an EFI error protocol handle could not be opened
+ * EFI_SUCCESS - The operation succeeded
+ * an EFI Error if the values could not be read
  */
-EFI_STATUS get_pci_device(IN EFI_DEVICE_PATH *p, OUT EFI_PCI_IO **p_pciio);
+EFI_STATUS get_pci_ids(IN EFI_PCI_IO *pciio, OUT pci_device_ids_t *ids);
 
 /**
- * get_pci_ids:
+ * get_pci_class:
  * @pciio - The EFI_PCI_IO_PROTOCOL handle for a device
- * @ids - Vendor and Device Ids
+ * @class - Programming interface, sub-class and base class codes
  *
- * Reads the Vendor and Device IDs from the PCI configuration space
+ * Reads the Class Code from the PCI configuration space
  *
  * Returns:
  * EFI_SUCCESS - The operation succeeded
  * an EFI Error if the values could not be read
  */
-EFI_STATUS get_pci_ids(IN EFI_PCI_IO *pciio, OUT pci_device_ids_t *ids);
+EFI_STATUS get_pci_class(IN EFI_PCI_IO *pciio, OUT pci_class_code_t *class);
+
+#define PCI_MAX_BAR		6
+
+/* A PCI function of the boot-time inventory. */
+typedef struct _pci_device
+{
+	UINT16 segment;
+	UINT8 bus;
+	UINT8 device;
+	UINT8 function;
+	UINT8 revision;
+	pci_device_ids_t ids;
+	pci_class_code_t class;
+	UINT32 bar[PCI_MAX_BAR];
+	UINT64 ecam;		/* Config space MMIO address, 0 if none */
+	EFI_HANDLE handle;	/* Owning PciIo handle, NULL if none */
+	EFI_PCI_IO *pciio;
+} pci_device_t;
+
+/**
+ * pci_get_inventory:
+ * @devices - Returned array of PCI functions sorted by location
+ * @count - Returned number of entries in @devices
+ *
+ * Enumerates the PCI functions on the first call, through the ECAM
+ * windows described by the ACPI MCFG table when available and
+ * through the EFI_PCI_IO_PROTOCOL handles otherwise.  Subsequent
+ * calls return the cached inventory.  Each ECAM read is a VM exit on
+ * virtual machines: the boot flow sticks to the PciIo handles.
+ *
+ * Returns:
+ * EFI_SUCCESS - The operation succeeded
+ * an EFI Error if the enumeration failed
+ */
+EFI_STATUS pci_get_inventory(OUT pci_device_t **devices, OUT UINTN *count);
+
+/**
+ * pci_find_device:
+ * @handle - An EFI_PCI_IO_PROTOCOL handle
+ *
+ * Returns:
+ * the inventory entry of @handle, NULL if not found
+ */
+pci_device_t *pci_find_device(IN EFI_HANDLE handle);
+
+/**
+ * pci_read_config:
+ * @dev - An inventory entry
+ * @offset - Config space offset, multiple of 4
+ * @buf - Output buffer
+ * @size - Number of bytes to read, multiple of 4
+ *
+ * Reads the configuration space of @dev through ECAM if available,
+ * through its EFI_PCI_IO_PROTOCOL otherwise.
+ *
+ * Returns:
+ * EFI_SUCCESS - The operation succeeded
+ * an EFI Error if the values could not be read
+ */
+EFI_STATUS pci_read_config(IN pci_device_t *dev, IN UINT16 offset,
+			   OUT VOID *buf, IN UINTN size);
 
 #endif	/* _PCI_H_ */
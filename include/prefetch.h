@@ -0,0 +1,54 @@
+/*
+ * Copyright (c) 2020, Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef _PREFETCH_H_
+#define _PREFETCH_H_
+
+#include <efi.h>
+#include <efiapi.h>
+
+/* The partition ranges read during a normal boot are recorded and
+ * saved as the prefetch plan.  On the next boot, prefetch_start()
+ * reads the ranges of the plan up front, merged, and the partition
+ * reads which fall in a prefetched range are served from memory. */
+
+void prefetch_record(const CHAR16 *label, UINT64 offset, UINT64 length);
+EFI_STATUS prefetch_start(void);
+/* Returns TRUE if BUF has been filled from a prefetched range. */
+BOOLEAN prefetch_read(const CHAR16 *label, UINT64 offset, UINTN size, VOID *buf);
+/* Saves the recorded ranges as the plan of the next boot if they
+ * differ from the current plan. */
+EFI_STATUS prefetch_save(void);
+/* Releases the prefetched data.  Called once the boot images are
+ * verified and by any flash or erase operation. */
+void prefetch_free(void);
+
+#endif	/* _PREFETCH_H_ */
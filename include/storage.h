@@ -78,13 +78,40 @@ EFI_STATUS identify_boot_device(enum storage_type type);
 PCI_DEVICE_PATH *get_boot_device(void);
 const char* get_boot_device_var(void);
 EFI_HANDLE get_boot_device_handle(void);
+/* Disk of the user logical unit saved by a previous boot, if it was
+ * used to identify the boot device */
+EFI_HANDLE storage_get_boot_device_hint(void);
+void storage_save_boot_device_hint(EFI_HANDLE disk);
 EFI_STATUS get_boot_device_type(enum storage_type *type);
 EFI_STATUS storage_set_boot_device(EFI_HANDLE device);
+/* Same as storage_set_boot_device() but only probes the storage TYPE
+ * already identified by the previous boot stage */
+EFI_STATUS storage_adopt_boot_device(EFI_HANDLE device, enum storage_type type);
 EFI_STATUS storage_check_logical_unit(EFI_DEVICE_PATH *p, logical_unit_t log_unit);
 EFI_STATUS storage_erase_blocks(EFI_HANDLE handle, EFI_BLOCK_IO *bio, EFI_LBA start, EFI_LBA end);
+/* Same as storage_erase_blocks() but never writes the blocks: only
+ * the erase groups fully covered by the range are erased, and nothing
+ * is done if the media does not support the erase block protocol */
+EFI_STATUS storage_discard_blocks(EFI_HANDLE handle, EFI_BLOCK_IO *bio, EFI_LBA start, EFI_LBA end);
 EFI_STATUS storage_get_erase_block_size(UINTN *erase_blk_size);
+#ifdef USB_STORAGE
+struct usb_erase_stats {
+	UINTN count;
+	UINTN errors;
+	UINT64 bytes;
+	UINT64 total_usec;
+	UINT64 max_usec;
+};
+
+/* SCSI commands statistics of the last USB storage erase */
+void usb_storage_get_erase_stats(struct usb_erase_stats *stats);
+#endif
 EFI_STATUS fill_with(EFI_BLOCK_IO *bio, EFI_LBA start, EFI_LBA end,
 		     VOID *pattern, UINTN pattern_blocks);
+/* Same as fill_with() but BUFFER is refilled by GENERATE before each write */
+EFI_STATUS fill_with_random(EFI_BLOCK_IO *bio, EFI_LBA start, EFI_LBA end,
+			    VOID *buffer, UINTN buffer_blocks,
+			    EFI_STATUS (*generate)(CHAR8 *data, UINTN size));
 EFI_STATUS fill_zero(EFI_BLOCK_IO *bio, EFI_LBA start, EFI_LBA end);
 BOOLEAN is_cur_storage_ufs(void);
 EFI_STATUS get_logical_block_size(UINTN *logical_blk_size);
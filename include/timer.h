@@ -47,6 +47,7 @@ enum TM_POINT {
 
 uint32_t get_cpu_freq(void);
 uint32_t boottime_in_msec(void);
+uint64_t boottime_in_usec(void);
 void set_boottime_stamp(int num);
 void set_efi_enter_point(unsigned int value);
 void construct_stages_boottime(CHAR8 *time_str, size_t buf_len);
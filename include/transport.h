@@ -49,6 +49,9 @@ typedef struct transport {
 	EFI_STATUS (*run)(void);
 	EFI_STATUS (*read)(void *buf, UINT32 size);
 	EFI_STATUS (*write)(void *buf, UINT32 size);
+	/* Number of write requests the transport accepts before
+	   the first one completes, 0 means 1.  */
+	UINTN max_tx_inflight;
 } transport_t;
 
 EFI_STATUS transport_register(transport_t *trans, UINTN nb);
@@ -61,5 +64,6 @@ EFI_STATUS transport_stop(void);
 EFI_STATUS transport_run(void);
 EFI_STATUS transport_read(void *buf, UINT32 len);
 EFI_STATUS transport_write(void *buf, UINT32 len);
+UINTN transport_max_tx_inflight(void);
 
 #endif	/* _TRANSPORT_H_ */
@@ -62,5 +62,8 @@ EFI_STATUS uefi_enter_binary(EFI_HANDLE part_handle, CHAR16 *path,
 EFI_STATUS uefi_check_upgrade(EFI_LOADED_IMAGE *loaded_image,
 		CHAR16 *partition, CHAR16 *upgrade_file,
 		CHAR16 *self_path1, CHAR16 *bak_path1, CHAR16 *self_path2, CHAR16 *bak_path2);
+/* Returns the size of PATH including its end node or 0 if PATH is not
+ * terminated within MAX_SIZE bytes. */
+UINTN uefi_device_path_size(EFI_DEVICE_PATH *path, UINTN max_size);
 
 #endif /* __UEFI_UTILS_H__ */
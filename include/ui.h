@@ -62,6 +62,8 @@ EFI_STATUS ui_image_draw(ui_image_t *image, UINTN x, UINTN y);
 EFI_STATUS ui_image_draw_scale(ui_image_t *image, UINTN x,
 			       UINTN y, UINTN width, UINTN height);
 ui_image_t *ui_image_get(const char *name);
+/* Same as ui_image_get() but does not decode the image */
+ui_image_t *ui_image_find(const char *name);
 
 /* Font */
 typedef struct ui_font {
@@ -171,6 +173,11 @@ EFI_STATUS ui_init(UINTN *width, UINTN *height);
 BOOLEAN ui_is_ready();
 void ui_free(void);
 EFI_STATUS ui_display_vendor_splash(VOID);
+/* Display the vendor splash in two steps: the image is decoded and
+ * scaled on an application processor, if any, between
+ * ui_vendor_splash_start() and ui_vendor_splash_finish() */
+EFI_STATUS ui_vendor_splash_start(VOID);
+EFI_STATUS ui_vendor_splash_finish(VOID);
 EFI_STATUS ui_fill_area(UINTN x, UINTN y, UINTN width, UINTN height,
 			EFI_GRAPHICS_OUTPUT_BLT_PIXEL *color);
 EFI_STATUS ui_clear_area(UINTN x, UINTN y, UINTN width, UINTN height);
@@ -39,4 +39,15 @@ EFI_STATUS upng_load(const char *data, UINTN size,
 		     EFI_GRAPHICS_OUTPUT_BLT_PIXEL **blt,
 		     UINTN *width, UINTN *height);
 
+/* upng_load() in two steps.  upng_prepare() parses the PNG headers and
+ * allocates all the buffers.  upng_finish() decodes the image and does
+ * not use any EFI service, it can run on an application processor.
+ * The BLT buffer returned by upng_finish() belongs to the caller. */
+typedef struct upng_job upng_job_t;
+
+EFI_STATUS upng_prepare(const char *data, UINTN size, upng_job_t **job,
+		       UINTN *width, UINTN *height);
+EFI_STATUS upng_finish(upng_job_t *job, EFI_GRAPHICS_OUTPUT_BLT_PIXEL **blt);
+void upng_job_free(upng_job_t *job);
+
 #endif	/* _UPNG_H_ */
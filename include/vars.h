@@ -71,6 +71,18 @@ extern const EFI_GUID fastboot_guid;
 /* EFI variable to store the kernelflinger logs.  */
 #define LOG_VAR			L"KernelflingerLogs"
 
+/* EFI variable which stores the device path of the controller used by
+ * fastboot the last time it was entered on KVM.  */
+#define FASTBOOT_DEVICE_PATH_VAR	L"FastbootDevicePath"
+
+/* EFI variable which stores the type and the device path of the boot
+ * storage selected by the previous boot.  */
+#define BOOT_DEVICE_HINT_VAR	L"BootDeviceHint"
+
+/* EFI variable which stores the partition ranges read by the previous
+ * normal boot.  */
+#define PREFETCH_PLAN_VAR	L"BootPrefetchPlan"
+
 #ifndef USER
 #define CMDLINE_PREPEND_VAR     L"PrependCmdline"
 #define CMDLINE_APPEND_VAR      L"AppendCmdline"
@@ -35,6 +35,7 @@
 #include <stdio.h>
 #include <transport.h>
 #include <version.h>
+#include <openssl/evp.h>
 
 #include "lib.h"
 #include "uefi_utils.h"
@@ -60,7 +61,6 @@ static fastboot_handle fastboot_flash_cmd;
 static fastboot_handle fastboot_erase_cmd;
 static EFI_FILE_IO_INTERFACE *file_io_interface;
 static data_callback_t fastboot_rx_cb, fastboot_tx_cb;
-static BOOLEAN need_tx_cb;
 static char *fastboot_cmd_buf;
 static UINTN fastboot_cmd_buf_len;
 static char command_buffer[256]; /* Large enough to fit long filename
@@ -73,18 +73,9 @@ static struct download_buffer *dl;
 
 #define MAX_LABEL_LEN 64
 
-static void flush_tx_buffer(void)
-{
-	while (need_tx_cb) {
-		need_tx_cb = FALSE;
-		fastboot_tx_cb(NULL, 0);
-	}
-}
-
 static void do_erase(INTN argc, CHAR8 **argv)
 {
 	fastboot_erase_cmd(argc, argv);
-	flush_tx_buffer();
 }
 
 static EFI_STATUS find_partition(CHAR8 *target)
@@ -168,7 +159,6 @@ static void installer_flash_buffer(void *data, unsigned size,
 	dl->size = size;
 
 	fastboot_flash_cmd(argc, argv);
-	flush_tx_buffer();
 
 	dl->data = data_save;
 	dl->size = 0;
@@ -577,10 +567,274 @@ exit:
 	uefi_call_wrapper(file->Close, 1, file);
 }
 
+/* The installer manifest lists the expected content of the
+ * partitions.  Each line is "<file> <partition> <size> <sha256>"
+ * where SIZE and SHA256 describe the first bytes of PARTITION once
+ * FILE has been flashed.  SHA256 can be replaced by '-' for raw
+ * images: the file is then compared with the partition range by
+ * range.  The flash of FILE is skipped if the partition content
+ * already matches. */
+#define MANIFEST_SUFFIX L".manifest"
+#define SHA256_LEN 32
+#define COMPARE_CHUNK (1024 * 1024)
+
+static struct manifest_entry {
+	char *filename;
+	char *partition;
+	UINT64 size;
+	BOOLEAN has_digest;
+	UINT8 digest[SHA256_LEN];
+} *manifest;
+static UINTN manifest_nb;
+
+static void free_manifest(void)
+{
+	UINTN i;
+
+	if (!manifest)
+		return;
+
+	for (i = 0; i < manifest_nb; i++) {
+		FreePool(manifest[i].filename);
+		FreePool(manifest[i].partition);
+	}
+
+	FreePool(manifest);
+	manifest = NULL;
+	manifest_nb = 0;
+}
+
+static int hex_value(char c)
+{
+	if (isdigit(c))
+		return c - '0';
+	c = tolower(c);
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	return -1;
+}
+
+static EFI_STATUS parse_digest(char *str, UINT8 *digest)
+{
+	int hi, lo;
+	UINTN i;
+
+	if (strlen((CHAR8 *)str) != SHA256_LEN * 2)
+		return EFI_INVALID_PARAMETER;
+
+	for (i = 0; i < SHA256_LEN; i++) {
+		hi = hex_value(str[2 * i]);
+		lo = hex_value(str[2 * i + 1]);
+		if (hi < 0 || lo < 0)
+			return EFI_INVALID_PARAMETER;
+		digest[i] = (hi << 4) | lo;
+	}
+
+	return EFI_SUCCESS;
+}
+
+static EFI_STATUS store_manifest_entry(char *line, VOID *context _unused)
+{
+	struct manifest_entry *entries, *entry;
+	char *filename, *partition, *size, *digest, *end, *saveptr;
+
+	if (*line == '#')
+		return EFI_SUCCESS;
+
+	filename = strtok_r(line, " \t", &saveptr);
+	partition = strtok_r(NULL, " \t", &saveptr);
+	size = strtok_r(NULL, " \t", &saveptr);
+	digest = strtok_r(NULL, " \t", &saveptr);
+	if (!filename || !partition || !size || !digest ||
+	    strtok_r(NULL, " \t", &saveptr))
+		return EFI_INVALID_PARAMETER;
+
+	entries = ReallocatePool(manifest, manifest_nb * sizeof(*manifest),
+				 (manifest_nb + 1) * sizeof(*manifest));
+	if (!entries)
+		return EFI_OUT_OF_RESOURCES;
+	manifest = entries;
+
+	entry = &manifest[manifest_nb];
+	entry->size = strtoull(size, &end, 0);
+	if (*end)
+		return EFI_INVALID_PARAMETER;
+
+	entry->has_digest = strcmp((CHAR8 *)digest, (CHAR8 *)"-") != 0;
+	if (entry->has_digest && EFI_ERROR(parse_digest(digest, entry->digest)))
+		return EFI_INVALID_PARAMETER;
+
+	entry->filename = strdup(filename);
+	entry->partition = strdup(partition);
+	if (!entry->filename || !entry->partition) {
+		if (entry->filename)
+			FreePool(entry->filename);
+		if (entry->partition)
+			FreePool(entry->partition);
+		return EFI_OUT_OF_RESOURCES;
+	}
+
+	manifest_nb++;
+	return EFI_SUCCESS;
+}
+
+/* Load the manifest which goes with the BATCH file, if any: the
+   extension of BATCH is replaced by ".manifest". */
+static EFI_STATUS load_manifest(CHAR16 *batch)
+{
+	EFI_STATUS ret;
+	CHAR16 *filename, *ext;
+	void *data;
+	UINTN size;
+
+	free_manifest();
+
+	size = (StrLen(batch) + ARRAY_SIZE(MANIFEST_SUFFIX)) * sizeof(CHAR16);
+	filename = AllocatePool(size);
+	if (!filename)
+		return EFI_OUT_OF_RESOURCES;
+
+	StrCpy(filename, batch);
+	for (ext = filename + StrLen(filename); ext > filename; ext--)
+		if (*ext == L'.' || *ext == L'/' || *ext == L'\\')
+			break;
+	if (*ext != L'.')
+		ext = filename + StrLen(filename);
+	StrCpy(ext, MANIFEST_SUFFIX);
+
+	ret = uefi_read_file(file_io_interface, filename, &data, &size);
+	if (EFI_ERROR(ret)) {
+		debug(L"No %s manifest file", filename);
+		FreePool(filename);
+		return EFI_SUCCESS;
+	}
+
+	ret = parse_text_buffer(data, size, store_manifest_entry, NULL);
+	FreePool(data);
+	if (EFI_ERROR(ret)) {
+		efi_perror(ret, L"Failed to parse %s, ignoring it", filename);
+		free_manifest();
+	}
+
+	FreePool(filename);
+	return EFI_SUCCESS;
+}
+
+static struct manifest_entry *find_manifest_entry(CHAR8 *filename, CHAR8 *partition)
+{
+	UINTN i;
+
+	for (i = 0; i < manifest_nb; i++)
+		if (!strcmp((CHAR8 *)manifest[i].filename, filename) &&
+		    !strcmp((CHAR8 *)manifest[i].partition, partition))
+			return &manifest[i];
+
+	return NULL;
+}
+
+static BOOLEAN digest_matches(struct gpt_partition_interface *gparti,
+			      struct manifest_entry *entry, void *buf)
+{
+	EVP_MD_CTX mdctx;
+	UINT8 digest[SHA256_LEN];
+	UINT64 offset, len;
+	EFI_STATUS ret = EFI_SUCCESS;
+
+	EVP_MD_CTX_init(&mdctx);
+	EVP_DigestInit_ex(&mdctx, EVP_sha256(), NULL);
+
+	for (offset = 0; offset < entry->size; offset += len) {
+		len = min(entry->size - offset, (UINT64)COMPARE_CHUNK);
+		ret = read_partition(gparti, offset, len, buf);
+		if (EFI_ERROR(ret))
+			break;
+		EVP_DigestUpdate(&mdctx, buf, len);
+	}
+	EVP_DigestFinal_ex(&mdctx, digest, NULL);
+	EVP_MD_CTX_cleanup(&mdctx);
+
+	return !EFI_ERROR(ret) && !memcmp(digest, entry->digest, sizeof(digest));
+}
+
+static BOOLEAN content_matches(struct gpt_partition_interface *gparti,
+			       struct manifest_entry *entry, CHAR16 *filename,
+			       UINTN file_size, void *buf)
+{
+	EFI_FILE *file;
+	EFI_STATUS ret;
+	UINT64 offset, len;
+	UINTN nsize;
+	BOOLEAN match = FALSE;
+
+	if (entry->size != file_size)
+		return FALSE;
+
+	ret = uefi_open_file(file_io_interface, filename, &file);
+	if (EFI_ERROR(ret))
+		return FALSE;
+
+	for (offset = 0; offset < entry->size; offset += len) {
+		len = min(entry->size - offset, (UINT64)COMPARE_CHUNK / 2);
+		nsize = len;
+		ret = uefi_call_wrapper(file->Read, 3, file, &nsize, buf);
+		if (EFI_ERROR(ret) || nsize != len)
+			goto out;
+		/* The content of sparse images is not comparable. */
+		if (!offset && is_sparse_image(buf, len))
+			goto out;
+		ret = read_partition(gparti, offset, len, buf + COMPARE_CHUNK / 2);
+		if (EFI_ERROR(ret) || memcmp(buf, buf + COMPARE_CHUNK / 2, len))
+			goto out;
+	}
+	match = TRUE;
+
+out:
+	uefi_call_wrapper(file->Close, 1, file);
+	return match;
+}
+
+/* Returns TRUE if LABEL already holds the content listed in the
+   manifest for the flash of FILE on PARTITION. */
+static BOOLEAN is_up_to_date(CHAR8 *partition, CHAR8 *label, CHAR8 *file,
+			     CHAR16 *filename, UINTN file_size)
+{
+	struct gpt_partition_interface gparti;
+	struct manifest_entry *entry;
+	CHAR16 *label16;
+	EFI_STATUS ret;
+	void *buf;
+	BOOLEAN match;
+
+	entry = find_manifest_entry(file, partition);
+	if (!entry)
+		return FALSE;
+
+	label16 = stra_to_str(label);
+	if (!label16)
+		return FALSE;
+	ret = gpt_get_partition_by_label(label16, &gparti, LOGICAL_UNIT_USER);
+	FreePool(label16);
+	if (EFI_ERROR(ret) || entry->size > get_partition_size(&gparti))
+		return FALSE;
+
+	buf = AllocatePool(COMPARE_CHUNK);
+	if (!buf)
+		return FALSE;
+
+	if (entry->has_digest)
+		match = digest_matches(&gparti, entry, buf);
+	else
+		match = content_matches(&gparti, entry, filename, file_size, buf);
+
+	FreePool(buf);
+	return match;
+}
+
 static void installer_flash_cmd(INTN argc, CHAR8 **argv)
 {
 	EFI_STATUS ret;
 	CHAR16 *filename;
+	CHAR8 *partition;
 	INTN num = argc - 2;
 	CHAR16 *numname[num];
 	void *data;
@@ -652,6 +906,7 @@ static void installer_flash_cmd(INTN argc, CHAR8 **argv)
 			goto exit;
 		}
 
+		partition = argv[1];
 		argv[1] = get_target(argv[1]);
 		if (!argv[1])
 			goto exit;
@@ -659,6 +914,11 @@ static void installer_flash_cmd(INTN argc, CHAR8 **argv)
 		ret = find_partition(argv[1]);
 		switch (ret) {
 		case EFI_SUCCESS:
+			if (is_up_to_date(partition, argv[1], argv[2], filename, size)) {
+				fastboot_info("%a is up to date, skipped", argv[1]);
+				fastboot_okay("");
+				goto exit;
+			}
 			do_erase(argc, argv);
 			if (!last_cmd_succeeded)
 				goto exit;
@@ -905,6 +1165,7 @@ static char *next_command()
 {
 	if (command_nb == current_command) {
 		free_commands();
+		free_manifest();
 		return NULL;
 	}
 
@@ -935,7 +1196,14 @@ static void batch(INTN argc, CHAR8 **argv)
 		FreePool(filename);
 		return;
 	}
+
+	ret = load_manifest(filename);
 	FreePool(filename);
+	if (EFI_ERROR(ret)) {
+		FreePool(data);
+		inst_perror(ret, "Failed to load the manifest");
+		return;
+	}
 
 	ret = parse_text_buffer(data, size, store_command, NULL);
 	FreePool(data);
@@ -1224,7 +1492,6 @@ EFI_STATUS installer_transport_run(void)
 	}
 
 	if (current_command > 0) {
-		flush_tx_buffer();
 		if (last_cmd_succeeded)
 			Print(L"Command successfully executed\n");
 		else {
@@ -1276,8 +1543,8 @@ EFI_STATUS installer_transport_write(void *buf, UINT32 size)
 
 	if (!memcmp((CHAR8 *)"INFO", buf, PREFIX_LEN)) {
 		Print(L"(bootloader) %a\n", buf + PREFIX_LEN);
-		need_tx_cb = TRUE;
-	} if (!memcmp((CHAR8 *)"OKAY", buf, PREFIX_LEN)) {
+		fastboot_tx_cb(NULL, 0);
+	} else if (!memcmp((CHAR8 *)"OKAY", buf, PREFIX_LEN)) {
 		if (((char *)buf)[PREFIX_LEN] != '\0')
 			Print(L"%a\n", buf + PREFIX_LEN);
 		last_cmd_succeeded = TRUE;
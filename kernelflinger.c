@@ -34,6 +34,7 @@
 #include <efi.h>
 #include <efiapi.h>
 #include <efilib.h>
+#include <efitcp.h>
 
 #include "openssl_support.h"
 
@@ -66,7 +67,10 @@
 #endif
 #include "gpt.h"
 #include "protocol.h"
+#include "pci.h"
 #include "uefi_utils.h"
+#include "handoff.h"
+#include "prefetch.h"
 #include "security_interface.h"
 #include "security_efi.h"
 #ifdef USE_TPM
@@ -1004,6 +1008,138 @@ VOID connect_all_drivers(VOID)
 		FreePool (handles);
 }
 
+static BOOLEAN is_fastboot_controller(pci_class_code_t *class)
+{
+	if (class->base_class == PCI_CLASS_NETWORK)
+		return TRUE;
+
+	return class->base_class == PCI_CLASS_SERIAL &&
+		class->sub_class == PCI_SUBCLASS_USB &&
+		class->prog_if == PCI_IF_USB_DEVICE;
+}
+
+static BOOLEAN tcp_is_available(VOID)
+{
+	EFI_GUID tcp_srv_binding_guid = EFI_TCP4_SERVICE_BINDING_PROTOCOL;
+	EFI_HANDLE *handles;
+	UINTN nb_handle = 0;
+	EFI_STATUS ret;
+
+	ret = uefi_call_wrapper(BS->LocateHandleBuffer, 5, ByProtocol,
+				&tcp_srv_binding_guid, NULL, &nb_handle, &handles);
+	if (EFI_ERROR(ret))
+		return FALSE;
+
+	FreePool(handles);
+	return nb_handle > 0;
+}
+
+/* Connects recursively HANDLE if it is a network or a USB device
+ * controller.  Returns TRUE if the fastboot transport can be started
+ * on it. */
+static BOOLEAN connect_fastboot_controller(EFI_HANDLE handle)
+{
+	EFI_STATUS ret;
+	EFI_PCI_IO *pciio;
+	pci_class_code_t class;
+
+	ret = handle_protocol(handle, &PciIoProtocol, (VOID **)&pciio);
+	if (EFI_ERROR(ret))
+		return FALSE;
+
+	ret = get_pci_class(pciio, &class);
+	if (EFI_ERROR(ret) || !is_fastboot_controller(&class))
+		return FALSE;
+
+	ret = uefi_call_wrapper(BS->ConnectController, 4, handle, NULL, NULL, TRUE);
+	if (EFI_ERROR(ret))
+		return FALSE;
+
+	/* The network controller is only usable once the
+	 * SNP/IP4/TCP4 stack is bound on top of it. */
+	if (class.base_class == PCI_CLASS_NETWORK)
+		return tcp_is_available();
+
+	return TRUE;
+}
+
+static BOOLEAN connect_saved_fastboot_controller(VOID)
+{
+	EFI_STATUS ret;
+	EFI_DEVICE_PATH *path, *remaining;
+	EFI_HANDLE handle;
+	UINTN size;
+	BOOLEAN connected = FALSE;
+
+	ret = get_efi_variable(&loader_guid, FASTBOOT_DEVICE_PATH_VAR,
+			       &size, (VOID **)&path, NULL);
+	if (EFI_ERROR(ret))
+		return FALSE;
+
+	if (uefi_device_path_size(path, size) != size)
+		goto out;
+
+	remaining = path;
+	ret = uefi_call_wrapper(BS->LocateDevicePath, 3, &PciIoProtocol,
+				&remaining, &handle);
+	if (EFI_ERROR(ret) || !IsDevicePathEnd(remaining))
+		goto out;
+
+	connected = connect_fastboot_controller(handle);
+
+out:
+	FreePool(path);
+	return connected;
+}
+
+static BOOLEAN connect_fastboot_controllers(VOID)
+{
+	EFI_STATUS ret;
+	EFI_HANDLE *handles;
+	EFI_DEVICE_PATH *path;
+	UINTN nb_handle = 0;
+	UINTN index;
+	BOOLEAN connected = FALSE;
+
+	ret = uefi_call_wrapper(BS->LocateHandleBuffer, 5, ByProtocol,
+				&PciIoProtocol, NULL, &nb_handle, &handles);
+	if (EFI_ERROR(ret))
+		return FALSE;
+
+	for (index = 0; index < nb_handle && !connected; index++)
+		connected = connect_fastboot_controller(handles[index]);
+
+	if (connected) {
+		path = DevicePathFromHandle(handles[index - 1]);
+		if (path) {
+			ret = set_efi_variable(&loader_guid, FASTBOOT_DEVICE_PATH_VAR,
+					       DevicePathSize(path), path, TRUE, FALSE);
+			if (EFI_ERROR(ret))
+				efi_perror(ret, L"Failed to save the fastboot device path");
+		}
+	}
+
+	FreePool(handles);
+	return connected;
+}
+
+/* When running on kvm, OVMF does not connect the drivers that are not
+ * necessary for boot, the network driver included, to achieve better
+ * performance.  Connect the controller used last time, then the
+ * network and USB device controllers, and only connect all the drivers
+ * if the transport is still not available. */
+static VOID connect_fastboot_drivers(VOID)
+{
+	if (connect_saved_fastboot_controller())
+		return;
+
+	if (connect_fastboot_controllers())
+		return;
+
+	debug(L"No fastboot controller found, connecting all drivers");
+	connect_all_drivers();
+}
+
 static VOID enter_fastboot_mode(UINT8 boot_state)
 	__attribute__ ((noreturn));
 
@@ -1018,17 +1154,8 @@ static VOID enter_fastboot_mode(UINT8 boot_state)
 	VOID *bootimage_p;
 	AvbSlotVerifyData *slot_data;
 
-	if (is_running_on_kvm()) {
-		/*
-		 * When running on kvm, OVMF will not connect network driver and other
-		 * driver that is not necessary for boot to achieve better performance,
-		 * while network is necessary for fastboot mode since USB device mode is
-		 * not supported.
-		 * Connect all drivers that have not been connected.
-		 *
-		 */
-		connect_all_drivers();
-	}
+	if (is_running_on_kvm())
+		connect_fastboot_drivers();
 	set_efi_variable(&fastboot_guid, BOOT_STATE_VAR, sizeof(boot_state),
 			&boot_state, FALSE, TRUE);
 	set_oemvars_update(TRUE);
@@ -1107,17 +1234,8 @@ static void bootloader_recover_mode(UINT8 boot_state)
 {
 	enum boot_target target;
 
-	if (is_running_on_kvm()) {
-		/*
-		 * When running on kvm, OVMF will not connect network driver and other
-		 * driver that is not necessary for boot to achieve better performance,
-		 * while network is necessary for crash mode since USB device mode is
-		 * not supported.
-		 * Connect all drivers that have not been connected.
-		 *
-		 */
-		connect_all_drivers();
-	}
+	if (is_running_on_kvm())
+		connect_fastboot_drivers();
 #ifdef USE_UI
 	target = ux_prompt_user_for_boot_target(NOT_BOOTABLE_CODE);
 	if (target == FASTBOOT)
@@ -1165,6 +1283,18 @@ static VOID boot_error(enum ux_error_code error_code, UINT8 boot_state,
 		halt_system();
 }
 
+/* The vendor splash may still be decoded by an application processor
+ * until ux_finish_vendor_splash() joins it: the early exits of
+ * efi_main() go through this function so that it is never left
+ * running. */
+static EFI_STATUS leave_vendor_splash(EFI_STATUS ret)
+{
+#ifdef USE_UI
+	ux_finish_vendor_splash();
+#endif
+	return ret;
+}
+
 EFI_STATUS efi_main(EFI_HANDLE image, EFI_SYSTEM_TABLE *sys_table)
 {
 	EFI_STATUS ret;
@@ -1183,7 +1313,7 @@ EFI_STATUS efi_main(EFI_HANDLE image, EFI_SYSTEM_TABLE *sys_table)
 	InitializeLib(image, sys_table);
 
 #ifdef USE_UI
-	ux_display_vendor_splash();
+	ux_start_vendor_splash();
 #endif
 
 	debug(KERNELFLINGER_VERSION);
@@ -1195,12 +1325,16 @@ EFI_STATUS efi_main(EFI_HANDLE image, EFI_SYSTEM_TABLE *sys_table)
 			image, NULL, EFI_OPEN_PROTOCOL_GET_PROTOCOL);
 	if (EFI_ERROR(ret)) {
 		efi_perror(ret, L"OpenProtocol: LoadedImageProtocol");
-		return ret;
+		return leave_vendor_splash(ret);
 	}
 	g_disk_device = g_loaded_image->DeviceHandle;
 
-	/* loaded from mass storage (not DnX) */
-	if (g_disk_device) {
+	/* loaded from mass storage (not DnX), reuse what kfld already
+	 * resolved if it handed it over.  The handoff must not reach
+	 * the OS even if it cannot be used. */
+	if (!g_disk_device)
+		handoff_withdraw();
+	else if (EFI_ERROR(handoff_adopt(g_disk_device))) {
 		ret = storage_set_boot_device(g_disk_device);
 		if (EFI_ERROR(ret))
 			error(L"Failed to set boot device");
@@ -1211,7 +1345,7 @@ EFI_STATUS efi_main(EFI_HANDLE image, EFI_SYSTEM_TABLE *sys_table)
 		if (!get_boot_device()) {
 			// Get boot device failed
 			error(L"Failed to find boot device");
-			return EFI_NO_MEDIA;
+			return leave_vendor_splash(EFI_NO_MEDIA);
 		}
 	}
 
@@ -1247,9 +1381,13 @@ EFI_STATUS efi_main(EFI_HANDLE image, EFI_SYSTEM_TABLE *sys_table)
 	ret = slot_init();
 	if (EFI_ERROR(ret)) {
 		efi_perror(ret, L"Slot management initialization failed");
-		return ret;
+		return leave_vendor_splash(ret);
 	}
 
+#ifdef USE_UI
+	ux_finish_vendor_splash();
+#endif
+
 	/* No UX prompts before this point, do not want to interfere
 	 * with magic key detection
 	 */
@@ -1348,11 +1486,21 @@ EFI_STATUS efi_main(EFI_HANDLE image, EFI_SYSTEM_TABLE *sys_table)
 	set_boottime_stamp(TM_AVB_START);
 	acpi_set_boot_target(boot_target);
 
+	/* Read up front what the previous normal boot needed */
+	if (boot_target == NORMAL_BOOT)
+		prefetch_start();
+
 	/* AVB check */
 	disable_slot_if_efi_loaded_slot_failed();
 	ret = avb_load_verify_boot_image(boot_target, target_path, &bootimage, oneshot, &boot_state, &vb_data);
 	avb_load_verify_vendor_boot_image(boot_target, &vendorbootimage);
 
+	/* The prefetched data must not outlive the boot image loading:
+	 * a fallback to fastboot could flash the partitions it covers. */
+	if (boot_target == NORMAL_BOOT && boot_state != BOOT_STATE_RED)
+		prefetch_save();
+	prefetch_free();
+
 	set_boottime_stamp(TM_VERIFY_BOOT_DONE);
 
 	if (boot_state == BOOT_STATE_RED) {
@@ -41,6 +41,9 @@
 #include "gpt.h"
 #include "android.h"
 #include "slot.h"
+#include "vars.h"
+#include "misc_cache.h"
+#include "handoff.h"
 
 #include "libavb_ab.h"
 
@@ -68,37 +71,14 @@ static EFI_LOADED_IMAGE *g_loaded_image;
 EFI_STATUS avb_ab_read_misc(AvbABData *avbABData)
 {
 	EFI_STATUS ret;
-	struct gpt_partition_interface gpart;
-	UINT32 MediaId;
-	UINTN partition_start;
-	UINTN partition_size;
-	CHAR16 *label = L"misc";
 
-	ret = gpt_get_partition_by_label(label, &gpart, LOGICAL_UNIT_USER);
+	/* Read through the misc cache so that kernelflinger can adopt
+	 * the content instead of reading the partition again.  The A/B
+	 * metadata follow the bootloader message. */
+	ret = misc_cache_read(sizeof(struct bootloader_message), avbABData,
+			      sizeof(*avbABData));
 	if (EFI_ERROR(ret)) {
-		efi_perror(ret, L"Partition %s not found", label);
-		return ret;
-	}
-	if (gpart.part.ending_lba < gpart.part.starting_lba) {
-		ret = EFI_COMPROMISED_DATA;
-		efi_perror(ret, L"Partition LBA is wrong");
-		return ret;
-	}
-	// Check the partition size is enough
-	MediaId = gpart.bio->Media->MediaId;
-	partition_start = gpart.part.starting_lba * gpart.bio->Media->BlockSize;
-	partition_size = (gpart.part.ending_lba + 1 - gpart.part.starting_lba) * gpart.bio->Media->BlockSize;
-	if (partition_size < 2048 + sizeof(*avbABData)) { // AB_METADATA_MISC_PARTITION_OFFSET = 2048;
-		ret = EFI_COMPROMISED_DATA;
-		efi_perror(ret, L"Partition %s is too small", label);
-		return ret;
-	}
-	ret = uefi_call_wrapper(gpart.dio->ReadDisk, 5, gpart.dio, MediaId,
-			partition_start + 2048,
-			sizeof(*avbABData), avbABData);
-
-	if (EFI_ERROR(ret)) {
-		efi_perror(ret, L"Read partition %s failed", label);
+		efi_perror(ret, L"Read partition %s failed", MISC_LABEL);
 		return ret;
 	}
 
@@ -209,7 +189,12 @@ EFI_STATUS load_kf(UINT8 slot)
 		return ret;
 	}
 
+	ret = handoff_publish();
+	if (EFI_ERROR(ret))
+		efi_perror(ret, L"Failed to publish the boot handoff");
+
 	ret = uefi_call_wrapper(BS->StartImage, 3, kf_image, NULL, NULL);
+	handoff_withdraw();
 
 out:
 	if (kf_image != 0) {
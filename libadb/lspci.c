@@ -32,46 +32,10 @@
 
 #include <lib.h>
 
-#include "ioport.h"
 #include "lspci.h"
+#include "pci.h"
 #include "pci_class.h"
 
-typedef union {
-	struct {
-		UINT8 function : 3;
-		UINT8 device : 5;
-		UINT8 bus : 8;
-	};
-	UINT16 raw;
-} pci_dev_t;
-
-typedef struct {
-	UINT16 vendor;
-	UINT16 device;
-	UINT16 command;
-	UINT16 status;
-	UINT8 revision;
-	struct {
-		UINT8 interface;
-		UINT8 sub;
-		UINT8 base;
-	} class;
-} __attribute__((packed)) pci_header_t;
-
-static UINT32 pci_read_config32(pci_dev_t dev, UINT16 reg)
-{
-	outl(0x80000000 | dev.raw << 8 | (reg & ~3), 0xcf8);
-	return inl(0xcfc + (reg & 3));
-}
-
-static void pci_read_config(pci_dev_t dev, void *buf, UINT16 count)
-{
-	UINTN i;
-
-	for (i = 0; i < count; i += sizeof(UINT32))
-		*(UINT32 *)&buf[i] = pci_read_config32(dev, i);
-}
-
 enum class_fmt {
 	DEFAULT,
 	NUMERIC,
@@ -93,9 +57,9 @@ static const struct {
 
 static EFI_STATUS lspci_main(INTN argc, const char **argv)
 {
-	UINTN i, j;
-	pci_dev_t dev;
-	pci_header_t header;
+	EFI_STATUS ret;
+	UINTN i, j, count;
+	pci_device_t *devices, *dev;
 	unsigned char *buf = NULL;
 	const char *class;
 
@@ -111,6 +75,12 @@ static EFI_STATUS lspci_main(INTN argc, const char **argv)
 			return EFI_INVALID_PARAMETER;
 	}
 
+	ret = pci_get_inventory(&devices, &count);
+	if (EFI_ERROR(ret)) {
+		efi_perror(ret, L"Failed to get the PCI devices");
+		return ret;
+	}
+
 	if (dump_size) {
 		buf = AllocatePool(dump_size);
 		if (!buf) {
@@ -119,18 +89,15 @@ static EFI_STATUS lspci_main(INTN argc, const char **argv)
 		}
 	}
 
-	for (i = 0, dev.raw = 0; i <= (UINT16)-1; i++, dev.raw = i) {
-		UINT32 val = pci_read_config32(dev, 0);
-
-		if (val == 0xffffffff || val == 0x00000000 ||
-		    val == 0x0000ffff || val == 0xffff0000)
-			continue;
-
-		pci_read_config(dev, &header, sizeof(header));
+	for (i = 0; i < count; i++) {
+		dev = &devices[i];
 
-		ss_printf(L"%02x:%02x.%d ", dev.bus, dev.device, dev.function);
+		if (dev->segment)
+			ss_printf(L"%04x:", dev->segment);
+		ss_printf(L"%02x:%02x.%d ", dev->bus, dev->device, dev->function);
 
-		class = pci_class_string(header.class.base, header.class.sub);
+		class = pci_class_string(dev->class.base_class,
+					 dev->class.sub_class);
 		switch (class_fmt) {
 		case DEFAULT:
 			if (class) {
@@ -139,21 +106,21 @@ static EFI_STATUS lspci_main(INTN argc, const char **argv)
 			}
 
 		case NUMERIC:
-			ss_printf(L"%02x%02x", header.class.base,
-				  header.class.sub);
+			ss_printf(L"%02x%02x", dev->class.base_class,
+				  dev->class.sub_class);
 			break;
 
 		case BOTH:
 			ss_printf(L"%a [%02x%02x]", class,
-				  header.class.base, header.class.sub);
+				  dev->class.base_class, dev->class.sub_class);
 			break;
 		}
 
 		ss_printf(L": %04x:%04x (rev %02x)\n",
-			  header.vendor, header.device, header.revision);
+			  dev->ids.vendor_id, dev->ids.device_id,
+			  dev->revision);
 
-		if (buf) {
-			pci_read_config(dev, buf, dump_size);
+		if (buf && !EFI_ERROR(pci_read_config(dev, 0, buf, dump_size))) {
 			ss_hexdump(buf, dump_size, 0, FALSE);
 			ss_printf(L"\n");
 		}
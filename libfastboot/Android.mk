@@ -32,6 +32,10 @@ SHARED_SRC_FILES := \
 	bootloader.c \
 	keybox_provision.c
 
+ifeq ($(PRODUCT_USE_DYNAMIC_PARTITIONS),true)
+    SHARED_SRC_FILES += super.c
+endif
+
 include $(CLEAR_VARS)
 
 LOCAL_MODULE := libfastboot-$(TARGET_BUILD_VARIANT)
@@ -46,6 +50,10 @@ LOCAL_SRC_FILES := $(SHARED_SRC_FILES) \
 ifneq ($(strip $(KERNELFLINGER_USE_UI)),false)
     LOCAL_SRC_FILES += fastboot_ui.c
 endif
+ifneq ($(TARGET_BUILD_VARIANT),user)
+    LOCAL_SRC_FILES += flash_bench.c \
+                       dispatch_bench.c
+endif
 
 ifeq ($(TARGET_USE_SBL),true)
 LOCAL_CFLAGS += -DUSE_SBL
@@ -31,6 +31,7 @@
  */
 
 #include <lib.h>
+#include <fastboot.h>
 
 #include "flash.h"
 #include "gpt.h"
@@ -39,6 +40,7 @@
 #include "text_parser.h"
 #include "uefi_utils.h"
 #include "slot.h"
+#include "timer.h"
 
 #define ESP_TMP_PART		ESP_LABEL L"2"
 #define BOOTLOADER_TMP_PART	BOOTLOADER_LABEL L"2"
@@ -203,7 +205,10 @@ static EFI_STATUS flash_efi_partition(CHAR16 *label, CHAR16 *tmp_part,
 	EFI_STATUS ret, erase_ret;
 	EFI_HANDLE handle;
 	UINTN i;
+	UINT32 start;
+	UINT64 invalidated = 0, swapped = 0;
 
+	start = boottime_in_msec();
 	ret = flash_partition(data, size, tmp_part);
 	if (EFI_ERROR(ret))
 		return ret;
@@ -239,7 +244,7 @@ static EFI_STATUS flash_efi_partition(CHAR16 *label, CHAR16 *tmp_part,
 		}
 	}
 
-	ret = gpt_swap_partition(tmp_part, label, LOGICAL_UNIT_USER);
+	ret = gpt_swap_partition(tmp_part, label, LOGICAL_UNIT_USER, &swapped);
 	if (EFI_ERROR(ret))
 		efi_perror(ret, L"Failed to swap partitions");
 
@@ -252,10 +257,14 @@ exit:
 	/* Microsoft allows to use the FAT32 filesystem for the ESP
 	   partition only and in the context of a UEFI device.  We
 	   have to get rid of this potential second FAT32
-	   partition.  */
-	erase_ret = erase_by_label(tmp_part);
+	   partition.  Invalidating its file system is enough, there
+	   is no need to erase the whole partition.  */
+	erase_ret = invalidate_by_label(tmp_part, &invalidated);
 	if (EFI_ERROR(erase_ret))
 		efi_perror(erase_ret, L"Failed to erase '%s' partition", tmp_part);
+	else
+		fastboot_info("%s flashed in %d ms, %ld bytes written", label,
+			      boottime_in_msec() - start, size + swapped + invalidated);
 
 	free_load_options();
 
@@ -0,0 +1,145 @@
+/*
+ * Copyright (c) 2020, Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#include <efi.h>
+#include <efilib.h>
+#include <lib.h>
+#include <fastboot.h>
+
+#include "timer.h"
+
+/* Benchmark of the fastboot command dispatch.  A scripted command
+   stream, similar to what automated flashing scripts send, is
+   dispatched through a command table holding as many commands as
+   the root and oem tables.  The linear scan over the registration
+   order the dispatch used to rely on is measured as a reference.  */
+
+#define BENCH_ROUNDS 10000
+
+static UINTN dispatched;
+
+static void bench_cmd(__attribute__((__unused__)) INTN argc,
+		      __attribute__((__unused__)) CHAR8 **argv)
+{
+	dispatched++;
+}
+
+#define BENCH_CMD(name) { name, UNKNOWN_STATE, bench_cmd }
+
+static struct fastboot_cmd COMMANDS[] = {
+	BENCH_CMD("download"), BENCH_CMD("upload"), BENCH_CMD("flash"),
+	BENCH_CMD("erase"), BENCH_CMD("getvar"), BENCH_CMD("boot"),
+	BENCH_CMD("continue"), BENCH_CMD("reboot"),
+	BENCH_CMD("reboot-bootloader"), BENCH_CMD("reboot-recovery"),
+	BENCH_CMD("reboot-fastboot"), BENCH_CMD("set_active"),
+	BENCH_CMD("off-mode-charge"), BENCH_CMD("crash-event-menu"),
+	BENCH_CMD("setvar"), BENCH_CMD("garbage-disk"),
+	BENCH_CMD("fw-update"), BENCH_CMD("set-storage"),
+	BENCH_CMD("transport-bench"), BENCH_CMD("storage-bench"),
+	BENCH_CMD("alloc-stats"), BENCH_CMD("reprovision"), BENCH_CMD("rm"),
+	BENCH_CMD("set-watchdog-counter-max"), BENCH_CMD("slot-fallback"),
+	BENCH_CMD("erase-efivars"), BENCH_CMD("get-hashes"),
+	BENCH_CMD("get-provisioning-logs"), BENCH_CMD("tpm-show-index"),
+	BENCH_CMD("tpm-delete-index"), BENCH_CMD("fuse"),
+	BENCH_CMD("oem"), BENCH_CMD("flashing")
+};
+
+/* One device flashing session */
+static const char *SCRIPT[] = {
+	"getvar", "getvar", "getvar", "flashing", "download", "flash",
+	"download", "flash", "download", "flash", "download", "flash",
+	"download", "flash", "erase", "erase", "oem", "set_active",
+	"getvar", "reboot"
+};
+
+static struct fastboot_cmd *linear_lookup(const char *name)
+{
+	UINTN i;
+
+	for (i = ARRAY_SIZE(COMMANDS); i > 0; i--)
+		if (!strcmp((CHAR8 *)name, (CHAR8 *)COMMANDS[i - 1].name))
+			return &COMMANDS[i - 1];
+
+	return NULL;
+}
+
+static void report(const CHAR16 *method, UINT64 us)
+{
+	UINT64 count = BENCH_ROUNDS * ARRAY_SIZE(SCRIPT);
+
+	info(L"%s: %ld commands in %ld us, %ld ns/command", method,
+	     count, us, us * 1000 / count);
+}
+
+void fastboot_dispatch_bench(void)
+{
+	static struct cmdlist list;
+	EFI_STATUS ret;
+	CHAR8 *argv[1];
+	UINT64 start;
+	UINTN i, j;
+
+	if (!boottime_in_usec())
+		info(L"No TSC frequency, timings will not be reported");
+
+	fastboot_cmdlist_unregister(&list);
+	for (i = 0; i < ARRAY_SIZE(COMMANDS); i++) {
+		ret = fastboot_register_into(&list, &COMMANDS[i]);
+		if (EFI_ERROR(ret)) {
+			efi_perror(ret, L"Failed to register the benchmark commands");
+			return;
+		}
+	}
+
+	dispatched = 0;
+	start = boottime_in_usec();
+	for (i = 0; i < BENCH_ROUNDS; i++)
+		for (j = 0; j < ARRAY_SIZE(SCRIPT); j++) {
+			argv[0] = (CHAR8 *)SCRIPT[j];
+			linear_lookup(SCRIPT[j])->handle(1, argv);
+		}
+	report(L"linear", boottime_in_usec() - start);
+
+	dispatched = 0;
+	start = boottime_in_usec();
+	for (i = 0; i < BENCH_ROUNDS; i++)
+		for (j = 0; j < ARRAY_SIZE(SCRIPT); j++) {
+			argv[0] = (CHAR8 *)SCRIPT[j];
+			fastboot_run_cmd(&list, SCRIPT[j], 1, argv);
+		}
+	report(L"table", boottime_in_usec() - start);
+
+	if (dispatched != BENCH_ROUNDS * ARRAY_SIZE(SCRIPT))
+		error(L"%ld commands dispatched instead of %ld", dispatched,
+		      BENCH_ROUNDS * ARRAY_SIZE(SCRIPT));
+
+	fastboot_cmdlist_unregister(&list);
+}
@@ -58,30 +58,38 @@
 #endif
 #include "timer.h"
 #include "android.h"
+#include "arena.h"
 
 /* size of "INFO" "OKAY" or "FAIL" */
 #define CODE_LENGTH 4
 #define INFO_PAYLOAD (MAGIC_LENGTH - CODE_LENGTH)
 #define MAX_VARIABLE_LENGTH 64
+#define VAR_HASH_SIZE 64
 #if defined(IOC_USE_SLCAN) || defined(IOC_USE_CBC)
 #define TIMEOUT 5
 #endif
 
 struct fastboot_var {
 	struct fastboot_var *next;
+	struct fastboot_var *hnext;
 	char name[MAX_VARIABLE_LENGTH];
 	char value[MAX_VARIABLE_LENGTH];
 	const char *(*get_value)(void);
 };
 
-struct fastboot_tx_buffer {
-	struct fastboot_tx_buffer *next;
-	char msg[MAGIC_LENGTH];
-};
-
-struct cmdlist {
-	struct cmdlist *next;
-	struct fastboot_cmd *cmd;
+/* Preallocated ring of outgoing INFO/OKAY/FAIL messages.  Slots
+ * [first, first + inflight) have been handed to the transport and
+ * must not be reused until their tx completion.  The following
+ * 'queued' slots are waiting to be sent.  */
+#define TX_RING_SIZE 64
+
+struct fastboot_tx_ring {
+	char msg[TX_RING_SIZE][MAGIC_LENGTH];
+	UINTN first;
+	UINTN inflight;
+	UINTN queued;
+	BOOLEAN filling;
+	BOOLEAN throttled;
 };
 
 enum fastboot_states {
@@ -90,17 +98,20 @@ enum fastboot_states {
 	STATE_COMPLETE,
 	STATE_START_DOWNLOAD,
 	STATE_DOWNLOAD,
+	STATE_START_UPLOAD,
+	STATE_UPLOAD,
 	STATE_TX,
 	STATE_STOPPING,
 	STATE_STOPPED,
 	STATE_ERROR,
 };
 
-static cmdlist_t cmdlist;
+static struct cmdlist cmdlist;
 static char *command_buffer;
 static UINTN command_buffer_size;
 static struct fastboot_var *varlist;
-static struct fastboot_tx_buffer *txbuf_head;
+static struct fastboot_var *varhash[VAR_HASH_SIZE];
+static struct fastboot_tx_ring tx_ring;
 static enum fastboot_states fastboot_state;
 static enum fastboot_states next_state;
 
@@ -109,6 +120,19 @@ static struct download_buffer dl;
 static const UINTN MIN_DLSIZE = 8 * 1024 * 1024;
 static const UINTN MAX_DLSIZE = 256 * 1024 * 1024;
 
+/* Data staged by the last command for the "upload" command.  It is
+ * sent by chunks of UPLOAD_CHUNK bytes, 'sent' bytes being already
+ * transmitted and 'chunk' bytes in flight.  */
+#define UPLOAD_CHUNK (1024 * 1024)
+
+static struct upload_buffer {
+	char *data;
+	UINTN size;
+	UINTN max_size;
+	UINTN sent;
+	UINTN chunk;
+} ul;
+
 #ifndef FASTBOOT_FOR_NON_ANDROID
 static const char *flash_locked_whitelist[] = {
 	NULL
@@ -172,6 +196,51 @@ struct download_buffer *fastboot_download_buffer(void)
 	return &dl;
 }
 
+EFI_STATUS fastboot_stage(const void *data, UINTN size)
+{
+	char *buf;
+	UINTN max_size;
+
+	if (!data && size)
+		return EFI_INVALID_PARAMETER;
+
+	if (size > ul.max_size - ul.size) {
+		for (max_size = ul.max_size ? ul.max_size : 4096;
+		     max_size - ul.size < size; max_size *= 2)
+			;
+		buf = ReallocatePool(ul.data, ul.max_size, max_size);
+		if (!buf) {
+			error(L"Failed to grow the upload buffer to %ld bytes", max_size);
+			return EFI_OUT_OF_RESOURCES;
+		}
+		ul.data = buf;
+		ul.max_size = max_size;
+	}
+
+	CopyMem(ul.data + ul.size, data, size);
+	ul.size += size;
+
+	return EFI_SUCCESS;
+}
+
+EFI_STATUS fastboot_stage_line(char *str, VOID *context _unused)
+{
+	EFI_STATUS ret;
+
+	ret = fastboot_stage(str, strlen((CHAR8 *)str));
+	if (EFI_ERROR(ret))
+		return ret;
+
+	return fastboot_stage("\n", 1);
+}
+
+void fastboot_stage_free(void)
+{
+	if (ul.data)
+		FreePool(ul.data);
+	ZeroMem(&ul, sizeof(ul));
+}
+
 EFI_STATUS fastboot_set_command_buffer(char *buffer, UINTN size)
 {
 	if (!buffer)
@@ -183,21 +252,53 @@ EFI_STATUS fastboot_set_command_buffer(char *buffer, UINTN size)
 	return EFI_SUCCESS;
 }
 
-EFI_STATUS fastboot_register_into(cmdlist_t *list, struct fastboot_cmd *cmd)
+/* Return the index of the NAME command in LIST or, if there is no
+   such command, the index it would have to be inserted at.  */
+static UINTN cmdlist_search(cmdlist_t list, const char *name, BOOLEAN *found)
+{
+	UINTN lo = 0, hi = list->count, mid;
+	int cmp;
+
+	*found = FALSE;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		cmp = strcmp((CHAR8 *)name, (CHAR8 *)list->cmds[mid]->name);
+		if (!cmp) {
+			*found = TRUE;
+			return mid;
+		}
+		if (cmp < 0)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+
+	return lo;
+}
+
+EFI_STATUS fastboot_register_into(cmdlist_t list, struct fastboot_cmd *cmd)
 {
-	cmdlist_t node;
+	BOOLEAN found;
+	UINTN i, j;
 
-	if (!list || !cmd)
+	if (!list || !cmd || !cmd->name)
 		return EFI_INVALID_PARAMETER;
 
-	node = AllocatePool(sizeof(*node));
-	if (!node) {
-		error(L"Failed to allocate fastboot command %a", cmd->name);
+	i = cmdlist_search(list, cmd->name, &found);
+	if (found) {
+		list->cmds[i] = cmd;
+		return EFI_SUCCESS;
+	}
+
+	if (list->count == ARRAY_SIZE(list->cmds)) {
+		error(L"Command table full, cannot register %a", cmd->name);
 		return EFI_OUT_OF_RESOURCES;
 	}
-	node->cmd = cmd;
-	node->next = *list;
-	*list = node;
+
+	for (j = list->count; j > i; j--)
+		list->cmds[j] = list->cmds[j - 1];
+	list->cmds[i] = cmd;
+	list->count++;
 
 	return EFI_SUCCESS;
 }
@@ -207,31 +308,44 @@ EFI_STATUS fastboot_register(struct fastboot_cmd *cmd)
 	return fastboot_register_into(&cmdlist, cmd);
 }
 
-void fastboot_cmdlist_unregister(cmdlist_t *list)
+void fastboot_cmdlist_unregister(cmdlist_t list)
 {
-	cmdlist_t next, node;
+	if (list)
+		list->count = 0;
+}
 
-	if (!list)
-		return;
+static UINTN var_hash(const char *name)
+{
+	UINTN hash = 5381;
 
-	for (node = *list; node; node = next) {
-		next = node->next;
-		FreePool(node);
-	}
-	*list = NULL;
+	for (; *name; name++)
+		hash = hash * 33 + (UINT8)*name;
+
+	return hash % VAR_HASH_SIZE;
 }
 
 struct fastboot_var *fastboot_getvar(const char *name)
 {
 	struct fastboot_var *var;
 
-	for (var = varlist; var; var = var->next)
+	for (var = varhash[var_hash(name)]; var; var = var->hnext)
 		if (!strcmp((CHAR8 *)name, (const CHAR8 *)var->name))
 			return var;
 
 	return NULL;
 }
 
+static void unhash_var(struct fastboot_var *var)
+{
+	struct fastboot_var **cur;
+
+	for (cur = &varhash[var_hash(var->name)]; *cur; cur = &(*cur)->hnext)
+		if (*cur == var) {
+			*cur = var->hnext;
+			return;
+		}
+}
+
 static struct fastboot_var *fastboot_getvar_or_create(const char *name)
 {
 	struct fastboot_var *var;
@@ -253,6 +367,8 @@ static struct fastboot_var *fastboot_getvar_or_create(const char *name)
 		var->next = varlist;
 		varlist = var;
 		CopyMem(var->name, name, size);
+		var->hnext = varhash[var_hash(var->name)];
+		varhash[var_hash(var->name)] = var;
 	}
 
 	return var;
@@ -270,6 +386,7 @@ static void delete_var_starting_with(const char *prefix)
 	for (var = old_varlist; var; var = next) {
 		next = var->next;
 		if (!memcmp(prefix, var->name, strlena((CHAR8 *)prefix))) {
+			unhash_var(var);
 			FreePool(var);
 		} else {
 			var->next = varlist;
@@ -288,6 +405,7 @@ static void fastboot_unpublish_all()
 	}
 
 	varlist = NULL;
+	ZeroMem(varhash, sizeof(varhash));
 }
 
 EFI_STATUS fastboot_publish_dynamic(const char *name, const char *(get_value)(void))
@@ -363,52 +481,172 @@ static const char *get_psize_str(UINT64 size)
 	return part_size;
 }
 
-static EFI_STATUS publish_part(CHAR16 *part_name, UINT64 size, EFI_GUID *guid)
+/* Per-partition variables are not stored in the variable registry,
+   their value is computed from the GPT cache when requested so that a
+   partition table change does not require to publish them again.  */
+static const char *get_part_size_var(struct gpt_partition_interface *gparti)
+{
+	return get_psize_str(gparti->bio->Media->BlockSize
+			     * (gparti->part.ending_lba + 1 - gparti->part.starting_lba));
+}
+
+static const char *get_part_type_var(struct gpt_partition_interface *gparti)
+{
+	return get_ptype_str(&gparti->part.type);
+}
+
+static const char *get_part_has_slot_var(__attribute__((__unused__)) struct gpt_partition_interface *gparti)
+{
+	return "no";
+}
+
+static const struct part_var {
+	const char *name;
+	const char *(*get_value)(struct gpt_partition_interface *gparti);
+} PART_VARS[] = {
+	{ "partition-size",	get_part_size_var },
+	{ "partition-type",	get_part_type_var },
+	{ "has-slot",		get_part_has_slot_var }
+};
+
+static BOOLEAN label_has_suffix(const CHAR16 *label, const char *suffix)
+{
+	UINTN label_len, suffix_len, i;
+
+	label_len = StrLen(label);
+	suffix_len = strlena((CHAR8 *)suffix);
+	if (label_len < suffix_len)
+		return FALSE;
+
+	for (i = 0; i < suffix_len; i++)
+		if (label[label_len - suffix_len + i] != (CHAR16)suffix[i])
+			return FALSE;
+
+	return TRUE;
+}
+
+static EFI_STATUS get_part_var_partition(const CHAR16 *label,
+					 struct gpt_partition_interface *gparti)
 {
-	struct descriptor {
-		const char *name;
-		const char *value;
-	} descriptors[] = {
-		{ "partition-size",	get_psize_str(size) },
-		{ "partition-type",	get_ptype_str(guid) },
-		{ "has-slot",		"no" }
-	};
 	EFI_STATUS ret;
-	char var[MAX_VARIABLE_LENGTH];
-	int len;
+
+	ret = gpt_get_partition_by_label(label, gparti, LOGICAL_UNIT_USER);
+	/* stay compatible with userdata/data naming */
+	if (ret == EFI_NOT_FOUND && !StrCmp(label, L"data"))
+		ret = gpt_get_partition_by_label(L"userdata", gparti,
+						 LOGICAL_UNIT_USER);
+
+	return ret;
+}
+
+/* Return TRUE if BASE is the base label of a slotted partition. */
+static BOOLEAN part_has_slot(const CHAR16 *base)
+{
+	struct gpt_partition_interface gparti;
+	CHAR16 label[GPT_NAME_LEN];
+	char **suffixes;
+	UINTN base_len, i;
+	const char *suffix;
+
+	if (!use_slot() || !slot_get_suffixes(&suffixes))
+		return FALSE;
+
+	base_len = StrLen(base);
+	suffix = suffixes[0];
+	if (base_len + strlena((CHAR8 *)suffix) >= ARRAY_SIZE(label))
+		return FALSE;
+
+	CopyMem(label, base, base_len * sizeof(*base));
+	for (i = 0; suffix[i]; i++)
+		label[base_len + i] = suffix[i];
+	label[base_len + i] = '\0';
+
+	return !EFI_ERROR(gpt_get_partition_by_label(label, &gparti,
+						    LOGICAL_UNIT_USER));
+}
+
+static const char *fastboot_part_var_value(const char *name)
+{
+	const struct part_var *pvar = NULL;
+	struct gpt_partition_interface gparti;
+	CHAR16 label[GPT_NAME_LEN];
+	UINTN i, len = 0;
+
+	for (i = 0; i < ARRAY_SIZE(PART_VARS); i++) {
+		len = strlena((CHAR8 *)PART_VARS[i].name);
+		if (!strncmp((CHAR8 *)name, (CHAR8 *)PART_VARS[i].name, len) &&
+		    name[len] == ':') {
+			pvar = &PART_VARS[i];
+			break;
+		}
+	}
+	if (!pvar)
+		return NULL;
+
+	name += len + 1;
+	if (!*name || strlena((CHAR8 *)name) >= ARRAY_SIZE(label))
+		return NULL;
+
+	for (i = 0; name[i]; i++)
+		label[i] = name[i];
+	label[i] = '\0';
+
+	if (pvar->get_value == get_part_has_slot_var && part_has_slot(label))
+		return "yes";
+
+	if (EFI_ERROR(get_part_var_partition(label, &gparti)))
+		return NULL;
+
+	return pvar->get_value(&gparti);
+}
+
+static void fastboot_info_part(const CHAR16 *label,
+			       struct gpt_partition_interface *gparti)
+{
+	const char *value;
 	UINTN i;
-	struct descriptor *desc;
-	const CHAR16 *parent_label;
-
-	parent_label = slot_base(part_name);
-	if (parent_label) {
-		len = efi_snprintf((CHAR8 *)var, sizeof(var),
-				   (CHAR8 *)"has-slot:%s",
-				   parent_label);
-		if (len < 0 || len >= (int)sizeof(var))
-			return EFI_INVALID_PARAMETER;
 
-		ret = fastboot_publish(var, "yes");
-		if (EFI_ERROR(ret))
-			return ret;
+	for (i = 0; i < ARRAY_SIZE(PART_VARS); i++) {
+		value = PART_VARS[i].get_value(gparti);
+		fastboot_info("%a:%s: %a", PART_VARS[i].name, label,
+			      value ? value : "");
 	}
+}
 
-	for (i = 0; i < ARRAY_SIZE(descriptors); i++) {
-		desc = &descriptors[i];
-		if (!desc->value)
-			return EFI_INVALID_PARAMETER;
+static void fastboot_info_part_vars(void)
+{
+	EFI_STATUS ret;
+	struct gpt_partition_interface *gparti;
+	UINTN part_count, nb_slots = 0;
+	char **suffixes = NULL;
+	const CHAR16 *base;
+	UINTN i;
 
-		len = efi_snprintf((CHAR8 *)var, sizeof(var), (CHAR8 *)"%a:%s",
-				   desc->name, part_name);
-		if (len < 0 || len >= (int)sizeof(var))
-			return EFI_INVALID_PARAMETER;
+	ret = gpt_list_partition(&gparti, &part_count, LOGICAL_UNIT_USER);
+	if (EFI_ERROR(ret) || part_count == 0)
+		return;
 
-		ret = fastboot_publish(var, desc->value);
-		if (EFI_ERROR(ret))
-			return ret;
+	if (use_slot())
+		nb_slots = slot_get_suffixes(&suffixes);
+
+	for (i = 0; i < part_count; i++) {
+		fastboot_info_part(gparti[i].part.name, &gparti[i]);
+
+		/* stay compatible with userdata/data naming */
+		if (!StrCmp(gparti[i].part.name, L"data"))
+			fastboot_info_part(L"userdata", &gparti[i]);
+		else if (!StrCmp(gparti[i].part.name, L"userdata"))
+			fastboot_info_part(L"data", &gparti[i]);
+
+		if (!nb_slots || !label_has_suffix(gparti[i].part.name, suffixes[0]))
+			continue;
+
+		base = slot_base(gparti[i].part.name);
+		if (base)
+			fastboot_info("has-slot:%s: yes", base);
 	}
 
-	return ret;
+	FreePool(gparti);
 }
 
 const char* fastboot_slot_get_active()
@@ -484,44 +722,6 @@ static EFI_STATUS publish_slots(void)
 	return EFI_SUCCESS;
 }
 
-static EFI_STATUS publish_partsize(void)
-{
-	EFI_STATUS ret;
-	struct gpt_partition_interface *gparti;
-	UINTN part_count;
-	UINTN i;
-
-	ret = gpt_list_partition(&gparti, &part_count, LOGICAL_UNIT_USER);
-	if (EFI_ERROR(ret) || part_count == 0)
-		return EFI_SUCCESS;
-
-	for (i = 0; i < part_count; i++) {
-		UINT64 size;
-
-		size = gparti[i].bio->Media->BlockSize
-			* (gparti[i].part.ending_lba + 1 - gparti[i].part.starting_lba);
-
-		ret = publish_part(gparti[i].part.name, size, &gparti[i].part.type);
-		if (EFI_ERROR(ret))
-			return ret;
-
-		/* stay compatible with userdata/data naming */
-		if (!StrCmp(gparti[i].part.name, L"data")) {
-			ret = publish_part(L"userdata", size, &gparti[i].part.type);
-			if (EFI_ERROR(ret))
-				return ret;
-		} else if (!StrCmp(gparti[i].part.name, L"userdata")) {
-			ret = publish_part(L"data", size, &gparti[i].part.type);
-			if (EFI_ERROR(ret))
-				return ret;
-		}
-	}
-
-	FreePool(gparti);
-
-	return EFI_SUCCESS;
-}
-
 static const char *get_battery_voltage_var()
 {
 	EFI_STATUS ret;
@@ -583,6 +783,28 @@ static const char *get_erase_block_size_var()
 	return erase_block_size;
 }
 
+#ifdef USB_STORAGE
+/* Commands, failed commands, bytes, average and maximum command
+   latency in microseconds of the last USB storage erase. */
+static const char *get_usb_erase_stats_var()
+{
+	static char usb_erase_stats[MAX_VARIABLE_LENGTH];
+	struct usb_erase_stats stats;
+	int len;
+
+	usb_storage_get_erase_stats(&stats);
+	len = efi_snprintf((CHAR8 *)usb_erase_stats, sizeof(usb_erase_stats),
+			   (CHAR8 *)"%d,%d,%ld,%ld,%ld", stats.count,
+			   stats.errors, stats.bytes,
+			   stats.count ? stats.total_usec / stats.count : 0,
+			   stats.max_usec);
+	if (len < 0 || len >= (int)sizeof(usb_erase_stats))
+		return NULL;
+
+	return usb_erase_stats;
+}
+#endif
+
 static const char *get_logical_block_size_var()
 {
 	static char logical_block_size[MAX_VARIABLE_LENGTH];
@@ -639,31 +861,111 @@ void fastboot_ack(const char *code, const char *fmt, va_list ap)
 		fastboot_state = STATE_ERROR;
 }
 
-void fastboot_ack_buffered(const char *code, const char *fmt, va_list ap)
+static struct fastboot_xfer_stats *xfer_stats;
+
+void fastboot_xfer_stats_arm(struct fastboot_xfer_stats *stats, BOOLEAN rx)
+{
+	xfer_stats = stats;
+	if (!stats)
+		return;
+
+	ZeroMem(stats, sizeof(*stats));
+	stats->rx = rx;
+	stats->start = stats->last = boottime_in_usec();
+}
+
+static void xfer_stats_record(BOOLEAN rx, UINTN len, UINTN queued)
+{
+	UINT64 now, delta;
+	UINTN bucket = 0;
+
+	if (!xfer_stats || xfer_stats->rx != rx)
+		return;
+
+	now = boottime_in_usec();
+	for (delta = now - xfer_stats->last;
+	     delta > 1 && bucket < XFER_HIST_BUCKETS - 1; delta >>= 1)
+		bucket++;
+
+	xfer_stats->hist[bucket]++;
+	xfer_stats->last = now;
+	xfer_stats->bytes += len;
+	xfer_stats->requests++;
+	xfer_stats->max_queued = max(xfer_stats->max_queued, queued);
+}
+
+static void fastboot_tx_fill(void)
 {
-	struct fastboot_tx_buffer *new_txbuf;
-	struct fastboot_tx_buffer *txbuf;
 	EFI_STATUS ret;
+	UINTN max_inflight;
+	char *msg;
 
-	new_txbuf = AllocateZeroPool(sizeof(*new_txbuf));
-	if (!new_txbuf) {
-		error(L"Failed to allocate memory");
+	/* Synchronous transports complete the write from within
+	   transport_write(), do not recurse.  */
+	if (tx_ring.filling)
 		return;
+
+	tx_ring.filling = TRUE;
+	max_inflight = transport_max_tx_inflight();
+	while (tx_ring.queued && tx_ring.inflight < max_inflight) {
+		msg = tx_ring.msg[(tx_ring.first + tx_ring.inflight) % TX_RING_SIZE];
+		tx_ring.queued--;
+		tx_ring.inflight++;
+
+		ret = transport_write(msg, MAGIC_LENGTH);
+		if (EFI_ERROR(ret)) {
+			fastboot_state = STATE_ERROR;
+			break;
+		}
 	}
+	tx_ring.filling = FALSE;
+}
 
-	ret = fastboot_build_ack_msg(new_txbuf->msg, code, fmt, ap);
-	if (EFI_ERROR(ret)) {
-		FreePool(new_txbuf);
-		return;
+/* Wait for at least one TX slot to be released.  The command handler
+   is still running so the end of the TX phase must not be reported
+   even if the ring gets empty.  */
+static EFI_STATUS fastboot_tx_wait_slot(void)
+{
+	EFI_STATUS ret = EFI_SUCCESS;
+
+	tx_ring.throttled = TRUE;
+	fastboot_tx_fill();
+	while (tx_ring.inflight + tx_ring.queued == TX_RING_SIZE &&
+	       fastboot_state == STATE_TX) {
+		ret = transport_run();
+		if (EFI_ERROR(ret) && ret != EFI_TIMEOUT)
+			break;
+		ret = EFI_SUCCESS;
 	}
-	if (!txbuf_head)
-		txbuf_head = new_txbuf;
-	else {
-		txbuf = txbuf_head;
-		while (txbuf->next)
-			txbuf = txbuf->next;
-		txbuf->next = new_txbuf;
+	tx_ring.throttled = FALSE;
+
+	if (EFI_ERROR(ret))
+		return ret;
+
+	return tx_ring.inflight + tx_ring.queued < TX_RING_SIZE ?
+		EFI_SUCCESS : EFI_OUT_OF_RESOURCES;
+}
+
+void fastboot_ack_buffered(const char *code, const char *fmt, va_list ap)
+{
+	EFI_STATUS ret;
+	char *msg;
+
+	if (tx_ring.inflight + tx_ring.queued == TX_RING_SIZE) {
+		ret = fastboot_tx_wait_slot();
+		if (EFI_ERROR(ret)) {
+			efi_perror(ret, L"No TX slot available");
+			return;
+		}
 	}
+
+	msg = tx_ring.msg[(tx_ring.first + tx_ring.inflight + tx_ring.queued)
+			  % TX_RING_SIZE];
+	ret = fastboot_build_ack_msg(msg, code, fmt, ap);
+	if (EFI_ERROR(ret))
+		return;
+
+	tx_ring.queued++;
 	fastboot_state = STATE_TX;
 }
 
@@ -721,27 +1023,40 @@ void fastboot_okay(const char *fmt, ...)
 	va_end(ap);
 }
 
-static void flush_tx_buffer(void)
+static void fastboot_process_tx(void *buf, unsigned len);
+
+/* Leave the TX state once the last buffered message has been sent,
+   the transport callback of this last message is processed as if it
+   were received in the next state.  */
+static void fastboot_tx_done(void *buf, unsigned len)
 {
-	EFI_STATUS ret;
-	struct fastboot_tx_buffer *msg;
-	static CHAR8 buf[sizeof(msg->msg)];
+	if (tx_ring.queued || tx_ring.inflight || tx_ring.throttled)
+		return;
 
-	msg = txbuf_head;
-	txbuf_head = txbuf_head->next;
-	if (!txbuf_head)
-		fastboot_state = next_state;
+	fastboot_state = next_state;
+	fastboot_process_tx(buf, len);
+}
 
-	ret = memcpy_s(buf, sizeof(buf), msg->msg, sizeof(buf));
-	FreePool(msg);
-	if (EFI_ERROR(ret)) {
-		fastboot_state = STATE_ERROR;
+static void flush_tx_buffer(void)
+{
+	fastboot_tx_fill();
+	if (fastboot_state == STATE_TX)
+		fastboot_tx_done(NULL, 0);
+}
+
+static void fastboot_tx_complete(void *buf, unsigned len)
+{
+	if (!tx_ring.inflight) {
+		error(L"Unexpected tx completion, no message in flight");
 		return;
 	}
 
-	ret = transport_write(buf, sizeof(buf));
-	if (EFI_ERROR(ret))
-		fastboot_state = STATE_ERROR;
+	tx_ring.first = (tx_ring.first + 1) % TX_RING_SIZE;
+	tx_ring.inflight--;
+
+	fastboot_tx_fill();
+	if (fastboot_state == STATE_TX)
+		fastboot_tx_done(buf, len);
 }
 
 static BOOLEAN is_in_white_list(const CHAR8 *key, const char **white_list)
@@ -757,8 +1072,6 @@ EFI_STATUS refresh_partition_var(void)
 {
 	EFI_STATUS ret;
 
-	delete_var_starting_with("partition-");
-	delete_var_starting_with("has-slot");
 	delete_var_starting_with("slot-");
 	delete_var_starting_with("current-slot");
 
@@ -768,11 +1081,7 @@ EFI_STATUS refresh_partition_var(void)
 		return ret;
 	}
 
-	ret = publish_slots();
-	if (EFI_ERROR(ret))
-		return ret;
-
-	return publish_partsize();
+	return publish_slots();
 }
 
 static void cmd_flash(INTN argc, CHAR8 **argv)
@@ -793,7 +1102,7 @@ static void cmd_flash(INTN argc, CHAR8 **argv)
 		return;
 	}
 #endif
-	label = stra_to_str((CHAR8*)argv[1]);
+	label = arena_stra_to_str((CHAR8*)argv[1]);
 	if (!label) {
 		error(L"Failed to get label %a", argv[1]);
 		fastboot_fail("Allocation error");
@@ -802,7 +1111,6 @@ static void cmd_flash(INTN argc, CHAR8 **argv)
 	info(L"Flashing %s ...", label);
 
 	ret = flash(dl.data, dl.size, label);
-	FreePool(label);
 	if (EFI_ERROR(ret)) {
 		fastboot_fail("Flash failure: %r", ret);
 		return;
@@ -833,7 +1141,7 @@ static void cmd_erase(INTN argc, CHAR8 **argv)
 		return;
 	}
 
-	label = stra_to_str((CHAR8*)argv[1]);
+	label = arena_stra_to_str((CHAR8*)argv[1]);
 	if (!label) {
 		error(L"Failed to get label %a", argv[1]);
 		fastboot_fail("Allocation error");
@@ -842,7 +1150,6 @@ static void cmd_erase(INTN argc, CHAR8 **argv)
 	info(L"Erasing %s ...", label);
 	ret = erase_by_label(label);
 	if (EFI_ERROR(ret)) {
-		FreePool(label);
 		fastboot_fail("Erase failure: %r", ret);
 		return;
 	}
@@ -850,13 +1157,11 @@ static void cmd_erase(INTN argc, CHAR8 **argv)
 	if (!StrCmp(label, SLOT_STORAGE_PART)) {
 		ret = publish_slots();
 		if (EFI_ERROR(ret)) {
-			FreePool(label);
 			fastboot_fail("Failed to refresh slot variables from misc, %r", ret);
 			return;
 		}
 	}
 
-	FreePool(label);
 	info(L"Erase done.");
 	fastboot_okay("");
 }
@@ -897,6 +1202,8 @@ static const char *fastboot_var_value(struct fastboot_var *var)
 static void cmd_getvar(INTN argc, CHAR8 **argv)
 {
 	struct fastboot_var *var;
+	const char *value;
+
 	if (argc != 2) {
 		fastboot_fail("Invalid parameter");
 		return;
@@ -905,15 +1212,22 @@ static void cmd_getvar(INTN argc, CHAR8 **argv)
 	if (!strcmp(argv[1], (CHAR8 *)"all")) {
 		for (var = varlist; var; var = var->next)
 			fastboot_info("%a: %a", var->name, fastboot_var_value(var));
+		fastboot_info_part_vars();
 		fastboot_okay("");
 		return;
 	}
 
 	var = fastboot_getvar((char *)argv[1]);
-	if (NULL == var)
+	if (var) {
+		fastboot_okay("%a", fastboot_var_value(var));
+		return;
+	}
+
+	value = fastboot_part_var_value((char *)argv[1]);
+	if (NULL == value)
 		fastboot_fail("Unknown variable");
 	else
-		fastboot_okay("%a", fastboot_var_value(var));
+		fastboot_okay("%a", value);
 }
 
 void fastboot_reboot(enum boot_target target, CHAR16 *msg)
@@ -1012,21 +1326,20 @@ static void cmd_set_active(INTN argc, CHAR8 **argv)
 
 static struct fastboot_cmd *get_cmd(cmdlist_t list, const char *name)
 {
-	cmdlist_t node;
+	BOOLEAN found;
+	UINTN i;
 
 	if (!name || !list)
 		return NULL;
 
-	for (node = list; node; node = node->next)
-		if (!strcmp((CHAR8 *)name, (CHAR8 *)node->cmd->name))
-			return node->cmd;
+	i = cmdlist_search(list, name, &found);
 
-	return NULL;
+	return found ? list->cmds[i] : NULL;
 }
 
 struct fastboot_cmd *fastboot_get_root_cmd(const char *name)
 {
-	return get_cmd(cmdlist, name);
+	return get_cmd(&cmdlist, name);
 }
 
 void fastboot_run_cmd(cmdlist_t list, const char *name, INTN argc, CHAR8 **argv)
@@ -1050,7 +1363,7 @@ void fastboot_run_cmd(cmdlist_t list, const char *name, INTN argc, CHAR8 **argv)
 
 void fastboot_run_root_cmd(const char *name, INTN argc, CHAR8 **argv)
 {
-	fastboot_run_cmd(cmdlist, name, argc, argv);
+	fastboot_run_cmd(&cmdlist, name, argc, argv);
 }
 
 static void fastboot_read_command(void)
@@ -1102,6 +1415,9 @@ static void worker_download(void)
 {
 	EFI_STATUS ret;
 
+	if (xfer_stats && xfer_stats->rx)
+		xfer_stats->start = xfer_stats->last = boottime_in_usec();
+
 	ret = transport_read(dl.data, dl.size);
 	if (EFI_ERROR(ret)) {
 		efi_perror(ret, L"Failed to receive %d bytes", dl.size);
@@ -1111,15 +1427,81 @@ static void worker_download(void)
 	fastboot_state = STATE_DOWNLOAD;
 }
 
-static void fastboot_process_tx(__attribute__((__unused__)) void *buf,
-				__attribute__((__unused__)) unsigned len)
+static void cmd_upload(INTN argc, __attribute__((__unused__)) CHAR8 **argv)
+{
+	static CHAR8 response[MAGIC_LENGTH];
+	EFI_STATUS ret;
+	int len;
+
+	if (argc != 1) {
+		fastboot_fail("Invalid parameter");
+		return;
+	}
+
+	if (!ul.size) {
+		fastboot_fail("No data staged by the last command");
+		return;
+	}
+
+	len = efi_snprintf(response, sizeof(response), (CHAR8 *)"DATA%08x",
+			   ul.size);
+	if (len < 0) {
+		error(L"Failed to format DATA response");
+		fastboot_fail("Failed to format DATA response");
+		return;
+	}
+
+	ul.sent = 0;
+	fastboot_state = STATE_START_UPLOAD;
+	ret = transport_write(response, strlen((CHAR8 *)response));
+	if (EFI_ERROR(ret)) {
+		fastboot_state = STATE_ERROR;
+		return;
+	}
+}
+
+static void worker_upload(void)
+{
+	EFI_STATUS ret;
+
+	if (!ul.sent && xfer_stats && !xfer_stats->rx)
+		xfer_stats->start = xfer_stats->last = boottime_in_usec();
+
+	ul.chunk = min(ul.size - ul.sent, (UINTN)UPLOAD_CHUNK);
+	fastboot_state = STATE_UPLOAD;
+	ret = transport_write(ul.data + ul.sent, ul.chunk);
+	if (EFI_ERROR(ret)) {
+		efi_perror(ret, L"Failed to send %d bytes", ul.chunk);
+		fastboot_state = STATE_ERROR;
+	}
+}
+
+static void fastboot_upload_complete(void)
+{
+	xfer_stats_record(FALSE, ul.chunk, 1);
+	ul.sent += ul.chunk;
+	if (ul.sent < ul.size) {
+		worker_upload();
+		return;
+	}
+
+	if (xfer_stats && !xfer_stats->rx)
+		xfer_stats = NULL;
+
+	debug(L"Uploaded %ld bytes", ul.size);
+	fastboot_stage_free();
+	fastboot_state = STATE_COMPLETE;
+	fastboot_okay("");
+}
+
+static void fastboot_process_tx(void *buf, unsigned len)
 {
 	switch (fastboot_state) {
 	case STATE_STOPPING:
 		fastboot_state = STATE_STOPPED;
 		break;
 	case STATE_TX:
-		flush_tx_buffer();
+		fastboot_tx_complete(buf, len);
 		break;
 	case STATE_COMPLETE:
 		fastboot_read_command();
@@ -1127,6 +1509,12 @@ static void fastboot_process_tx(__attribute__((__unused__)) void *buf,
 	case STATE_START_DOWNLOAD:
 		worker_download();
 		break;
+	case STATE_START_UPLOAD:
+		worker_upload();
+		break;
+	case STATE_UPLOAD:
+		fastboot_upload_complete();
+		break;
 	default:
 		error(L"Unexpected tx event while in state %d", fastboot_state);
 		break;
@@ -1142,6 +1530,7 @@ static void fastboot_run_command()
 	EFI_STATUS ret;
 	CHAR8 *argv[MAX_ARGS];
 	INTN argc = 0;
+	arena_mark_t mark;
 
 	if (fastboot_state != STATE_COMMAND)
 		return;
@@ -1152,7 +1541,14 @@ static void fastboot_run_command()
 		return;
 	}
 
+	/* Staged data is only available right after the command that
+	   staged it.  */
+	if (!argc || strcmp(argv[0], (CHAR8 *)"upload"))
+		fastboot_stage_free();
+
+	mark = arena_push();
 	fastboot_run_root_cmd((char *)argv[0], argc, argv);
+	arena_pop(mark);
 	received_len = 0;
 	last_received_len = 0;
 
@@ -1166,12 +1562,15 @@ static void fastboot_process_rx(void *buf, unsigned len)
 
 	switch (fastboot_state) {
 	case STATE_DOWNLOAD:
+		xfer_stats_record(TRUE, len, 1);
 		received_len += len;
 		printProgress((received_len / MiB), (dl.size / MiB));
 		if (received_len < dl.size) {
 			s = buf;
 			transport_read(&s[len], dl.size - received_len);
 		} else {
+			if (xfer_stats && xfer_stats->rx)
+				xfer_stats = NULL;
 			fastboot_state = STATE_COMPLETE;
 			fastboot_okay("");
 		}
@@ -1218,6 +1617,7 @@ static EFI_STATUS init_download_buffer(void)
 #ifndef FASTBOOT_FOR_NON_ANDROID
 static struct fastboot_cmd COMMANDS[] = {
 	{ "download",		LOCKED,		cmd_download },
+	{ "upload",		LOCKED,		cmd_upload },
 	{ "flash",		LOCKED,		cmd_flash },
 	{ "erase",		UNLOCKED,	cmd_erase },
 	{ "getvar",		LOCKED,		cmd_getvar },
@@ -1232,6 +1632,7 @@ static struct fastboot_cmd COMMANDS[] = {
 #else
 static struct fastboot_cmd COMMANDS[] = {
 	{ "download",		UNKNOWN_STATE,		cmd_download },
+	{ "upload",		UNKNOWN_STATE,		cmd_upload },
 	{ "flash",		UNKNOWN_STATE,		cmd_flash },
 	{ "erase",		UNKNOWN_STATE,		cmd_erase },
 	{ "getvar",		UNKNOWN_STATE,		cmd_getvar },
@@ -1328,9 +1729,11 @@ static EFI_STATUS fastboot_init()
 	if (EFI_ERROR(ret))
 		goto error;
 
-	ret = publish_partsize();
+#ifdef USB_STORAGE
+	ret = fastboot_publish_dynamic("usb-erase-stats", get_usb_erase_stats_var);
 	if (EFI_ERROR(ret))
 		goto error;
+#endif
 
 #ifndef FASTBOOT_FOR_NON_ANDROID
 	ret = publish_slots();
@@ -1506,6 +1909,9 @@ void fastboot_free()
 		dl.max_size = dl.size = 0;
 	}
 
+	fastboot_stage_free();
+	ZeroMem(&tx_ring, sizeof(tx_ring));
+	xfer_stats = NULL;
 	fastboot_unpublish_all();
 	fastboot_cmdlist_unregister(&cmdlist);
 #ifndef FASTBOOT_FOR_NON_ANDROID
@@ -1516,4 +1922,5 @@ void fastboot_free()
 	fastboot_ui_destroy();
 #endif
 	gpt_free_cache();
+	arena_free();
 }
@@ -41,7 +41,7 @@
 #include "intel_variables.h"
 #include "android.h"
 
-static cmdlist_t cmdlist;
+static struct cmdlist cmdlist;
 
 EFI_STATUS fastboot_flashing_publish(void)
 {
@@ -274,7 +274,7 @@ static void cmd_flashing(INTN argc, CHAR8 **argv)
 		return;
 	}
 
-	fastboot_run_cmd(cmdlist, (char *)argv[1], argc - 1, argv + 1);
+	fastboot_run_cmd(&cmdlist, (char *)argv[1], argc - 1, argv + 1);
 }
 
 static struct fastboot_cmd COMMANDS[] = {
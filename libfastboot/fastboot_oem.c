@@ -44,6 +44,9 @@
 #include "fastboot.h"
 #include "fastboot_ui.h"
 #include "gpt.h"
+#include "timer.h"
+#include "misc_cache.h"
+#include "arena.h"
 #include "authenticated_action.h"
 
 #include "fastboot_oem.h"
@@ -63,9 +66,9 @@
 #define CRASH_EVENT_MENU	"crash-event-menu"
 #define SLOT_FALLBACK		"slot-fallback"
 
-static cmdlist_t cmdlist;
+static struct cmdlist cmdlist;
 #ifdef USE_TPM
-static cmdlist_t cmdlist_fuse;
+static struct cmdlist cmdlist_fuse;
 #endif
 
 static EFI_STATUS fastboot_oem_publish(void)
@@ -143,7 +146,11 @@ static void cmd_oem_setvar(INTN argc, CHAR8 **argv)
 		return;
 	}
 
-	varname = stra_to_str(argv[1]);
+	varname = arena_stra_to_str(argv[1]);
+	if (!varname) {
+		fastboot_fail("Unable to convert string");
+		return;
+	}
 	if (argc == 3)
 		value = argv[2];
 
@@ -158,8 +165,6 @@ static void cmd_oem_setvar(INTN argc, CHAR8 **argv)
 			      value ? "set" : "clear", varname);
 	else
 		fastboot_okay("");
-
-	FreePool(varname);
 }
 
 static void cmd_oem_reboot(INTN argc, CHAR8 **argv)
@@ -172,14 +177,13 @@ static void cmd_oem_reboot(INTN argc, CHAR8 **argv)
 		return;
 	}
 
-	target = stra_to_str(argv[1]);
+	target = arena_stra_to_str(argv[1]);
 	if (!target) {
 		fastboot_fail("Unable to convert string");
 		return;
 	}
 
 	bt = name_to_boot_target(target);
-	FreePool(target);
 	if (bt == UNKNOWN_TARGET) {
 		fastboot_fail("Unknown %a boot target", argv[1]);
 		return;
@@ -229,6 +233,326 @@ static void cmd_oem_garbage_disk(__attribute__((__unused__)) INTN argc,
 		fastboot_fail("Garbage disk failed, %r", ret);
 }
 
+#ifndef USER
+/* Benchmark results are reported as INFO lines of KEY=VALUE pairs
+   so that they can be logged by the host.  Throughput is in kB/s.  */
+#define TRANSPORT_BENCH_TX_DEFAULT	64	/* MiB */
+#define TRANSPORT_BENCH_TX_MAX		256	/* MiB */
+#define STORAGE_BENCH_SIZE_DEFAULT	64	/* MiB */
+#define STORAGE_BENCH_CHUNK		(1024 * 1024)
+#define STORAGE_BENCH_RANDOM_SIZE	4096
+#define STORAGE_BENCH_RANDOM_COUNT	256
+
+static struct fastboot_xfer_stats transport_bench_stats;
+
+static UINT64 bench_rate(UINT64 bytes, UINT64 us)
+{
+	return us ? bytes * 1000 / us : 0;
+}
+
+static void transport_bench_report(void)
+{
+	struct fastboot_xfer_stats *stats = &transport_bench_stats;
+	const char *dir = stats->rx ? "rx" : "tx";
+	UINT64 us = stats->last - stats->start;
+	UINTN i;
+
+	fastboot_info("transport-bench %a bytes=%ld us=%ld kBps=%ld", dir,
+		      stats->bytes, us, bench_rate(stats->bytes, us));
+	fastboot_info("transport-bench %a requests=%d queued=%d", dir,
+		      stats->requests, stats->max_queued);
+	for (i = 0; i < ARRAY_SIZE(stats->hist); i++)
+		if (stats->hist[i])
+			fastboot_info("transport-bench %a lat-us=%ld-%ld count=%d",
+				      dir, i ? 1ULL << i : 0, 1ULL << (i + 1),
+				      stats->hist[i]);
+}
+
+static EFI_STATUS transport_bench_stage(UINTN size)
+{
+	EFI_STATUS ret = EFI_SUCCESS;
+	CHAR8 *chunk;
+	UINTN i;
+
+	chunk = AllocatePool(MiB);
+	if (!chunk)
+		return EFI_OUT_OF_RESOURCES;
+
+	for (i = 0; i < MiB; i++)
+		chunk[i] = i;
+
+	for (i = 0; i < size; i++) {
+		ret = fastboot_stage(chunk, MiB);
+		if (EFI_ERROR(ret))
+			break;
+	}
+
+	FreePool(chunk);
+	return ret;
+}
+
+/* oem transport-bench rx: record the next download ('fastboot stage')
+   oem transport-bench tx [SIZE]: stage SIZE MiB and record the next
+   upload ('fastboot get_staged')
+   oem transport-bench report: report the last recorded test  */
+static void cmd_oem_transport_bench(INTN argc, CHAR8 **argv)
+{
+	EFI_STATUS ret;
+	unsigned long size = TRANSPORT_BENCH_TX_DEFAULT;
+	char *endptr;
+
+	if (argc < 2 || argc > 3) {
+		fastboot_fail("Invalid parameter");
+		return;
+	}
+
+	if (!strcmp(argv[1], (CHAR8 *)"rx") && argc == 2) {
+		fastboot_xfer_stats_arm(&transport_bench_stats, TRUE);
+		fastboot_okay("");
+		return;
+	}
+
+	if (!strcmp(argv[1], (CHAR8 *)"tx")) {
+		if (argc == 3) {
+			size = strtoul((char *)argv[2], &endptr, 10);
+			if (*endptr != '\0' || size == 0 ||
+			    size > TRANSPORT_BENCH_TX_MAX) {
+				fastboot_fail("Invalid size");
+				return;
+			}
+		}
+
+		ret = transport_bench_stage(size);
+		if (EFI_ERROR(ret)) {
+			fastboot_stage_free();
+			fastboot_fail("Failed to stage %ld MiB, %r", size, ret);
+			return;
+		}
+
+		fastboot_xfer_stats_arm(&transport_bench_stats, FALSE);
+		fastboot_okay("");
+		return;
+	}
+
+	if (!strcmp(argv[1], (CHAR8 *)"report") && argc == 2) {
+		fastboot_xfer_stats_arm(NULL, FALSE);
+		if (!transport_bench_stats.requests) {
+			fastboot_fail("No transfer recorded");
+			return;
+		}
+		transport_bench_report();
+		fastboot_okay("");
+		return;
+	}
+
+	fastboot_fail("Unknown transport-bench test");
+}
+
+static UINT64 bench_random(UINT64 *state)
+{
+	/* xorshift64 */
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+	return *state;
+}
+
+static EFI_STATUS storage_bench_seq(struct gpt_partition_interface *gparti,
+				    VOID *buf, UINT64 size, BOOLEAN write)
+{
+	EFI_STATUS ret = EFI_SUCCESS;
+	UINT64 offset, start, us;
+
+	start = boottime_in_usec();
+	for (offset = 0; offset < size; offset += STORAGE_BENCH_CHUNK) {
+		if (!write)
+			ret = read_partition(gparti, offset, STORAGE_BENCH_CHUNK, buf);
+		else if (offset == 0)
+			ret = flash_into(gparti, buf, STORAGE_BENCH_CHUNK);
+		else
+			ret = flash_write(buf, STORAGE_BENCH_CHUNK);
+		if (EFI_ERROR(ret))
+			return ret;
+	}
+	us = boottime_in_usec() - start;
+
+	fastboot_info("storage-bench %a bytes=%ld us=%ld kBps=%ld requests=%ld",
+		      write ? "seq-write" : "seq-read", size, us,
+		      bench_rate(size, us), size / STORAGE_BENCH_CHUNK);
+	return EFI_SUCCESS;
+}
+
+static EFI_STATUS storage_bench_random(struct gpt_partition_interface *gparti,
+				       VOID *buf, UINT64 size, BOOLEAN write)
+{
+	struct gpt_partition_interface target;
+	EFI_STATUS ret;
+	UINT64 state, offset, start, us;
+	UINTN i;
+
+	state = boottime_in_usec() | 1;
+	start = boottime_in_usec();
+	for (i = 0; i < STORAGE_BENCH_RANDOM_COUNT; i++) {
+		offset = bench_random(&state) % (size / STORAGE_BENCH_RANDOM_SIZE);
+		offset *= STORAGE_BENCH_RANDOM_SIZE;
+
+		if (write) {
+			target = *gparti;
+			target.part.starting_lba += offset / gparti->bio->Media->BlockSize;
+			ret = flash_into(&target, buf, STORAGE_BENCH_RANDOM_SIZE);
+		} else
+			ret = read_partition(gparti, offset, STORAGE_BENCH_RANDOM_SIZE, buf);
+		if (EFI_ERROR(ret))
+			return ret;
+	}
+	us = boottime_in_usec() - start;
+
+	fastboot_info("storage-bench %a bytes=%ld us=%ld kBps=%ld iops=%ld",
+		      write ? "rand-write" : "rand-read",
+		      (UINT64)STORAGE_BENCH_RANDOM_COUNT * STORAGE_BENCH_RANDOM_SIZE,
+		      us, bench_rate(STORAGE_BENCH_RANDOM_COUNT * STORAGE_BENCH_RANDOM_SIZE, us),
+		      us ? STORAGE_BENCH_RANDOM_COUNT * 1000000ULL / us : 0);
+	return EFI_SUCCESS;
+}
+
+/* oem storage-bench PARTITION [SIZE]: sequential and random read and
+   write tests on the first SIZE MiB of PARTITION whose content is
+   destroyed.  */
+static void cmd_oem_storage_bench(INTN argc, CHAR8 **argv)
+{
+	struct gpt_partition_interface gparti;
+	EFI_STATUS ret;
+	CHAR16 *label;
+	VOID *buf, *aligned_buf;
+	UINT64 size = STORAGE_BENCH_SIZE_DEFAULT;
+	char *endptr;
+
+	if (argc < 2 || argc > 3) {
+		fastboot_fail("Invalid parameter");
+		return;
+	}
+
+	if (argc == 3) {
+		size = strtoul((char *)argv[2], &endptr, 10);
+		if (*endptr != '\0' || size == 0) {
+			fastboot_fail("Invalid size");
+			return;
+		}
+	}
+	size *= MiB;
+
+	label = stra_to_str(argv[1]);
+	if (!label) {
+		fastboot_fail("Failed to allocate the partition label");
+		return;
+	}
+
+	ret = gpt_get_partition_by_label(label, &gparti, LOGICAL_UNIT_USER);
+	FreePool(label);
+	if (EFI_ERROR(ret)) {
+		fastboot_fail("Failed to get partition %a, %r", argv[1], ret);
+		return;
+	}
+
+	size = min(size, ALIGN_DOWN(get_partition_size(&gparti), STORAGE_BENCH_CHUNK));
+	if (!size) {
+		fastboot_fail("Partition %a is too small", argv[1]);
+		return;
+	}
+
+	ret = alloc_aligned(&buf, &aligned_buf, STORAGE_BENCH_CHUNK,
+			    gparti.bio->Media->IoAlign);
+	if (EFI_ERROR(ret)) {
+		fastboot_fail("Failed to allocate the benchmark buffer");
+		return;
+	}
+	SetMem(aligned_buf, STORAGE_BENCH_CHUNK, 0x5a);
+
+	ret = storage_bench_seq(&gparti, aligned_buf, size, TRUE);
+	if (!EFI_ERROR(ret))
+		ret = storage_bench_seq(&gparti, aligned_buf, size, FALSE);
+	if (!EFI_ERROR(ret))
+		ret = storage_bench_random(&gparti, aligned_buf, size, TRUE);
+	if (!EFI_ERROR(ret))
+		ret = storage_bench_random(&gparti, aligned_buf, size, FALSE);
+	misc_cache_invalidate();
+
+	FreePool(buf);
+	if (EFI_ERROR(ret)) {
+		fastboot_fail("Storage benchmark failed, %r", ret);
+		return;
+	}
+
+	fastboot_okay("");
+}
+
+#define ALLOC_STATS_MAX_SITES	16
+
+static void alloc_stats_site(struct alloc_site *site, VOID *context)
+{
+	UINTN *count = context;
+	const char *file, *p;
+
+	if ((*count)++ == ALLOC_STATS_MAX_SITES)
+		return;
+
+	for (file = p = site->file; *p; p++)
+		if (*p == '/')
+			file = p + 1;
+
+	fastboot_info("%a:%d n=%d bytes=%d live=%d/%d", file, site->line,
+		      site->count, site->bytes, site->live_count,
+		      site->live_bytes);
+}
+
+static void cmd_oem_alloc_stats(INTN argc, CHAR8 **argv)
+{
+	EFI_STATUS ret;
+	struct arena_stats arena;
+	struct alloc_prof_stats prof;
+	UINTN count = 0;
+
+	if (argc > 2) {
+		fastboot_fail("Invalid parameter");
+		return;
+	}
+
+	if (argc == 2) {
+		if (strcmp(argv[1], (CHAR8 *)"reset")) {
+			fastboot_fail("Unknown alloc-stats action");
+			return;
+		}
+		alloc_prof_reset();
+		fastboot_okay("");
+		return;
+	}
+
+	arena_get_stats(&arena);
+	fastboot_info("arena: size=%d used=%d peak=%d allocs=%d failures=%d",
+		      arena.size, arena.used, arena.peak, arena.allocs,
+		      arena.failures);
+
+	ret = alloc_prof_get_stats(&prof);
+	if (ret == EFI_UNSUPPORTED) {
+		fastboot_info("pool: profiler not built in");
+		fastboot_okay("");
+		return;
+	}
+
+	fastboot_info("pool: allocs=%d frees=%d live=%d peak=%d untracked=%d",
+		      prof.allocs, prof.frees, prof.live_bytes,
+		      prof.peak_bytes, prof.untracked);
+
+	ret = alloc_prof_report(alloc_stats_site, &count);
+	if (EFI_ERROR(ret)) {
+		fastboot_fail("Failed to report the allocation sites, %r", ret);
+		return;
+	}
+
+	fastboot_okay("");
+}
+#endif
+
 static struct oem_hash {
 	const CHAR16 *name;
 	EFI_STATUS (*hash)(const CHAR16 *name);
@@ -264,25 +588,63 @@ static struct oem_hash {
 static void cmd_oem_gethashes(INTN argc, CHAR8 **argv)
 {
 	EFI_STATUS ret;
-	UINTN i;
+	BOOLEAN manifest = FALSE, allocated = FALSE, upload = FALSE;
+	INTN i;
 
-	if (argc == 2) {
-		ret = set_hash_algorithm(argv[1]);
+	if (argc > 5) {
+		fastboot_fail("Invalid parameter");
+		return;
+	}
+
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], (CHAR8 *)"manifest")) {
+			manifest = TRUE;
+			continue;
+		}
+		/* The upload variant stages the manifest for the
+		   "upload" command instead of sending INFO lines.  */
+		if (!strcmp(argv[i], (CHAR8 *)"upload")) {
+			manifest = upload = TRUE;
+			continue;
+		}
+		if (!strcmp(argv[i], (CHAR8 *)"allocated")) {
+			allocated = TRUE;
+			continue;
+		}
+
+		ret = set_hash_algorithm(argv[i]);
 		if (EFI_ERROR(ret)) {
 			fastboot_fail("Fail to set the algorithm, %r", ret);
 			return;
 		}
 	}
 
-	for (i = 0; i < ARRAY_SIZE(OEM_HASH); i++) {
+	if (manifest)
+		hash_manifest_start();
+	hash_allocated_only(allocated);
+
+	for (i = 0; i < (INTN)ARRAY_SIZE(OEM_HASH); i++) {
 		ret = OEM_HASH[i].hash(slot_label(OEM_HASH[i].name));
 		if (EFI_ERROR(ret)
 		    && (ret != EFI_NOT_FOUND || OEM_HASH[i].fail_if_missing)) {
+			hash_allocated_only(FALSE);
+			if (manifest)
+				hash_manifest_stop(NULL);
 			fastboot_fail("Failed to get hash for %s, %r",
 				      OEM_HASH[i].name, ret);
 			return;
 		}
 	}
+	hash_allocated_only(FALSE);
+
+	if (manifest) {
+		ret = hash_manifest_stop(upload ? fastboot_stage_line :
+					 fastboot_info_long_string);
+		if (EFI_ERROR(ret)) {
+			fastboot_fail("Failed to report the manifest, %r", ret);
+			return;
+		}
+	}
 
 	fastboot_okay("");
 }
@@ -543,14 +905,14 @@ static void cmd_oem_erase_efivars(__attribute__((__unused__)) INTN argc,
 
 #endif
 
-static void cmd_oem_get_logs(INTN argc, __attribute__((__unused__)) CHAR8 **argv)
+static void cmd_oem_get_logs(INTN argc, CHAR8 **argv)
 {
 	EFI_STATUS ret;
 	UINT32 flags;
 	char *buf;
 	UINTN size;
 
-	if (argc != 1) {
+	if (argc > 2 || (argc == 2 && strcmp(argv[1], (CHAR8 *)"upload"))) {
 		fastboot_fail("Invalid parameter");
 		return;
 	}
@@ -561,6 +923,17 @@ static void cmd_oem_get_logs(INTN argc, __attribute__((__unused__)) CHAR8 **argv
 		return;
 	}
 
+	if (argc == 2) {
+		ret = fastboot_stage(buf, size);
+		FreePool(buf);
+		if (EFI_ERROR(ret)) {
+			fastboot_fail("Failed to stage the log buffer, %r", ret);
+			return;
+		}
+		fastboot_okay("%ld bytes staged", size);
+		return;
+	}
+
 	ret = parse_text_buffer(buf, size, fastboot_info_long_string, NULL);
 	FreePool(buf);
 	if (EFI_ERROR(ret)) {
@@ -578,7 +951,7 @@ static void cmd_oem(INTN argc, CHAR8 **argv)
 		return;
 	}
 
-	fastboot_run_cmd(cmdlist, (char *)argv[1], argc - 1, argv + 1);
+	fastboot_run_cmd(&cmdlist, (char *)argv[1], argc - 1, argv + 1);
 }
 
 #ifdef USE_TPM
@@ -631,7 +1004,7 @@ static void cmd_fuse(INTN argc, CHAR8 **argv)
 		return;
 	}
 
-	fastboot_run_cmd(cmdlist_fuse, (char *)argv[1], argc - 1, argv + 1);
+	fastboot_run_cmd(&cmdlist_fuse, (char *)argv[1], argc - 1, argv + 1);
 }
 
 static void cmd_fuse_vbmeta_key_hash(INTN argc, __attribute__((__unused__)) CHAR8 **argv)
@@ -727,6 +1100,9 @@ static struct fastboot_cmd COMMANDS[] = {
 	{ "fw-update",			UNLOCKED,	cmd_oem_fw_update  },
 	{ "set-storage",		LOCKED,		cmd_oem_set_storage  },
 #ifndef USER
+	{ "transport-bench",		LOCKED,		cmd_oem_transport_bench },
+	{ "storage-bench",		UNLOCKED,	cmd_oem_storage_bench },
+	{ "alloc-stats",		LOCKED,		cmd_oem_alloc_stats },
 	{ "reprovision",		LOCKED,		cmd_oem_reprovision  },
 	{ "rm",				LOCKED,		cmd_oem_rm },
 	{ "set-watchdog-counter-max",	LOCKED,		cmd_oem_set_watchdog_counter_max },
@@ -62,6 +62,8 @@ EFI_STATUS fastboot_usb_read(void *buf, UINT32 size)
 
 /* TCP */
 static const UINT32 TCP_PORT = 5554;
+/* Must not exceed the number of TX tokens of the TCP library.  */
+#define TCP_TX_INFLIGHT 8
 static const CHAR8 PROTOCOL_VERSION[4] = "FB01";
 
 typedef enum tcp_state {
@@ -80,6 +82,8 @@ static struct rx {
 	UINT32 used;
 } rx;
 static UINT64 remaining_data;
+/* Length header of the bulk data packet being sent.  */
+static UINT64 data_header;
 
 static start_callback_t start_callback;
 static data_callback_t rx_callback;
@@ -168,6 +172,10 @@ static void transport_tcp_rx_cb(void *buf, UINT32 size)
 
 static void transport_tcp_tx_cb(void *buf, UINT32 size)
 {
+	/* Only the completion of the data itself is reported.  */
+	if (buf == &data_header)
+		return;
+
 	if (tcp_state == READY)
 		tx_callback(buf, size);
 }
@@ -207,20 +215,32 @@ static EFI_STATUS fastboot_tcp_start(start_callback_t start_cb,
 EFI_STATUS fastboot_tcp_write(void *buf, UINT32 size)
 {
 	EFI_STATUS ret;
-	static char write_buf[MAGIC_LENGTH + sizeof(UINT64)];
+	static char write_bufs[TCP_TX_INFLIGHT][MAGIC_LENGTH + sizeof(UINT64)];
+	static UINTN next_write_buf;
+	char *write_buf;
 
 	if (tcp_state != READY) {
 		error(L"Inconsistent TCP state %d at write", tcp_state);
 		return EFI_NOT_STARTED;
 	}
 
-	if (size + sizeof(UINT64) > sizeof(write_buf)) {
-		error(L"Invalid size %d", size);
-		return EFI_INVALID_PARAMETER;
+	/* Bulk data, such as the upload data phase, is sent from the
+	   caller buffer which stays valid until the tx completion.  */
+	if (size > MAGIC_LENGTH) {
+		data_header = htobe64(size);
+		ret = tcp_write(&data_header, sizeof(data_header));
+		if (EFI_ERROR(ret))
+			return ret;
+
+		return tcp_write(buf, size);
 	}
 
+	write_buf = write_bufs[next_write_buf];
+	next_write_buf = (next_write_buf + 1) % TCP_TX_INFLIGHT;
+
 	*((UINT64 *)write_buf) = htobe64(size);
-	ret = memcpy_s(write_buf + sizeof(UINT64), sizeof(write_buf), buf, size);
+	ret = memcpy_s(write_buf + sizeof(UINT64), sizeof(write_bufs[0]) - sizeof(UINT64),
+		       buf, size);
 	if (EFI_ERROR(ret))
 		return ret;
 
@@ -264,7 +284,8 @@ static transport_t FASTBOOT_TRANSPORT[] = {
 		.stop = tcp_stop,
 		.run = tcp_run,
 		.read = fastboot_tcp_read,
-		.write = fastboot_tcp_write
+		.write = fastboot_tcp_write,
+		.max_tx_inflight = TCP_TX_INFLIGHT
 	}
 };
 
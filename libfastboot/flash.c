@@ -47,8 +47,14 @@
 #include "sparse.h"
 #include "oemvars.h"
 #include "vars.h"
+#include "misc_cache.h"
+#include "prefetch.h"
+#include "drbg.h"
 #include "bootloader.h"
 #include "authenticated_action.h"
+#ifdef DYNAMIC_PARTITIONS
+#include "super.h"
+#endif
 #if defined(IOC_USE_SLCAN) || defined(IOC_USE_CBC)
 #include "ioc_uart_protocol.h"
 #endif
@@ -76,6 +82,23 @@ EFI_STATUS flash_skip(UINT64 size)
 	return EFI_SUCCESS;
 }
 
+EFI_STATUS flash_seek(struct gpt_partition_interface *target, UINT64 offset)
+{
+	if (!target || !target->bio)
+		return EFI_INVALID_PARAMETER;
+
+	gparti = *target;
+	prefetch_free();
+	if (offset > part_end - part_start) {
+		error(L"Attempt to seek outside of partition [%ld %ld] %ld",
+		      part_start, part_end, part_start + offset);
+		return EFI_INVALID_PARAMETER;
+	}
+
+	cur_offset = part_start + offset;
+	return EFI_SUCCESS;
+}
+
 EFI_STATUS flash_write(VOID *data, UINTN size)
 {
 	EFI_STATUS ret;
@@ -420,6 +443,22 @@ out:
 	return ret;
 }
 
+static EFI_STATUS flash_oemvars_report(VOID *data, UINTN size)
+{
+	EFI_STATUS ret;
+	struct oemvars_stats stats;
+
+	ret = flash_oemvars(data, size);
+	if (EFI_ERROR(ret))
+		return ret;
+
+	oemvars_get_stats(&stats);
+	fastboot_info("oemvars: %d written, %d unchanged",
+		      stats.written, stats.unchanged);
+
+	return EFI_SUCCESS;
+}
+
 static EFI_STATUS flash_kernel(VOID *data, UINTN size)
 {
 	return flash_new_bootimage(data, size, NULL, 0);
@@ -433,28 +472,40 @@ static EFI_STATUS flash_ramdisk(VOID *data, UINTN size)
 static CHAR16 *DM_VERITY_PARTITIONS[] =
 	{ SYSTEM_LABEL, VENDOR_LABEL, OEM_LABEL };
 
+EFI_STATUS flash_into(struct gpt_partition_interface *target,
+		      VOID *data, UINTN size)
+{
+	if (!target || !target->bio)
+		return EFI_INVALID_PARAMETER;
+
+	gparti = *target;
+	cur_offset = gparti.part.starting_lba * gparti.bio->Media->BlockSize;
+	/* The prefetched content is stale once the storage is written */
+	prefetch_free();
+
+	if (is_sparse_image(data, size))
+		return flash_sparse(data, size);
+
+	return flash_write(data, size);
+}
+
 EFI_STATUS flash_partition(VOID *data, UINTN size, CHAR16 *label)
 {
 	EFI_STATUS ret;
 	UINTN i;
+	struct gpt_partition_interface target;
 
-	ret = gpt_get_partition_by_label(label, &gparti, LOGICAL_UNIT_USER);
+	ret = gpt_get_partition_by_label(label, &target, LOGICAL_UNIT_USER);
 	if (EFI_ERROR(ret)) {
 		efi_perror(ret, L"Failed to get partition %s", label);
 		return ret;
 	}
 
-	cur_offset = gparti.part.starting_lba * gparti.bio->Media->BlockSize;
-
-	if (is_sparse_image(data, size))
-		ret = flash_sparse(data, size);
-	else
-		ret = flash_write(data, size);
-
+	ret = flash_into(&target, data, size);
 	if (EFI_ERROR(ret))
 		return ret;
 
-	if (!CompareGuid(&gparti.part.type, &EfiPartTypeSystemPartitionGuid)) {
+	if (!CompareGuid(&target.part.type, &EfiPartTypeSystemPartitionGuid)) {
 		ret = gpt_refresh();
 		if (EFI_ERROR(ret))
 			return ret;
@@ -479,13 +530,16 @@ static struct label_exception {
 #endif
 	{ L"sfu", flash_sfu },
 	{ L"ifwi", flash_ifwi },
-	{ L"oemvars", flash_oemvars },
+	{ L"oemvars", flash_oemvars_report },
 	{ L"kernel", flash_kernel },
 	{ L"ramdisk", flash_ramdisk },
 	{ ESP_LABEL, flash_esp },
 	{ BOOTLOADER_LABEL, flash_bootloader },
 	{ BOOTLOADER_A_LABEL, flash_bootloader_a },
 	{ BOOTLOADER_B_LABEL, flash_bootloader_b },
+#ifdef DYNAMIC_PARTITIONS
+	{ SUPER_LABEL, flash_super },
+#endif
 #if defined(IOC_USE_SLCAN) || defined(IOC_USE_CBC)
 	{ L"ioc", flash_ioc },
 #endif
@@ -494,7 +548,7 @@ static struct label_exception {
 #endif
 };
 
-EFI_STATUS flash(VOID *data, UINTN size, CHAR16 *label)
+static EFI_STATUS flash_label(VOID *data, UINTN size, CHAR16 *label)
 {
 	UINTN i;
 
@@ -512,6 +566,19 @@ EFI_STATUS flash(VOID *data, UINTN size, CHAR16 *label)
 	return flash_partition(data, size, label);
 }
 
+EFI_STATUS flash(VOID *data, UINTN size, CHAR16 *label)
+{
+	EFI_STATUS ret;
+
+	/* The misc partition or the partition table might be
+	   overwritten, do not keep a stale misc cache. */
+	ret = flash_label(data, size, label);
+	misc_cache_invalidate();
+	prefetch_free();
+
+	return ret;
+}
+
 EFI_STATUS flash_file(EFI_HANDLE image, CHAR16 *filename, CHAR16 *label)
 {
 	EFI_STATUS ret;
@@ -579,6 +646,8 @@ EFI_STATUS erase_by_label(CHAR16 *label)
 		return ret;
 	}
 	ret = erase_blocks(gparti.handle, gparti.bio, gparti.part.starting_lba, gparti.part.ending_lba);
+	misc_cache_invalidate();
+	prefetch_free();
 	if (EFI_ERROR(ret)) {
 		efi_perror(ret, L"Failed to erase partition %s", label);
 		return ret;
@@ -589,6 +658,51 @@ EFI_STATUS erase_by_label(CHAR16 *label)
 	return EFI_SUCCESS;
 }
 
+/* FAT keeps its boot sector, FSInfo sector and backup boot sector
+   within the first reserved sectors.  Clearing them is enough for the
+   firmware to not find a file system on the partition anymore.  */
+#define FS_INVALIDATE_SIZE (64 * 1024)
+
+EFI_STATUS invalidate_by_label(CHAR16 *label, UINT64 *written)
+{
+	EFI_STATUS ret, erase_ret;
+	EFI_LBA end;
+
+	ret = gpt_get_partition_by_label(label, &gparti, LOGICAL_UNIT_USER);
+	if (EFI_ERROR(ret)) {
+		efi_perror(ret, L"Failed to get partition %s", label);
+		return ret;
+	}
+
+	end = gparti.part.starting_lba + FS_INVALIDATE_SIZE / gparti.bio->Media->BlockSize - 1;
+	end = min(end, gparti.part.ending_lba);
+
+	prefetch_free();
+	ret = fill_zero(gparti.bio, gparti.part.starting_lba, end);
+	if (!EFI_ERROR(ret) && end < gparti.part.ending_lba) {
+		/* The remaining content is meaningless, let the
+		   storage discard it if it can but do not fill it
+		   up with zeros otherwise.  */
+		erase_ret = storage_discard_blocks(gparti.handle, gparti.bio,
+						   end + 1, gparti.part.ending_lba);
+		if (EFI_ERROR(erase_ret))
+			debug(L"Discard of partition %s skipped: %r", label, erase_ret);
+	}
+	misc_cache_invalidate();
+	if (EFI_ERROR(ret)) {
+		efi_perror(ret, L"Failed to invalidate partition %s", label);
+		return ret;
+	}
+
+	if (written)
+		*written = (end - gparti.part.starting_lba + 1) * gparti.bio->Media->BlockSize;
+
+	if (!CompareGuid(&gparti.part.type, &EfiPartTypeSystemPartitionGuid))
+		return gpt_refresh();
+
+	return EFI_SUCCESS;
+}
+
 EFI_STATUS garbage_disk(void)
 {
 	struct gpt_partition_interface gparti;
@@ -610,16 +724,13 @@ EFI_STATUS garbage_disk(void)
 		return ret;
 	}
 
-	ret = generate_random_numbers(aligned_chunk, size);
-	if (EFI_ERROR(ret)) {
-		efi_perror(ret, L"Failed to generate random numbers");
-		FreePool(chunk);
-		return ret;
-	}
-
-	ret = fill_with(gparti.bio, gparti.part.starting_lba,
-			gparti.part.ending_lba, aligned_chunk, N_BLOCK);
+	ret = fill_with_random(gparti.bio, gparti.part.starting_lba,
+			       gparti.part.ending_lba, aligned_chunk, N_BLOCK,
+			       drbg_generate);
 
 	FreePool(chunk);
+	drbg_free();
+	misc_cache_invalidate();
+	prefetch_free();
 	return gpt_refresh();
 }
@@ -36,11 +36,20 @@
 #define _FLASH_H_
 
 #include <efi.h>
+#include "gpt.h"
 
 EFI_STATUS flash_skip(UINT64 size);
+/* Position the next flash_write(), flash_fill() or flash_skip() at
+   OFFSET bytes from the beginning of TARGET. */
+EFI_STATUS flash_seek(struct gpt_partition_interface *target, UINT64 offset);
 EFI_STATUS flash_write(VOID *data, UINTN size);
 EFI_STATUS flash_fill(UINT32 pattern, UINTN size);
 
+/* Write a raw or sparse image at the beginning of TARGET, without
+   any of the label specific processing of flash(). */
+EFI_STATUS flash_into(struct gpt_partition_interface *target,
+		      VOID *data, UINTN size);
+
 /* return value for flash() function */
 
 #define REFRESH_PARTITION_VAR 0x1
@@ -48,6 +57,10 @@ EFI_STATUS flash_fill(UINT32 pattern, UINTN size);
 EFI_STATUS flash(VOID *data, UINTN size, CHAR16 *label);
 EFI_STATUS flash_file(EFI_HANDLE image, CHAR16 *filename, CHAR16 *label);
 EFI_STATUS erase_by_label(CHAR16 *label);
+/* Make the file system of partition LABEL unrecognizable without
+   erasing the whole partition.  WRITTEN, if not NULL, receives the
+   number of bytes written.  */
+EFI_STATUS invalidate_by_label(CHAR16 *label, UINT64 *written);
 EFI_STATUS garbage_disk(void);
 EFI_STATUS flash_partition(VOID *data, UINTN size, CHAR16 *label);
 EFI_STATUS fill_zero(EFI_BLOCK_IO *bio, UINT64 start, UINT64 end);
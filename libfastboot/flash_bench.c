@@ -0,0 +1,347 @@
+/*
+ * Copyright (c) 2020, Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#include <efi.h>
+#include <efilib.h>
+#include <lib.h>
+#include <fastboot.h>
+
+#include "flash.h"
+#include "gpt_bin.h"
+#include "storage.h"
+#include "sparse_format.h"
+#include "timer.h"
+
+/* Benchmark of the flash pipeline (sparse parsing, buffering and
+   block writes) against a memory backed block device.  The device
+   delays each request according to a simple latency and bandwidth
+   model so that the effect of the number and the size of the
+   requests on the throughput can be measured without the real
+   storage.  */
+
+#define BENCH_BLOCK_SIZE	512
+#define BENCH_SPARSE_BLK_SZ	4096
+#define BENCH_IMAGE_SIZE	(32 * 1024 * 1024)
+#define BENCH_PART_START	2048
+#define BENCH_DISK_SIZE		(BENCH_PART_START * BENCH_BLOCK_SIZE + \
+				 BENCH_IMAGE_SIZE)
+
+/* Sparse image layout, repeated for each MiB of the output image */
+#define SPARSE_RAW_SIZE		(512 * 1024)
+#define SPARSE_FILL_SIZE	(256 * 1024)
+#define SPARSE_SKIP_SIZE	(256 * 1024)
+
+struct disk_model {
+	const CHAR16 *name;
+	UINTN latency;		/* us per request */
+	UINTN bandwidth;	/* MB/s, 0 means unlimited */
+};
+
+static const struct disk_model DISK_MODELS[] = {
+	{ L"ram", 0, 0 },
+	{ L"emmc", 150, 250 },
+	{ L"ufs", 60, 800 }
+};
+
+static struct ram_disk {
+	EFI_BLOCK_IO bio;
+	EFI_DISK_IO dio;
+	EFI_BLOCK_IO_MEDIA media;
+	UINT8 *data;
+	const struct disk_model *model;
+	UINTN requests;
+	UINT64 bytes;
+} disk;
+
+static EFI_STATUS disk_access(UINT64 offset, UINTN size)
+{
+	UINTN delay;
+
+	if (offset > BENCH_DISK_SIZE || size > BENCH_DISK_SIZE - offset)
+		return EFI_INVALID_PARAMETER;
+
+	disk.requests++;
+	disk.bytes += size;
+
+	/* A MB/s bandwidth is also a byte per us bandwidth */
+	delay = disk.model->latency;
+	if (disk.model->bandwidth)
+		delay += size / disk.model->bandwidth;
+	if (delay)
+		uefi_call_wrapper(BS->Stall, 1, delay);
+
+	return EFI_SUCCESS;
+}
+
+static EFIAPI EFI_STATUS disk_read(__attribute__((__unused__)) EFI_DISK_IO *This,
+				   __attribute__((__unused__)) UINT32 MediaId,
+				   UINT64 Offset, UINTN BufferSize, VOID *Buffer)
+{
+	EFI_STATUS ret;
+
+	ret = disk_access(Offset, BufferSize);
+	if (EFI_ERROR(ret))
+		return ret;
+
+	return memcpy_s(Buffer, BufferSize, disk.data + Offset, BufferSize);
+}
+
+static EFIAPI EFI_STATUS disk_write(__attribute__((__unused__)) EFI_DISK_IO *This,
+				    __attribute__((__unused__)) UINT32 MediaId,
+				    UINT64 Offset, UINTN BufferSize, VOID *Buffer)
+{
+	EFI_STATUS ret;
+
+	ret = disk_access(Offset, BufferSize);
+	if (EFI_ERROR(ret))
+		return ret;
+
+	return memcpy_s(disk.data + Offset, BufferSize, Buffer, BufferSize);
+}
+
+static EFIAPI EFI_STATUS block_reset(__attribute__((__unused__)) EFI_BLOCK_IO *This,
+				     __attribute__((__unused__)) BOOLEAN ExtendedVerification)
+{
+	return EFI_SUCCESS;
+}
+
+static EFIAPI EFI_STATUS block_read(EFI_BLOCK_IO *This, UINT32 MediaId, EFI_LBA LBA,
+				    UINTN BufferSize, VOID *Buffer)
+{
+	return disk_read(&disk.dio, MediaId, LBA * This->Media->BlockSize,
+			 BufferSize, Buffer);
+}
+
+static EFIAPI EFI_STATUS block_write(EFI_BLOCK_IO *This, UINT32 MediaId, EFI_LBA LBA,
+				     UINTN BufferSize, VOID *Buffer)
+{
+	return disk_write(&disk.dio, MediaId, LBA * This->Media->BlockSize,
+			  BufferSize, Buffer);
+}
+
+static EFIAPI EFI_STATUS block_flush(__attribute__((__unused__)) EFI_BLOCK_IO *This)
+{
+	return EFI_SUCCESS;
+}
+
+static EFI_STATUS ram_disk_init(struct gpt_partition_interface *gparti)
+{
+	disk.data = AllocatePool(BENCH_DISK_SIZE);
+	if (!disk.data)
+		return EFI_OUT_OF_RESOURCES;
+
+	disk.media.MediaPresent = TRUE;
+	disk.media.BlockSize = BENCH_BLOCK_SIZE;
+	disk.media.IoAlign = 0;
+	disk.media.LastBlock = BENCH_DISK_SIZE / BENCH_BLOCK_SIZE - 1;
+
+	disk.bio.Revision = EFI_BLOCK_IO_INTERFACE_REVISION;
+	disk.bio.Media = &disk.media;
+	disk.bio.Reset = block_reset;
+	disk.bio.ReadBlocks = block_read;
+	disk.bio.WriteBlocks = block_write;
+	disk.bio.FlushBlocks = block_flush;
+
+	disk.dio.Revision = EFI_DISK_IO_INTERFACE_REVISION;
+	disk.dio.ReadDisk = disk_read;
+	disk.dio.WriteDisk = disk_write;
+
+	ZeroMem(gparti, sizeof(*gparti));
+	gparti->bio = &disk.bio;
+	gparti->dio = &disk.dio;
+	gparti->part.starting_lba = BENCH_PART_START;
+	gparti->part.ending_lba = disk.media.LastBlock;
+
+	return EFI_SUCCESS;
+}
+
+static void ram_disk_free(void)
+{
+	if (disk.data)
+		FreePool(disk.data);
+	ZeroMem(&disk, sizeof(disk));
+}
+
+static EFI_STATUS build_raw_image(VOID **image, UINTN *size)
+{
+	UINT32 *data;
+	UINTN i;
+
+	data = AllocatePool(BENCH_IMAGE_SIZE);
+	if (!data)
+		return EFI_OUT_OF_RESOURCES;
+
+	for (i = 0; i < BENCH_IMAGE_SIZE / sizeof(*data); i++)
+		data[i] = i * 2654435761U;
+
+	*image = data;
+	*size = BENCH_IMAGE_SIZE;
+	return EFI_SUCCESS;
+}
+
+static CHAR8 *add_chunk(CHAR8 *s, UINT16 type, UINT32 size, UINT32 data_size)
+{
+	struct chunk_header *ckh = (struct chunk_header *)s;
+
+	ckh->chunk_type = type;
+	ckh->reserved1 = 0;
+	ckh->chunk_sz = size / BENCH_SPARSE_BLK_SZ;
+	ckh->total_sz = sizeof(*ckh) + data_size;
+
+	return s + sizeof(*ckh);
+}
+
+static EFI_STATUS build_sparse_image(VOID **image, UINTN *size)
+{
+	struct sparse_header *sph;
+	UINTN i, nb_groups, total;
+	UINT32 *raw;
+	CHAR8 *s;
+
+	nb_groups = BENCH_IMAGE_SIZE / MiB;
+	total = sizeof(*sph) + nb_groups *
+		(3 * sizeof(struct chunk_header) + SPARSE_RAW_SIZE + sizeof(UINT32));
+
+	sph = AllocateZeroPool(total);
+	if (!sph)
+		return EFI_OUT_OF_RESOURCES;
+
+	sph->magic = SPARSE_HEADER_MAGIC;
+	sph->major_version = 1;
+	sph->file_hdr_sz = sizeof(*sph);
+	sph->chunk_hdr_sz = sizeof(struct chunk_header);
+	sph->blk_sz = BENCH_SPARSE_BLK_SZ;
+	sph->total_blks = BENCH_IMAGE_SIZE / BENCH_SPARSE_BLK_SZ;
+	sph->total_chunks = nb_groups * 3;
+
+	s = (CHAR8 *)(sph + 1);
+	for (i = 0; i < nb_groups; i++) {
+		raw = (UINT32 *)add_chunk(s, CHUNK_TYPE_RAW, SPARSE_RAW_SIZE,
+					  SPARSE_RAW_SIZE);
+		raw[0] = i;
+		s = (CHAR8 *)raw + SPARSE_RAW_SIZE;
+
+		raw = (UINT32 *)add_chunk(s, CHUNK_TYPE_FILL, SPARSE_FILL_SIZE,
+					  sizeof(UINT32));
+		*raw = 0xdeadbeef;
+		s = (CHAR8 *)(raw + 1);
+
+		s = add_chunk(s, CHUNK_TYPE_DONT_CARE, SPARSE_SKIP_SIZE, 0);
+	}
+
+	*image = sph;
+	*size = total;
+	return EFI_SUCCESS;
+}
+
+static void report(const CHAR16 *scenario, UINT64 bytes, UINT64 us)
+{
+	UINT64 rate = us ? bytes * 100 / us : 0;
+
+	info(L"%s/%s: %ld KiB in %ld us, %ld.%02ld MB/s, %ld requests/MiB, %ld KiB/request",
+	     scenario, disk.model->name, bytes / 1024, us, rate / 100, rate % 100,
+	     disk.requests * MiB / bytes,
+	     disk.requests ? disk.bytes / 1024 / disk.requests : 0);
+}
+
+static EFI_STATUS bench_flash(const CHAR16 *scenario,
+			      struct gpt_partition_interface *gparti,
+			      EFI_STATUS (*build)(VOID **image, UINTN *size))
+{
+	EFI_STATUS ret;
+	VOID *image;
+	UINTN size;
+	UINT64 start;
+
+	ret = build(&image, &size);
+	if (EFI_ERROR(ret)) {
+		efi_perror(ret, L"Failed to build the %s image", scenario);
+		return ret;
+	}
+
+	disk.requests = disk.bytes = 0;
+	start = boottime_in_usec();
+	ret = flash_into(gparti, image, size);
+	if (EFI_ERROR(ret))
+		efi_perror(ret, L"%s flash failed", scenario);
+	else
+		report(scenario, BENCH_IMAGE_SIZE, boottime_in_usec() - start);
+
+	FreePool(image);
+	return ret;
+}
+
+static EFI_STATUS bench_erase(struct gpt_partition_interface *gparti)
+{
+	EFI_STATUS ret;
+	UINT64 start;
+
+	disk.requests = disk.bytes = 0;
+	start = boottime_in_usec();
+	ret = fill_zero(gparti->bio, gparti->part.starting_lba,
+			gparti->part.ending_lba);
+	if (EFI_ERROR(ret)) {
+		efi_perror(ret, L"erase failed");
+		return ret;
+	}
+
+	report(L"erase", BENCH_IMAGE_SIZE, boottime_in_usec() - start);
+	return EFI_SUCCESS;
+}
+
+void fastboot_flash_bench(void)
+{
+	EFI_STATUS ret;
+	struct gpt_partition_interface gparti;
+	UINTN i;
+
+	if (!boottime_in_usec())
+		info(L"No TSC frequency, throughput will not be reported");
+
+	for (i = 0; i < ARRAY_SIZE(DISK_MODELS); i++) {
+		ret = ram_disk_init(&gparti);
+		if (EFI_ERROR(ret)) {
+			efi_perror(ret, L"Failed to allocate the benchmark disk");
+			return;
+		}
+		disk.model = &DISK_MODELS[i];
+
+		ret = bench_flash(L"raw", &gparti, build_raw_image);
+		if (!EFI_ERROR(ret))
+			ret = bench_flash(L"sparse", &gparti, build_sparse_image);
+		if (!EFI_ERROR(ret))
+			ret = bench_erase(&gparti);
+
+		ram_disk_free();
+		if (EFI_ERROR(ret))
+			return;
+	}
+}
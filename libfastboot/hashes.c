@@ -89,18 +89,78 @@ out:
 	return ret;
 }
 
-static void hash_buffer(CHAR8 *buffer, UINT64 len, CHAR8 *hash)
+/* In manifest mode, the hashes are collected as "<target> <hash>"
+   lines which are reported sorted by target so that the output of
+   two devices or two builds can be compared with diff.  */
+static BOOLEAN manifest_enabled;
+static CHAR8 **manifest;
+static UINTN manifest_count;
+static UINTN manifest_max;
+
+static EFI_STATUS manifest_add(const CHAR16 *base, const CHAR16 *name,
+			       CHAR8 *hashstr)
 {
-	EVP_MD_CTX mdctx;
+	CHAR8 **entries;
+	CHAR8 *line;
+	UINTN size;
+	int len;
+
+	if (manifest_count == manifest_max) {
+		size = manifest_max ? manifest_max * 2 : 64;
+		entries = ReallocatePool(manifest, manifest_max * sizeof(*manifest),
+					 size * sizeof(*manifest));
+		if (!entries)
+			return EFI_OUT_OF_RESOURCES;
+		manifest = entries;
+		manifest_max = size;
+	}
 
-	if (!selected_md)
-		set_hash_algorithm(NULL);
+	size = StrLen(base) + StrLen(name) + strlen(hashstr) + 2;
+	line = AllocatePool(size);
+	if (!line)
+		return EFI_OUT_OF_RESOURCES;
 
-	EVP_MD_CTX_init(&mdctx);
-	EVP_DigestInit_ex(&mdctx, selected_md, NULL);
-	EVP_DigestUpdate(&mdctx, buffer, len);
-	EVP_DigestFinal_ex(&mdctx, hash, NULL);
-	EVP_MD_CTX_cleanup(&mdctx);
+	len = efi_snprintf(line, size, (CHAR8 *)"%s%s %a", base, name, hashstr);
+	if (len < 0) {
+		FreePool(line);
+		return EFI_INVALID_PARAMETER;
+	}
+
+	manifest[manifest_count++] = line;
+	return EFI_SUCCESS;
+}
+
+static int manifest_cmp(const void *a, const void *b)
+{
+	return strcmp(*(CHAR8 **)a, *(CHAR8 **)b);
+}
+
+void hash_manifest_start(void)
+{
+	manifest_enabled = TRUE;
+}
+
+EFI_STATUS hash_manifest_stop(EFI_STATUS (*report)(char *line, VOID *context))
+{
+	EFI_STATUS ret = EFI_SUCCESS;
+	UINTN i;
+
+	if (report && manifest_count)
+		qsort(manifest, manifest_count, sizeof(*manifest), manifest_cmp);
+
+	for (i = 0; i < manifest_count; i++) {
+		if (report && !EFI_ERROR(ret))
+			ret = report((char *)manifest[i], NULL);
+		FreePool(manifest[i]);
+	}
+
+	if (manifest)
+		FreePool(manifest);
+	manifest = NULL;
+	manifest_count = manifest_max = 0;
+	manifest_enabled = FALSE;
+
+	return ret;
 }
 
 static EFI_STATUS report_hash(const CHAR16 *base, const CHAR16 *name, CHAR8 *hash)
@@ -114,6 +174,9 @@ static EFI_STATUS report_hash(const CHAR16 *base, const CHAR16 *name, CHAR8 *has
 		return ret;
 	}
 
+	if (manifest_enabled)
+		return manifest_add(base, name, hashstr);
+
 	fastboot_info("target: %s%s", base, name);
 	fastboot_info("hash: %a", hashstr);
 
@@ -123,44 +186,60 @@ static EFI_STATUS report_hash(const CHAR16 *base, const CHAR16 *name, CHAR8 *has
 #define MAX_DIR 10
 #define MAX_FILENAME_LEN (256 * sizeof(CHAR16))
 #define DIR_BUFFER_SIZE (MAX_DIR * MAX_FILENAME_LEN)
+/* ESP files are hashed by chunks through a single buffer shared by
+   the whole walk so that memory usage does not depend on the file
+   sizes.  */
+#define FILE_CHUNK (256 * 1024)
 static CHAR16 *path;
 static CHAR16 *subname[MAX_DIR];
 static INTN subdir;
+static CHAR8 *file_chunk;
 
 static EFI_STATUS hash_file(EFI_FILE *dir, EFI_FILE_INFO *fi)
 {
+	EVP_MD_CTX mdctx;
 	EFI_FILE *file;
-	void *data;
 	CHAR8 hash[EVP_MAX_MD_SIZE];
-	EFI_STATUS ret;
+	EFI_STATUS ret = EFI_SUCCESS;
+	UINT64 left;
 	UINTN size;
 
-	if (!fi->Size) {
-		hash_buffer(NULL, 0, hash);
-		return report_hash(path, fi->FileName, hash);
-	}
-
-	ret = uefi_call_wrapper(dir->Open, 5, dir, &file, fi->FileName, EFI_FILE_MODE_READ, 0);
-	if (EFI_ERROR(ret))
-		return ret;
+	if (!selected_md)
+		set_hash_algorithm(NULL);
 
-	size = fi->FileSize;
+	EVP_MD_CTX_init(&mdctx);
+	EVP_DigestInit_ex(&mdctx, selected_md, NULL);
 
-	data = AllocatePool(size);
-	if (!data)
-		goto close;
+	if (fi->FileSize) {
+		ret = uefi_call_wrapper(dir->Open, 5, dir, &file, fi->FileName,
+					EFI_FILE_MODE_READ, 0);
+		if (EFI_ERROR(ret))
+			goto out;
+
+		for (left = fi->FileSize; left; left -= size) {
+			size = min(left, (UINT64)FILE_CHUNK);
+			ret = uefi_call_wrapper(file->Read, 3, file, &size, file_chunk);
+			if (EFI_ERROR(ret))
+				break;
+			if (!size) {
+				ret = EFI_END_OF_FILE;
+				break;
+			}
+			EVP_DigestUpdate(&mdctx, file_chunk, size);
+		}
 
-	ret = uefi_call_wrapper(file->Read, 3, file, &size, data);
-	if (EFI_ERROR(ret))
-		goto free;
+		uefi_call_wrapper(file->Close, 1, file);
+		if (EFI_ERROR(ret)) {
+			efi_perror(ret, L"Failed to read %s%s", path, fi->FileName);
+			goto out;
+		}
+	}
 
-	hash_buffer(data, size, hash);
+	EVP_DigestFinal_ex(&mdctx, hash, NULL);
 	ret = report_hash(path, fi->FileName, hash);
 
-free:
-	FreePool(data);
-close:
-	uefi_call_wrapper(file->Close, 1, file);
+out:
+	EVP_MD_CTX_cleanup(&mdctx);
 	return ret;
 }
 
@@ -233,11 +312,15 @@ static EFI_STATUS get_esp_hash(void)
 		return ret;
 	}
 
+	file_chunk = AllocatePool(FILE_CHUNK);
+	if (!file_chunk)
+		return EFI_OUT_OF_RESOURCES;
+
 	subdir = 0;
 	ret = uefi_call_wrapper(io->OpenVolume, 2, io, &dirs[subdir]);
 	if (EFI_ERROR(ret)) {
 		efi_perror(ret, L"Failed to open root directory");
-		return ret;
+		goto out;
 	}
 	initpath();
 	do {
@@ -281,11 +364,16 @@ static EFI_STATUS get_esp_hash(void)
 			ret = hash_file(dirs[subdir], fi);
 			if (EFI_ERROR(ret)) {
 				freepath();
-				return ret;
+				goto out;
 			}
 		}
 	} while (size || subdir >= 0);
-	return EFI_SUCCESS;
+	ret = EFI_SUCCESS;
+
+out:
+	FreePool(file_chunk);
+	file_chunk = NULL;
+	return ret;
 }
 
 EFI_STATUS get_bootloader_hash(const CHAR16 *label)
@@ -317,18 +405,41 @@ EFI_STATUS get_bootloader_hash(const CHAR16 *label)
 #define EXT4_SUPER_MAGIC 0xEF53
 #define EXT4_VALID_FS 0x0001
 
+#define EXT4_INCOMPAT_META_BG 0x0010
+#define EXT4_INCOMPAT_64BIT 0x0080
+#define EXT4_MIN_DESC_SIZE 32
+#define EXT4_MIN_DESC_SIZE_64BIT 64
+#define EXT4_BG_BLOCK_UNINIT 0x0002
+
 struct ext4_super_block {
 	INT32 unused;
 	INT32 s_blocks_count_lo;
-	INT32 unused2[4];
+	INT32 unused2[3];
+	UINT32 s_first_data_block;
 	INT32 s_log_block_size;
-	INT32 unused3[7];
+	INT32 unused3;
+	UINT32 s_blocks_per_group;
+	INT32 unused4[5];
 	UINT16 s_magic;
 	UINT16 s_state;
-	INT32 unused4[69];
+	INT32 unused5[9];
+	UINT32 s_feature_incompat;
+	UINT32 s_feature_ro_compat;
+	UINT8 unused6[150];
+	UINT16 s_desc_size;
+	INT32 unused7[20];
 	INT32 s_blocks_count_hi;
 };
 
+struct ext4_group_desc {
+	UINT32 bg_block_bitmap_lo;
+	UINT32 unused[3];
+	UINT16 unused2;
+	UINT16 bg_flags;
+	UINT32 unused3[3];
+	UINT32 bg_block_bitmap_hi;
+};
+
 struct ext4_verity_header {
 	UINT32 magic;
 	UINT32 protocol_version;
@@ -660,6 +771,218 @@ static EFI_STATUS get_ext4_len(struct gpt_partition_interface *gparti, UINT64 *l
 	return EFI_SUCCESS;
 }
 
+/* In allocated mode, an ext4 filesystem is hashed as a sequence of
+   runs of blocks.  Each run is introduced by its length in blocks and
+   its state.  The content of the allocated runs is hashed while the
+   free runs are only represented by their header, so the time needed
+   depends on the used space and the digest remains deterministic.  */
+static BOOLEAN allocated_only;
+
+void hash_allocated_only(BOOLEAN enable)
+{
+	allocated_only = enable;
+}
+
+struct ext4_run {
+	struct gpt_partition_interface *gparti;
+	EVP_MD_CTX *mdctx;
+	CHAR8 *buffer;
+	UINT64 block_size;
+	UINT64 start;
+	UINT64 count;
+	BOOLEAN allocated;
+};
+
+static EFI_STATUS hash_range(struct ext4_run *run, UINT64 offset, UINT64 len)
+{
+	EFI_STATUS ret;
+	UINT64 chunklen;
+
+	for (; len; len -= chunklen, offset += chunklen) {
+		chunklen = MIN(len, CHUNK);
+		ret = read_partition(run->gparti, offset, chunklen, run->buffer);
+		if (EFI_ERROR(ret))
+			return ret;
+		EVP_DigestUpdate(run->mdctx, run->buffer, chunklen);
+	}
+
+	return EFI_SUCCESS;
+}
+
+static EFI_STATUS ext4_run_flush(struct ext4_run *run)
+{
+	UINT8 allocated = run->allocated;
+	EFI_STATUS ret = EFI_SUCCESS;
+
+	if (!run->count)
+		return EFI_SUCCESS;
+
+	EVP_DigestUpdate(run->mdctx, &run->count, sizeof(run->count));
+	EVP_DigestUpdate(run->mdctx, &allocated, sizeof(allocated));
+	if (run->allocated)
+		ret = hash_range(run, run->start * run->block_size,
+				 run->count * run->block_size);
+
+	run->start += run->count;
+	run->count = 0;
+	return ret;
+}
+
+static EFI_STATUS ext4_run_add(struct ext4_run *run, BOOLEAN allocated, UINT64 count)
+{
+	EFI_STATUS ret;
+
+	if (run->count && run->allocated != allocated) {
+		ret = ext4_run_flush(run);
+		if (EFI_ERROR(ret))
+			return ret;
+	}
+
+	run->allocated = allocated;
+	run->count += count;
+	return EFI_SUCCESS;
+}
+
+static EFI_STATUS ext4_add_bitmap(struct ext4_run *run, UINT8 *bitmap, UINT64 nblocks)
+{
+	EFI_STATUS ret;
+	UINT64 i;
+
+	for (i = 0; i < nblocks; i++) {
+		/* Whole bytes are the common case. */
+		if (!(i % 8) && nblocks - i >= 8 &&
+		    (bitmap[i / 8] == 0 || bitmap[i / 8] == 0xFF)) {
+			ret = ext4_run_add(run, bitmap[i / 8] != 0, 8);
+			i += 7;
+		} else
+			ret = ext4_run_add(run, (bitmap[i / 8] >> (i % 8)) & 1, 1);
+		if (EFI_ERROR(ret))
+			return ret;
+	}
+
+	return EFI_SUCCESS;
+}
+
+/* Groups with an uninitialized block bitmap are considered free.  The
+   meta_bg layout is not supported.  */
+static EFI_STATUS hash_ext4_allocated(struct gpt_partition_interface *gparti,
+				      UINT64 fs_len, CHAR8 *hash)
+{
+	struct ext4_super_block sb;
+	struct ext4_group_desc *desc;
+	struct ext4_run run;
+	EVP_MD_CTX mdctx;
+	UINT64 blocks_count, ngroups, group_blocks, bitmap_block, g;
+	UINTN desc_size;
+	CHAR8 *gdt = NULL, *bitmap = NULL;
+	EFI_STATUS ret;
+
+	ret = read_partition(gparti, EXT4_SB_OFFSET, sizeof(sb), &sb);
+	if (EFI_ERROR(ret))
+		return ret;
+
+	if (sb.s_feature_incompat & EXT4_INCOMPAT_META_BG)
+		return EFI_UNSUPPORTED;
+
+	desc_size = EXT4_MIN_DESC_SIZE;
+	if (sb.s_feature_incompat & EXT4_INCOMPAT_64BIT) {
+		desc_size = sb.s_desc_size;
+		if (desc_size < EXT4_MIN_DESC_SIZE_64BIT)
+			return EFI_UNSUPPORTED;
+	}
+
+	run.block_size = 1024 << sb.s_log_block_size;
+	blocks_count = ((UINT64)sb.s_blocks_count_hi << 32) + (UINT32)sb.s_blocks_count_lo;
+	if (!sb.s_blocks_per_group || sb.s_blocks_per_group > run.block_size * 8 ||
+	    sb.s_first_data_block >= blocks_count)
+		return EFI_UNSUPPORTED;
+	ngroups = (blocks_count - sb.s_first_data_block + sb.s_blocks_per_group - 1)
+		/ sb.s_blocks_per_group;
+
+	gdt = AllocatePool(ngroups * desc_size);
+	bitmap = AllocatePool(run.block_size);
+	run.buffer = AllocatePool(CHUNK);
+	if (!gdt || !bitmap || !run.buffer) {
+		ret = EFI_OUT_OF_RESOURCES;
+		goto free;
+	}
+
+	ret = read_partition(gparti, (sb.s_first_data_block + 1) * run.block_size,
+			     ngroups * desc_size, gdt);
+	if (EFI_ERROR(ret))
+		goto free;
+
+	if (!selected_md)
+		set_hash_algorithm(NULL);
+
+	EVP_MD_CTX_init(&mdctx);
+	EVP_DigestInit_ex(&mdctx, selected_md, NULL);
+
+	run.gparti = gparti;
+	run.mdctx = &mdctx;
+	run.start = run.count = 0;
+	run.allocated = TRUE;
+
+	/* The blocks before the first group (boot block) */
+	ret = ext4_run_add(&run, TRUE, sb.s_first_data_block);
+	if (EFI_ERROR(ret))
+		goto cleanup;
+
+	for (g = 0; g < ngroups; g++) {
+		group_blocks = MIN(blocks_count - sb.s_first_data_block
+				   - g * sb.s_blocks_per_group,
+				   (UINT64)sb.s_blocks_per_group);
+		desc = (struct ext4_group_desc *)(gdt + g * desc_size);
+		if (desc->bg_flags & EXT4_BG_BLOCK_UNINIT) {
+			ret = ext4_run_add(&run, FALSE, group_blocks);
+			if (EFI_ERROR(ret))
+				goto cleanup;
+			continue;
+		}
+
+		bitmap_block = desc->bg_block_bitmap_lo;
+		if (desc_size >= EXT4_MIN_DESC_SIZE_64BIT)
+			bitmap_block |= (UINT64)desc->bg_block_bitmap_hi << 32;
+		if (bitmap_block >= blocks_count) {
+			ret = EFI_COMPROMISED_DATA;
+			goto cleanup;
+		}
+
+		ret = read_partition(gparti, bitmap_block * run.block_size,
+				     run.block_size, bitmap);
+		if (EFI_ERROR(ret))
+			goto cleanup;
+
+		ret = ext4_add_bitmap(&run, (UINT8 *)bitmap, group_blocks);
+		if (EFI_ERROR(ret))
+			goto cleanup;
+	}
+
+	ret = ext4_run_flush(&run);
+	if (EFI_ERROR(ret))
+		goto cleanup;
+
+	/* Whatever follows the filesystem (verity metadata, crypto
+	   footer, ...) is hashed entirely. */
+	ret = hash_range(&run, blocks_count * run.block_size,
+			 fs_len - MIN(fs_len, blocks_count * run.block_size));
+	if (EFI_ERROR(ret))
+		goto cleanup;
+
+	EVP_DigestFinal_ex(&mdctx, hash, NULL);
+
+cleanup:
+	EVP_MD_CTX_cleanup(&mdctx);
+free:
+	if (run.buffer)
+		FreePool(run.buffer);
+	if (bitmap)
+		FreePool(bitmap);
+	if (gdt)
+		FreePool(gdt);
+	return ret;
+}
+
 static EFI_STATUS get_squashfs_len(struct gpt_partition_interface *gparti, UINT64 *len)
 {
 	struct squashfs_super_block sb;
@@ -717,10 +1040,12 @@ EFI_STATUS get_fs_hash(const CHAR16 *label)
 	static struct supported_fs {
 		const char *name;
 		EFI_STATUS (*get_len)(struct gpt_partition_interface *gparti, UINT64 *len);
+		EFI_STATUS (*hash_allocated)(struct gpt_partition_interface *gparti,
+					     UINT64 len, CHAR8 *hash);
 	} SUPPORTED_FS[] = {
-		{ "Ext4", get_ext4_len },
-		{ "SquashFS", get_squashfs_len },
-		{ "Ias", get_iasimage_len }
+		{ "Ext4", get_ext4_len, hash_ext4_allocated },
+		{ "SquashFS", get_squashfs_len, NULL },
+		{ "Ias", get_iasimage_len, NULL }
 	};
 	struct gpt_partition_interface gparti;
 	CHAR8 hash[EVP_MAX_MD_SIZE];
@@ -751,7 +1076,11 @@ EFI_STATUS get_fs_hash(const CHAR16 *label)
 		fs_len = get_partition_size(&gparti);
 	debug(L"filesystem size %lld", fs_len);
 
-	ret = hash_partition(&gparti, fs_len, hash);
+	ret = EFI_UNSUPPORTED;
+	if (allocated_only && SUPPORTED_FS[i].hash_allocated)
+		ret = SUPPORTED_FS[i].hash_allocated(&gparti, fs_len, hash);
+	if (ret == EFI_UNSUPPORTED)
+		ret = hash_partition(&gparti, fs_len, hash);
 	if (EFI_ERROR(ret))
 		return ret;
 	return report_hash(L"/", gparti.part.name, hash);
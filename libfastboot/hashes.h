@@ -43,6 +43,14 @@ EFI_STATUS get_boot_image_hash(const CHAR16 *label);
 EFI_STATUS get_bootloader_hash(const CHAR16 *label);
 EFI_STATUS get_fs_hash(const CHAR16 *label);
 EFI_STATUS set_hash_algorithm(const CHAR8 *algo);
+/* Make get_fs_hash() hash only the allocated blocks of the ext4
+   filesystems, free block runs being represented by their length.  */
+void hash_allocated_only(BOOLEAN enable);
+/* Collect the hashes reported by the get_*_hash() functions and pass
+   them as sorted "<target> <hash>" lines to the REPORT callback of
+   hash_manifest_stop().  A NULL REPORT drops the collected lines.  */
+void hash_manifest_start(void);
+EFI_STATUS hash_manifest_stop(EFI_STATUS (*report)(char *line, VOID *context));
 #if defined(USE_ACPIO) || defined(USE_ACPI)
 EFI_STATUS get_acpi_hash(const CHAR16 *label);
 #endif
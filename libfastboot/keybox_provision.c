@@ -14,10 +14,10 @@
  * limitations under the License.
  */
 
-#include <lib.h>
-#include <vars.h>
 #include <efi.h>
 #include <efilib.h>
+#include <lib.h>
+#include <vars.h>
 #include <gpt.h>
 #include <log.h>
 
@@ -0,0 +1,661 @@
+/*
+ * Copyright (c) 2020, Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#include <efi.h>
+#include <efilib.h>
+#include <lib.h>
+#include <fastboot.h>
+
+#include "gpt.h"
+#include "flash.h"
+#include "storage.h"
+#include "sparse.h"
+#include "sparse_format.h"
+#include "lp_format.h"
+#include "vars.h"
+#include "super.h"
+
+/* The download buffer is described as a sorted list of chunks
+ * covering the expanded image, so that any range of the image can be
+ * compared with or written to the device without expanding it. */
+struct super_chunk {
+	UINT64 offset;
+	UINT64 size;
+	UINT16 type;
+	VOID *data;
+};
+
+struct lp_metadata {
+	struct lp_geometry geometry;
+	struct lp_header header;
+	UINT8 *tables;
+};
+
+/* Zero filled ranges smaller than this are written rather than
+ * discarded. */
+#define DISCARD_THRESHOLD (1024 * 1024)
+#define CMP_BUF_SIZE (1024 * 1024)
+
+static struct gpt_partition_interface super;
+static struct super_chunk *chunks;
+static UINTN nchunks;
+static UINT64 image_size;
+static BOOLEAN has_dont_care;
+static VOID *cmp_buf;
+
+#define super_size() \
+	((super.part.ending_lba + 1 - super.part.starting_lba) * \
+	 super.bio->Media->BlockSize)
+
+static EFI_STATUS map_image(VOID *data, UINTN size)
+{
+	struct sparse_header *sph = data;
+	struct chunk_header *ckh;
+	UINT64 len, rlen;
+	CHAR8 *s;
+	UINT32 i;
+
+	has_dont_care = FALSE;
+	if (!is_sparse_image(data, size)) {
+		chunks = AllocatePool(sizeof(*chunks));
+		if (!chunks)
+			return EFI_OUT_OF_RESOURCES;
+		chunks->offset = 0;
+		chunks->size = size;
+		chunks->type = CHUNK_TYPE_RAW;
+		chunks->data = data;
+		nchunks = 1;
+		image_size = size;
+		return EFI_SUCCESS;
+	}
+
+	if (!sph->blk_sz || sph->blk_sz % super.bio->Media->BlockSize)
+		return EFI_UNSUPPORTED;
+
+	chunks = AllocatePool(sph->total_chunks * sizeof(*chunks));
+	if (!chunks)
+		return EFI_OUT_OF_RESOURCES;
+
+	s = (CHAR8 *)data + sph->file_hdr_sz;
+	rlen = size - sph->file_hdr_sz;
+	image_size = 0;
+	nchunks = 0;
+	for (i = 0; i < sph->total_chunks; i++) {
+		ckh = (struct chunk_header *)s;
+		if (rlen < sph->chunk_hdr_sz || rlen < ckh->total_sz ||
+		    ckh->total_sz < sph->chunk_hdr_sz)
+			return EFI_INVALID_PARAMETER;
+
+		len = (UINT64)ckh->chunk_sz * sph->blk_sz;
+		switch (ckh->chunk_type) {
+		case CHUNK_TYPE_RAW:
+			if (ckh->total_sz - sph->chunk_hdr_sz != len)
+				return EFI_INVALID_PARAMETER;
+			break;
+		case CHUNK_TYPE_FILL:
+			if (ckh->total_sz - sph->chunk_hdr_sz < sizeof(UINT32))
+				return EFI_INVALID_PARAMETER;
+			break;
+		case CHUNK_TYPE_DONT_CARE:
+			if (len)
+				has_dont_care = TRUE;
+			break;
+		case CHUNK_TYPE_CRC32:
+			len = 0;
+			break;
+		default:
+			return EFI_INVALID_PARAMETER;
+		}
+
+		if (len) {
+			chunks[nchunks].offset = image_size;
+			chunks[nchunks].size = len;
+			chunks[nchunks].type = ckh->chunk_type;
+			chunks[nchunks].data = s + sph->chunk_hdr_sz;
+			nchunks++;
+		}
+
+		image_size += len;
+		s += ckh->total_sz;
+		rlen -= ckh->total_sz;
+	}
+
+	return EFI_SUCCESS;
+}
+
+/* Returns the index of the chunk holding OFFSET or NCHUNKS if OFFSET
+   is beyond the end of the image. */
+static UINTN find_chunk(UINT64 offset)
+{
+	UINTN lo = 0, hi = nchunks, mid;
+
+	if (offset >= image_size)
+		return nchunks;
+
+	while (hi - lo > 1) {
+		mid = lo + (hi - lo) / 2;
+		if (chunks[mid].offset <= offset)
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+/* Returns TRUE if [OFFSET, OFFSET + SIZE[ is not covered by the
+   image, as the ranges of the other segments of a split sparse
+   image. */
+static BOOLEAN is_dont_care(UINT64 offset, UINT64 size)
+{
+	UINTN i = find_chunk(offset);
+
+	return i < nchunks && chunks[i].type == CHUNK_TYPE_DONT_CARE &&
+		chunks[i].offset + chunks[i].size >= offset + size;
+}
+
+typedef EFI_STATUS (*chunk_fn_t)(struct super_chunk *chunk, UINT64 offset,
+				 UINT64 size, VOID *ctx);
+
+/* Calls FN on each piece of chunk covering [OFFSET, OFFSET + SIZE[.
+   The part of the range beyond the end of the image is ignored. */
+static EFI_STATUS for_each_chunk(UINT64 offset, UINT64 size,
+				 chunk_fn_t fn, VOID *ctx)
+{
+	EFI_STATUS ret;
+	UINT64 end = offset + size, len;
+	UINTN i;
+
+	for (i = find_chunk(offset); i < nchunks && offset < end; i++) {
+		len = min(end, chunks[i].offset + chunks[i].size) - offset;
+		ret = fn(&chunks[i], offset, len, ctx);
+		if (EFI_ERROR(ret))
+			return ret;
+		offset += len;
+	}
+
+	return EFI_SUCCESS;
+}
+
+static EFI_STATUS copy_chunk(struct super_chunk *chunk, UINT64 offset,
+			     UINT64 size, VOID *ctx)
+{
+	CHAR8 *dst = *(CHAR8 **)ctx;
+	UINT32 pattern;
+	UINT64 i;
+
+	switch (chunk->type) {
+	case CHUNK_TYPE_RAW:
+		CopyMem(dst, chunk->data + (offset - chunk->offset), size);
+		break;
+	case CHUNK_TYPE_FILL:
+		pattern = *(UINT32 *)chunk->data;
+		for (i = 0; i < size; i++)
+			dst[i] = ((CHAR8 *)&pattern)[(offset + i) % sizeof(pattern)];
+		break;
+	default:
+		ZeroMem(dst, size);
+	}
+
+	*(CHAR8 **)ctx = dst + size;
+	return EFI_SUCCESS;
+}
+
+static EFI_STATUS read_image(UINT64 offset, UINT64 size, VOID *dst)
+{
+	ZeroMem(dst, size);
+	return for_each_chunk(offset, size, copy_chunk, &dst);
+}
+
+static EFI_STATUS read_device(UINT64 offset, UINT64 size, VOID *dst)
+{
+	if (offset + size > super_size())
+		return EFI_INVALID_PARAMETER;
+
+	return uefi_call_wrapper(super.dio->ReadDisk, 5, super.dio,
+				 super.bio->Media->MediaId,
+				 super.part.starting_lba * super.bio->Media->BlockSize + offset,
+				 size, dst);
+}
+
+static VOID *lp_entry(struct lp_metadata *md, struct lp_table_descriptor *desc,
+		      UINT32 index)
+{
+	return md->tables + desc->offset + (UINTN)index * desc->entry_size;
+}
+
+static BOOLEAN lp_table_is_valid(struct lp_metadata *md,
+				 struct lp_table_descriptor *desc,
+				 UINTN entry_size)
+{
+	return desc->entry_size >= entry_size &&
+		(UINT64)desc->offset + (UINT64)desc->num_entries * desc->entry_size
+		<= md->header.tables_size;
+}
+
+static void free_metadata(struct lp_metadata *md)
+{
+	if (md->tables)
+		FreePool(md->tables);
+	md->tables = NULL;
+}
+
+static EFI_STATUS load_metadata(EFI_STATUS (*read)(UINT64 offset, UINT64 size, VOID *dst),
+				struct lp_metadata *md)
+{
+	struct lp_geometry *geo = &md->geometry;
+	struct lp_header *hdr = &md->header;
+	struct lp_partition *part;
+	EFI_STATUS ret;
+	UINT32 i;
+
+	md->tables = NULL;
+
+	ret = read(LP_PARTITION_RESERVED_BYTES, sizeof(*geo), geo);
+	if (EFI_ERROR(ret))
+		return ret;
+	if (geo->magic != LP_METADATA_GEOMETRY_MAGIC ||
+	    geo->struct_size < sizeof(*geo))
+		return EFI_NOT_FOUND;
+
+	ret = read(LP_PRIMARY_METADATA_OFFSET, sizeof(*hdr), hdr);
+	if (EFI_ERROR(ret))
+		return ret;
+	if (hdr->magic != LP_METADATA_HEADER_MAGIC ||
+	    hdr->major_version != LP_METADATA_MAJOR_VERSION ||
+	    hdr->header_size < sizeof(*hdr) ||
+	    (UINT64)hdr->header_size + hdr->tables_size > geo->metadata_max_size)
+		return EFI_NOT_FOUND;
+
+	md->tables = AllocatePool(hdr->tables_size);
+	if (!md->tables)
+		return EFI_OUT_OF_RESOURCES;
+
+	ret = read(LP_PRIMARY_METADATA_OFFSET + hdr->header_size,
+		   hdr->tables_size, md->tables);
+	if (EFI_ERROR(ret))
+		goto err;
+
+	ret = EFI_INVALID_PARAMETER;
+	if (!lp_table_is_valid(md, &hdr->partitions, sizeof(struct lp_partition)) ||
+	    !lp_table_is_valid(md, &hdr->extents, sizeof(struct lp_extent)) ||
+	    !lp_table_is_valid(md, &hdr->block_devices, sizeof(struct lp_block_device)))
+		goto err;
+
+	for (i = 0; i < hdr->partitions.num_entries; i++) {
+		part = lp_entry(md, &hdr->partitions, i);
+		if ((UINT64)part->first_extent_index + part->num_extents >
+		    hdr->extents.num_entries)
+			goto err;
+	}
+
+	return EFI_SUCCESS;
+
+err:
+	free_metadata(md);
+	return ret;
+}
+
+static struct lp_partition *find_lp_partition(struct lp_metadata *md,
+					      struct lp_partition *part)
+{
+	struct lp_partition *cur;
+	UINT32 i;
+
+	if (!md->tables)
+		return NULL;
+
+	for (i = 0; i < md->header.partitions.num_entries; i++) {
+		cur = lp_entry(md, &md->header.partitions, i);
+		if (!memcmp(cur->name, part->name, sizeof(cur->name)))
+			return cur;
+	}
+
+	return NULL;
+}
+
+static BOOLEAN same_extents(struct lp_metadata *a, struct lp_partition *pa,
+			    struct lp_metadata *b, struct lp_partition *pb)
+{
+	struct lp_extent *ea, *eb;
+	UINT32 i;
+
+	if (pa->num_extents != pb->num_extents)
+		return FALSE;
+
+	for (i = 0; i < pa->num_extents; i++) {
+		ea = lp_entry(a, &a->header.extents, pa->first_extent_index + i);
+		eb = lp_entry(b, &b->header.extents, pb->first_extent_index + i);
+		if (ea->num_sectors != eb->num_sectors ||
+		    ea->target_type != eb->target_type ||
+		    ea->target_data != eb->target_data ||
+		    ea->target_source != eb->target_source)
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+/* Checks that the image metadata describes a single block device
+   which fits in the super partition and that all the extents are
+   aligned on the device block size. */
+static EFI_STATUS check_layout(struct lp_metadata *md, UINT64 *metadata_size)
+{
+	struct lp_block_device *bdev;
+	struct lp_extent *ext;
+	UINT32 block_size = super.bio->Media->BlockSize;
+	UINT32 i;
+
+	if (md->header.block_devices.num_entries != 1)
+		return EFI_UNSUPPORTED;
+
+	bdev = lp_entry(md, &md->header.block_devices, 0);
+	*metadata_size = bdev->first_logical_sector * LP_SECTOR_SIZE;
+	if (bdev->size > super_size() || *metadata_size > bdev->size ||
+	    *metadata_size % block_size)
+		return EFI_UNSUPPORTED;
+
+	for (i = 0; i < md->header.extents.num_entries; i++) {
+		ext = lp_entry(md, &md->header.extents, i);
+		if (ext->target_type != LP_TARGET_TYPE_LINEAR)
+			continue;
+		if (ext->target_source != 0 ||
+		    (ext->target_data * LP_SECTOR_SIZE) % block_size ||
+		    (ext->num_sectors * LP_SECTOR_SIZE) % block_size ||
+		    (ext->target_data + ext->num_sectors) * LP_SECTOR_SIZE > bdev->size)
+			return EFI_UNSUPPORTED;
+	}
+
+	return EFI_SUCCESS;
+}
+
+static EFI_STATUS compare_chunk(struct super_chunk *chunk, UINT64 offset,
+				UINT64 size, _unused VOID *ctx)
+{
+	EFI_STATUS ret;
+	UINT32 *words, pattern;
+	UINT64 len;
+	UINTN i;
+
+	if (chunk->type == CHUNK_TYPE_DONT_CARE)
+		return EFI_SUCCESS;
+
+	for (; size; size -= len, offset += len) {
+		len = min(size, (UINT64)CMP_BUF_SIZE);
+		ret = read_device(offset, len, cmp_buf);
+		if (EFI_ERROR(ret))
+			return ret;
+
+		if (chunk->type == CHUNK_TYPE_RAW) {
+			if (memcmp(cmp_buf, chunk->data + (offset - chunk->offset), len))
+				return EFI_ABORTED;
+			continue;
+		}
+
+		pattern = *(UINT32 *)chunk->data;
+		words = cmp_buf;
+		for (i = 0; i < len / sizeof(*words); i++)
+			if (words[i] != pattern)
+				return EFI_ABORTED;
+	}
+
+	return EFI_SUCCESS;
+}
+
+/* Returns TRUE if the device already holds the image content in
+   [OFFSET, OFFSET + SIZE[.  Read errors are reported as a
+   difference. */
+static BOOLEAN is_identical(UINT64 offset, UINT64 size)
+{
+	return !EFI_ERROR(for_each_chunk(offset, size, compare_chunk, NULL));
+}
+
+/* Discards the blocks and checks that they read back as zeros since
+   the erase operation does not guarantee it on all the devices. */
+static EFI_STATUS discard_zeros(UINT64 offset, UINT64 size)
+{
+	static UINT32 zero;
+	struct super_chunk zeros = {
+		.offset = offset,
+		.size = size,
+		.type = CHUNK_TYPE_FILL,
+		.data = &zero
+	};
+	UINT32 block_size = super.bio->Media->BlockSize;
+	EFI_LBA start = super.part.starting_lba + offset / block_size;
+	EFI_STATUS ret;
+
+	ret = storage_erase_blocks(super.handle, super.bio, start,
+				   start + size / block_size - 1);
+	if (EFI_ERROR(ret))
+		return ret;
+
+	ret = compare_chunk(&zeros, offset, size, NULL);
+	if (EFI_ERROR(ret))
+		debug(L"Discarded blocks do not read back as zeros");
+
+	return ret;
+}
+
+static EFI_STATUS write_chunk(struct super_chunk *chunk, UINT64 offset,
+			      UINT64 size, _unused VOID *ctx)
+{
+	EFI_STATUS ret;
+	UINT32 pattern;
+
+	switch (chunk->type) {
+	case CHUNK_TYPE_RAW:
+		ret = flash_seek(&super, offset);
+		if (EFI_ERROR(ret))
+			return ret;
+		return flash_write(chunk->data + (offset - chunk->offset), size);
+	case CHUNK_TYPE_FILL:
+		pattern = *(UINT32 *)chunk->data;
+		if (!pattern && size >= DISCARD_THRESHOLD &&
+		    !EFI_ERROR(discard_zeros(offset, size)))
+			return EFI_SUCCESS;
+		ret = flash_seek(&super, offset);
+		if (EFI_ERROR(ret))
+			return ret;
+		return flash_fill(pattern, size);
+	default:
+		return EFI_SUCCESS;
+	}
+}
+
+static EFI_STATUS write_range(UINT64 offset, UINT64 size)
+{
+	return for_each_chunk(offset, size, write_chunk, NULL);
+}
+
+/* Writes the image partition PART unless all its extents already
+   hold the image content.  The extents comparison with the device
+   metadata avoids reading the device for relocated partitions. */
+static EFI_STATUS flash_lp_partition(struct lp_metadata *img, struct lp_partition *part,
+				     struct lp_metadata *dev, BOOLEAN *written)
+{
+	struct lp_partition *dev_part;
+	struct lp_extent *ext;
+	BOOLEAN identical;
+	EFI_STATUS ret;
+	UINT32 i;
+
+	dev_part = find_lp_partition(dev, part);
+	identical = dev_part && same_extents(img, part, dev, dev_part);
+	for (i = 0; identical && i < part->num_extents; i++) {
+		ext = lp_entry(img, &img->header.extents, part->first_extent_index + i);
+		if (ext->target_type == LP_TARGET_TYPE_LINEAR)
+			identical = is_identical(ext->target_data * LP_SECTOR_SIZE,
+						 ext->num_sectors * LP_SECTOR_SIZE);
+	}
+
+	*written = !identical;
+	if (identical)
+		return EFI_SUCCESS;
+
+	for (i = 0; i < part->num_extents; i++) {
+		ext = lp_entry(img, &img->header.extents, part->first_extent_index + i);
+		if (ext->target_type != LP_TARGET_TYPE_LINEAR)
+			continue;
+		ret = write_range(ext->target_data * LP_SECTOR_SIZE,
+				  ext->num_sectors * LP_SECTOR_SIZE);
+		if (EFI_ERROR(ret))
+			return ret;
+	}
+
+	return EFI_SUCCESS;
+}
+
+static EFI_STATUS flash_lp_partitions(struct lp_metadata *img)
+{
+	struct lp_metadata dev;
+	struct lp_partition *part;
+	UINT64 metadata_size;
+	UINTN written = 0;
+	BOOLEAN part_written, metadata_written;
+	EFI_STATUS ret;
+	UINT32 i;
+
+	ret = check_layout(img, &metadata_size);
+	if (EFI_ERROR(ret))
+		return ret;
+
+	ret = load_metadata(read_device, &dev);
+	if (EFI_ERROR(ret)) {
+		debug(L"No valid dynamic partitions metadata on the device");
+		ret = EFI_SUCCESS;
+	}
+
+	for (i = 0; i < img->header.partitions.num_entries; i++) {
+		part = lp_entry(img, &img->header.partitions, i);
+		ret = flash_lp_partition(img, part, &dev, &part_written);
+		if (EFI_ERROR(ret)) {
+			efi_perror(ret, L"Failed to flash logical partition %a", part->name);
+			goto out;
+		}
+		if (part_written)
+			written++;
+	}
+
+	/* The metadata is written last so that it never describes
+	   partially written partitions in case of failure. */
+	metadata_written = !is_identical(0, metadata_size);
+	if (metadata_written) {
+		ret = write_range(0, metadata_size);
+		if (EFI_ERROR(ret)) {
+			efi_perror(ret, L"Failed to write the dynamic partitions metadata");
+			goto out;
+		}
+	}
+
+	fastboot_info("super: %d logical partitions written, %d unchanged",
+		      written, img->header.partitions.num_entries - written);
+	fastboot_info("super: metadata %a",
+		      metadata_written ? "written" : "unchanged");
+
+out:
+	free_metadata(&dev);
+	return ret;
+}
+
+/* The image metadata of the last sparse image holding don't care
+   chunks.  Host tools split the sparse images larger than the
+   download buffer into segments of the same size in which the ranges
+   of the other segments are don't care chunks: only the first one
+   holds the metadata, the following ones reuse it so that they are
+   handled incrementally as well. */
+static struct lp_metadata split_img;
+static UINT64 split_size;
+
+EFI_STATUS flash_super(VOID *data, UINTN size)
+{
+	struct lp_metadata img = { .tables = NULL };
+	EFI_STATUS ret;
+
+	ret = gpt_get_partition_by_label(SUPER_LABEL, &super, LOGICAL_UNIT_USER);
+	if (EFI_ERROR(ret)) {
+		efi_perror(ret, L"Failed to get partition %s", SUPER_LABEL);
+		return ret;
+	}
+
+	ret = map_image(data, size);
+	if (EFI_ERROR(ret))
+		goto fallback;
+
+	if (image_size > super_size()) {
+		error(L"Super image is larger than the super partition");
+		ret = EFI_INVALID_PARAMETER;
+		goto out;
+	}
+
+	if (split_img.tables && split_size == image_size &&
+	    is_dont_care(0, LP_PARTITION_RESERVED_BYTES + sizeof(struct lp_geometry))) {
+		img = split_img;
+		split_img.tables = NULL;
+	} else {
+		free_metadata(&split_img);
+		ret = load_metadata(read_image, &img);
+		if (EFI_ERROR(ret))
+			goto fallback;
+	}
+
+	cmp_buf = AllocatePool(CMP_BUF_SIZE);
+	if (!cmp_buf) {
+		ret = EFI_OUT_OF_RESOURCES;
+		goto fallback;
+	}
+
+	ret = flash_lp_partitions(&img);
+	if (!EFI_ERROR(ret) && has_dont_care) {
+		split_img = img;
+		split_size = image_size;
+		img.tables = NULL;
+	}
+	if (ret != EFI_UNSUPPORTED)
+		goto out;
+
+fallback:
+	debug(L"Super image not handled incrementally: %r", ret);
+	free_metadata(&split_img);
+	ret = flash_partition(data, size, SUPER_LABEL);
+
+out:
+	free_metadata(&img);
+	if (cmp_buf) {
+		FreePool(cmp_buf);
+		cmp_buf = NULL;
+	}
+	if (chunks) {
+		FreePool(chunks);
+		chunks = NULL;
+	}
+	return ret;
+}
@@ -100,14 +100,20 @@ LOCAL_SRC_FILES := \
 	acpi.c \
 	acpi_image.c \
 	lib.c \
+	arena.c \
+	alloc_prof.c \
 	options.c \
 	security.c \
 	vars.c \
 	log.c \
 	em.c \
 	gpt.c \
+	misc_cache.c \
+	handoff.c \
+	prefetch.c \
 	storage.c \
 	pci.c \
+	mp.c \
 	mmc.c \
 	ufs.c \
 	sdcard.c \
@@ -126,6 +132,7 @@ LOCAL_SRC_FILES := \
 	virtual_media.c \
 	general_block.c \
 	aes_gcm.c \
+	drbg.c \
 	vbmeta_ias.c \
 	android_vb2.c \
 	security_vb2.c
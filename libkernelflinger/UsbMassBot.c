@@ -575,8 +575,24 @@ UsbBotExecCommandWithRetry (
   UINTN                  Retry;
   VOID                   *timeout_evt;
 
-  Retry  = 0;
-  Status = EFI_SUCCESS;
+  //
+  // Commands almost always succeed on the first attempt, so only arm
+  // the retry timer once the device actually needs recovery.
+  //
+  Status = UsbBotExecCommand(Context,
+                             Cmd,
+                             CmdLen,
+                             DataDir,
+                             Data,
+                             DataLen,
+                             Lun,
+                             Timeout,
+                             CmdStatus
+                             );
+  if (Status == EFI_SUCCESS || Status == EFI_NO_MEDIA)
+    return Status;
+
+  Retry  = Status == EFI_NOT_READY ? 0 : 1;
   Status = uefi_call_wrapper(BS->CreateEvent,
                              5,
                              EVT_TIMER,
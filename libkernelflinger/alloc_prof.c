@@ -0,0 +1,293 @@
+/*
+ * Copyright (c) 2020, Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#define ALLOC_PROF_NO_WRAP
+
+#include <efi.h>
+#include <efilib.h>
+#include <lib.h>
+
+#include "alloc_prof.h"
+
+#ifdef ALLOC_PROFILE
+
+/* Both tables are open addressing hash tables with linear probing.
+ * The pointer table maps a live allocation to its size and call
+ * site. */
+#define MAX_SITES	512
+#define MAX_PTRS	8192
+
+struct alloc_ptr {
+	VOID *ptr;
+	UINTN size;
+	struct alloc_site *site;
+};
+
+static struct alloc_site *sites;
+static struct alloc_ptr *ptrs;
+static struct alloc_prof_stats stats;
+
+static BOOLEAN alloc_prof_init(void)
+{
+	if (ptrs)
+		return TRUE;
+
+	sites = AllocateZeroPool(MAX_SITES * sizeof(*sites));
+	ptrs = AllocateZeroPool(MAX_PTRS * sizeof(*ptrs));
+	if (!sites || !ptrs) {
+		if (sites)
+			FreePool(sites);
+		if (ptrs)
+			FreePool(ptrs);
+		sites = NULL;
+		ptrs = NULL;
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static UINTN hash_ptr(VOID *ptr)
+{
+	return ((UINTN)ptr >> 4) * 2654435761U;
+}
+
+static struct alloc_site *get_site(const char *file, UINT32 line)
+{
+	UINTN i, n;
+
+	i = (((UINTN)file >> 2) ^ line) * 2654435761U;
+	for (n = 0; n < MAX_SITES; n++, i++) {
+		struct alloc_site *site = &sites[i % MAX_SITES];
+
+		if (!site->file) {
+			site->file = file;
+			site->line = line;
+		}
+		if (site->file == file && site->line == line)
+			return site;
+	}
+
+	return NULL;
+}
+
+static void track(VOID *ptr, UINTN size, const char *file, UINT32 line)
+{
+	struct alloc_site *site;
+	UINTN i, n;
+
+	stats.allocs++;
+
+	site = get_site(file, line);
+	if (site) {
+		site->count++;
+		site->bytes += size;
+	}
+
+	i = hash_ptr(ptr);
+	for (n = 0; n < MAX_PTRS; n++, i++) {
+		struct alloc_ptr *entry = &ptrs[i % MAX_PTRS];
+
+		if (entry->ptr)
+			continue;
+		entry->ptr = ptr;
+		entry->size = size;
+		entry->site = site;
+		break;
+	}
+
+	/* untrack() cannot account the release of a pointer missing
+	 * from the table, neither can the live figures. */
+	if (n == MAX_PTRS)
+		return;
+
+	stats.live_bytes += size;
+	stats.peak_bytes = max(stats.peak_bytes, stats.live_bytes);
+	if (site) {
+		site->live_count++;
+		site->live_bytes += size;
+	}
+}
+
+static void untrack(VOID *ptr)
+{
+	struct alloc_ptr *entry = NULL, *next;
+	UINTN i, j, n, home;
+
+	stats.frees++;
+
+	i = hash_ptr(ptr);
+	for (n = 0; n < MAX_PTRS; n++, i++) {
+		entry = &ptrs[i % MAX_PTRS];
+		if (!entry->ptr || entry->ptr == ptr)
+			break;
+	}
+	if (n == MAX_PTRS || !entry->ptr) {
+		stats.untracked++;
+		return;
+	}
+
+	stats.live_bytes -= entry->size;
+	if (entry->site) {
+		entry->site->live_count--;
+		entry->site->live_bytes -= entry->size;
+	}
+
+	/* Backward shift deletion: move up the following entries of
+	 * the cluster which would not be found anymore. */
+	i %= MAX_PTRS;
+	for (j = (i + 1) % MAX_PTRS; ptrs[j].ptr; j = (j + 1) % MAX_PTRS) {
+		next = &ptrs[j];
+		home = hash_ptr(next->ptr) % MAX_PTRS;
+		if ((j > i && (home <= i || home > j)) ||
+		    (j < i && home <= i && home > j)) {
+			ptrs[i] = *next;
+			i = j;
+		}
+	}
+	ZeroMem(&ptrs[i], sizeof(ptrs[i]));
+}
+
+VOID *alloc_prof_alloc(UINTN size, BOOLEAN zero, const char *file, UINT32 line)
+{
+	VOID *ptr;
+
+	ptr = zero ? AllocateZeroPool(size) : AllocatePool(size);
+	if (ptr && alloc_prof_init())
+		track(ptr, size, file, line);
+
+	return ptr;
+}
+
+VOID *alloc_prof_realloc(VOID *old, UINTN old_size, UINTN new_size,
+			 const char *file, UINT32 line)
+{
+	VOID *ptr;
+
+	ptr = ReallocatePool(old, old_size, new_size);
+	if (!ptr || !alloc_prof_init())
+		return ptr;
+
+	if (old)
+		untrack(old);
+	track(ptr, new_size, file, line);
+
+	return ptr;
+}
+
+VOID alloc_prof_free(VOID *ptr)
+{
+	if (ptr && ptrs)
+		untrack(ptr);
+	FreePool(ptr);
+}
+
+static int cmp_sites(const void *a, const void *b)
+{
+	const struct alloc_site *sa = a, *sb = b;
+
+	if (sa->live_bytes != sb->live_bytes)
+		return sa->live_bytes < sb->live_bytes ? 1 : -1;
+	if (sa->bytes != sb->bytes)
+		return sa->bytes < sb->bytes ? 1 : -1;
+	return 0;
+}
+
+EFI_STATUS alloc_prof_report(void (*callback)(struct alloc_site *site,
+					      VOID *context),
+			     VOID *context)
+{
+	struct alloc_site *sorted;
+	UINTN i, count = 0;
+
+	if (!sites)
+		return EFI_SUCCESS;
+
+	sorted = AllocatePool(MAX_SITES * sizeof(*sorted));
+	if (!sorted)
+		return EFI_OUT_OF_RESOURCES;
+
+	for (i = 0; i < MAX_SITES; i++)
+		if (sites[i].file)
+			sorted[count++] = sites[i];
+
+	qsort(sorted, count, sizeof(*sorted), cmp_sites);
+	for (i = 0; i < count; i++)
+		callback(&sorted[i], context);
+
+	FreePool(sorted);
+	return EFI_SUCCESS;
+}
+
+EFI_STATUS alloc_prof_get_stats(struct alloc_prof_stats *s)
+{
+	*s = stats;
+	return EFI_SUCCESS;
+}
+
+/* Live allocations remain tracked so that their release is still
+ * accounted correctly, only the call site counters are cleared. */
+void alloc_prof_reset(void)
+{
+	UINTN i;
+
+	if (!sites)
+		return;
+
+	for (i = 0; i < MAX_SITES; i++) {
+		sites[i].count = sites[i].live_count;
+		sites[i].bytes = sites[i].live_bytes;
+	}
+	stats.allocs = 0;
+	stats.frees = 0;
+	stats.peak_bytes = stats.live_bytes;
+	stats.untracked = 0;
+}
+
+#else
+
+EFI_STATUS alloc_prof_report(_unused void (*callback)(struct alloc_site *site,
+						      VOID *context),
+			     _unused VOID *context)
+{
+	return EFI_UNSUPPORTED;
+}
+
+EFI_STATUS alloc_prof_get_stats(_unused struct alloc_prof_stats *stats)
+{
+	return EFI_UNSUPPORTED;
+}
+
+void alloc_prof_reset(void)
+{
+}
+
+#endif
@@ -52,6 +52,7 @@
 #include "slot.h"
 #include "pae.h"
 #include "timer.h"
+#include "misc_cache.h"
 #include "android_vb2.h"
 #include "acpi.h"
 #ifdef USE_FIRSTSTAGE_MOUNT
@@ -803,44 +804,265 @@ done:
         return bootreason;
 }
 
-EFI_STATUS prepend_command_line(CHAR16 **cmdline, CHAR16 *fmt, ...)
+/* Room left in front of the initial command line for the fragments
+ * prepended by the bootloader, it avoids any reallocation in the
+ * common case. */
+#define CMDLINE_HEADROOM 2048
+#define CMDLINE_TAILROOM 256
+
+#ifndef USER
+/* When set, the command lines also build their reference: the string
+ * the former implementation produced by rebuilding the whole CHAR16
+ * line for every fragment. */
+static BOOLEAN cmdline_build_reference;
+/* Reference of the last command line set up */
+static CHAR16 *cmdline_reference;
+
+static EFI_STATUS reference_insert(struct cmdline *cmdline, BOOLEAN prepend,
+                                   CHAR16 *fragment)
 {
-        CHAR16 *old;
-        va_list args;
-        CHAR16 *string;
         CHAR16 *new;
 
-        old = *cmdline;
-        va_start(args, fmt);
-        string = VPoolPrint(fmt, args);
-        va_end(args);
+        if (!cmdline->reference)
+                return EFI_SUCCESS;
 
-        if (!string)
+        new = prepend ? PoolPrint(L"%s %s", fragment, cmdline->reference) :
+                PoolPrint(L"%s %s", cmdline->reference, fragment);
+        if (!new)
                 return EFI_OUT_OF_RESOURCES;
 
-        new = PoolPrint(L"%s %s", string, old);
-        FreePool(string);
-        if (!new)
+        FreePool(cmdline->reference);
+        cmdline->reference = new;
+        return EFI_SUCCESS;
+}
+#endif
+
+/* Makes sure that FRONT characters can be inserted before the content
+ * and BACK characters after it, NUL terminator excluded. */
+static EFI_STATUS cmdline_reserve(struct cmdline *cmdline, UINTN front, UINTN back)
+{
+        CHAR8 *buf;
+        UINTN len, size, start;
+
+        if (cmdline->buf && cmdline->start >= front &&
+            cmdline->size - cmdline->end > back)
+                return EFI_SUCCESS;
+
+        len = cmdline_len(cmdline);
+        size = max(cmdline->size * 2, len + front + back + 1 +
+                   CMDLINE_HEADROOM + CMDLINE_TAILROOM);
+        buf = AllocatePool(size);
+        if (!buf)
                 return EFI_OUT_OF_RESOURCES;
 
-        FreePool(old);
-        *cmdline = new;
+        /* Split the free space between both ends, most fragments are
+         * prepended. */
+        start = size - len - 1 - back - CMDLINE_TAILROOM;
+        if (cmdline->buf) {
+                CopyMem(buf + start, cmdline_str(cmdline), len);
+                FreePool(cmdline->buf);
+        }
+        buf[start + len] = '\0';
+
+        cmdline->buf = buf;
+        cmdline->size = size;
+        cmdline->start = start;
+        cmdline->end = start + len;
+        return EFI_SUCCESS;
+}
+
+/* The kernel command line must be plain ASCII, as str_to_stra()
+ * enforces for the CHAR16 fragments. */
+static EFI_STATUS check_ascii(const CHAR8 *str, UINTN len)
+{
+        UINTN i;
+
+        for (i = 0; i < len; i++)
+                if (str[i] > 0x7F) {
+                        error(L"Non-ascii characters in command line");
+                        return EFI_INVALID_PARAMETER;
+                }
+
+        return EFI_SUCCESS;
+}
+
+EFI_STATUS cmdline_init(struct cmdline *cmdline, const CHAR8 *str)
+{
+        EFI_STATUS ret;
+        UINTN len = str ? strlen(str) : 0;
+
+        ZeroMem(cmdline, sizeof(*cmdline));
+        ret = check_ascii(str, len);
+        if (EFI_ERROR(ret))
+                return ret;
+
+        ret = cmdline_reserve(cmdline, 0, len);
+        if (EFI_ERROR(ret))
+                return ret;
+
+        CopyMem(cmdline->buf + cmdline->end, str, len);
+        cmdline->end += len;
+        cmdline->buf[cmdline->end] = '\0';
+
+#ifndef USER
+        if (cmdline_build_reference) {
+                cmdline->reference = stra_to_str(str ? str : (CHAR8 *)"");
+                if (!cmdline->reference) {
+                        cmdline_free(cmdline);
+                        return EFI_OUT_OF_RESOURCES;
+                }
+        }
+#endif
+        return EFI_SUCCESS;
+}
+
+void cmdline_free(struct cmdline *cmdline)
+{
+        if (cmdline->buf)
+                FreePool(cmdline->buf);
+#ifndef USER
+        if (cmdline->reference)
+                FreePool(cmdline->reference);
+#endif
+        ZeroMem(cmdline, sizeof(*cmdline));
+}
+
+EFI_STATUS prepend_command_line_str(struct cmdline *cmdline, const CHAR8 *str)
+{
+        EFI_STATUS ret;
+        UINTN len = strlen(str);
+
+        ret = check_ascii(str, len);
+        if (EFI_ERROR(ret))
+                return ret;
+
+        ret = cmdline_reserve(cmdline, len + 1, 0);
+        if (EFI_ERROR(ret))
+                return ret;
+
+#ifndef USER
+        if (cmdline->reference) {
+                CHAR16 *fragment = stra_to_str(str);
+
+                if (!fragment)
+                        return EFI_OUT_OF_RESOURCES;
+                ret = reference_insert(cmdline, TRUE, fragment);
+                FreePool(fragment);
+                if (EFI_ERROR(ret))
+                        return ret;
+        }
+#endif
+
+        cmdline->start -= len + 1;
+        CopyMem(cmdline->buf + cmdline->start, str, len);
+        cmdline->buf[cmdline->start + len] = ' ';
         return EFI_SUCCESS;
 }
 
+static EFI_STATUS insert_command_line(struct cmdline *cmdline, BOOLEAN prepend,
+                                      CHAR16 *fmt, va_list args)
+{
+        EFI_STATUS ret;
+        CHAR16 *string;
+        UINTN len, pos;
+
+        string = VPoolPrint(fmt, args);
+        if (!string)
+                return EFI_OUT_OF_RESOURCES;
+
+        len = StrLen(string);
+        ret = prepend ? cmdline_reserve(cmdline, len + 1, 0) :
+                cmdline_reserve(cmdline, 0, len + 1);
+        if (EFI_ERROR(ret))
+                goto out;
+
+        pos = prepend ? cmdline->start - len - 1 : cmdline->end + 1;
+        /* str_to_stra() NUL terminates right after the fragment */
+        ret = str_to_stra(cmdline->buf + pos, string, len + 1);
+        if (EFI_ERROR(ret)) {
+                error(L"Non-ascii characters in command line");
+                goto out;
+        }
+
+#ifndef USER
+        ret = reference_insert(cmdline, prepend, string);
+        if (EFI_ERROR(ret))
+                goto out;
+#endif
+
+        if (prepend) {
+                cmdline->buf[pos + len] = ' ';
+                cmdline->start = pos;
+        } else {
+                cmdline->buf[cmdline->end] = ' ';
+                cmdline->end = pos + len;
+        }
+
+out:
+        FreePool(string);
+        return ret;
+}
+
+EFI_STATUS prepend_command_line(struct cmdline *cmdline, CHAR16 *fmt, ...)
+{
+        EFI_STATUS ret;
+        va_list args;
 
-static CHAR16 *get_command_line(IN struct boot_img_hdr *aosp_header,
-                                IN enum boot_target boot_target)
+        va_start(args, fmt);
+        ret = insert_command_line(cmdline, TRUE, fmt, args);
+        va_end(args);
+
+        return ret;
+}
+
+EFI_STATUS append_command_line(struct cmdline *cmdline, CHAR16 *fmt, ...)
 {
         EFI_STATUS ret;
-        CHAR16 *cmdline16 = NULL;
+        va_list args;
+
+        va_start(args, fmt);
+        ret = insert_command_line(cmdline, FALSE, fmt, args);
+        va_end(args);
+
+        return ret;
+}
+
+#ifndef USER
+/* Same as cmdline_init() for a CHAR16 string */
+static EFI_STATUS cmdline_init_str16(struct cmdline *cmdline, const CHAR16 *str)
+{
+        EFI_STATUS ret;
+        CHAR8 *str8;
+        UINTN len = StrLen(str);
+
+        str8 = AllocatePool(len + 1);
+        if (!str8)
+                return EFI_OUT_OF_RESOURCES;
+
+        ret = str_to_stra(str8, str, len + 1);
+        if (EFI_ERROR(ret))
+                error(L"Non-ascii characters in command line");
+        else
+                ret = cmdline_init(cmdline, str8);
+
+        FreePool(str8);
+        return ret;
+}
+#endif
+
+static EFI_STATUS get_command_line(IN struct boot_img_hdr *aosp_header,
+                                   IN enum boot_target boot_target,
+                                   OUT struct cmdline *cmdline)
+{
+        EFI_STATUS ret;
+        CHAR16 *cmdline_replace = NULL;
 #ifndef USER
         CHAR16 *cmdline_append = NULL;
         CHAR16 *cmdline_prepend = NULL;
         BOOLEAN needs_pause = FALSE;
 
         if (boot_target == NORMAL_BOOT || boot_target == MEMORY) {
-                cmdline16 = get_efi_variable_str8(&loader_guid, CMDLINE_REPLACE_VAR);
+                cmdline_replace = get_efi_variable_str8(&loader_guid, CMDLINE_REPLACE_VAR);
                 cmdline_append = get_efi_variable_str8(&loader_guid, CMDLINE_APPEND_VAR);
                 cmdline_prepend = get_efi_variable_str8(&loader_guid, CMDLINE_PREPEND_VAR);
         }
@@ -848,68 +1070,71 @@ static CHAR16 *get_command_line(IN struct boot_img_hdr *aosp_header,
         (void)boot_target; /* Get rid of a unused parameter warning */
 #endif
 
-        if (!cmdline16) {
+        if (!cmdline_replace) {
                 if (aosp_header->header_version < BOOT_HEADER_V3) {
-                    CHAR8 full_cmdline[BOOT_ARGS_SIZE + BOOT_EXTRA_ARGS_SIZE];
+                    CHAR8 full_cmdline[BOOT_ARGS_SIZE + BOOT_EXTRA_ARGS_SIZE + 1];
                     int offset = BOOT_ARGS_SIZE;
 
                     /* include the potential NUL terminal char */
                     ret = memcpy_s(full_cmdline, sizeof(full_cmdline), aosp_header->cmdline,
                                    BOOT_ARGS_SIZE);
                     if (EFI_ERROR(ret))
-                            return NULL;
+                            goto out;
+                    full_cmdline[BOOT_ARGS_SIZE] = '\0';
 
                     /* if there is extra cmdline arguments */
                     if (aosp_header->extra_cmdline[0]) {
                             /* legacy boot.img format cmdline is NUL terminated */
                             if (!aosp_header->cmdline[BOOT_ARGS_SIZE - 1])
                                     offset--;
-                            ret = memcpy_s(full_cmdline + offset, sizeof(full_cmdline),
+                            ret = memcpy_s(full_cmdline + offset, sizeof(full_cmdline) - offset,
                                            aosp_header->extra_cmdline, BOOT_EXTRA_ARGS_SIZE);
                             if (EFI_ERROR(ret))
-                                    return NULL;
+                                    goto out;
+                            full_cmdline[offset + BOOT_EXTRA_ARGS_SIZE] = '\0';
                     }
-                    cmdline16 = stra_to_str(full_cmdline);
+                    ret = cmdline_init(cmdline, full_cmdline);
                 } else {
                     struct boot_img_hdr_v3 *v3 = (struct boot_img_hdr_v3 *)aosp_header;
-                    cmdline16 = stra_to_str(v3->cmdline);
+                    ret = cmdline_init(cmdline, v3->cmdline);
                 }
-
-                if (!cmdline16)
-                        return NULL;
 #ifndef USER
         } else {
-                error(L"Boot image command line overridden with '%s'", cmdline16);
+                error(L"Boot image command line overridden with '%s'", cmdline_replace);
                 needs_pause = TRUE;
+
+                ret = cmdline_init_str16(cmdline, cmdline_replace);
+                FreePool(cmdline_replace);
 #endif
         }
+        if (EFI_ERROR(ret))
+                goto out;
 
 #ifndef USER
         if (cmdline_prepend) {
-                EFI_STATUS ret;
-
                 error(L"Prepending '%s' to command line", cmdline_prepend);
                 needs_pause = TRUE;
 
-                ret = prepend_command_line(&cmdline16, L"%s", cmdline_prepend);
-                FreePool(cmdline_prepend);
-                if (EFI_ERROR(ret))
+                ret = prepend_command_line(cmdline, L"%s", cmdline_prepend);
+                /* Non-ascii characters reject the whole command line */
+                if (ret == EFI_INVALID_PARAMETER)
+                        goto out;
+                if (EFI_ERROR(ret)) {
                         error(L"couldn't prepend to command line");
+                        ret = EFI_SUCCESS;
+                }
         }
 
         if (cmdline_append) {
-                EFI_STATUS ret;
-
                 error(L"Appending '%s' to command line", cmdline_append);
                 needs_pause = TRUE;
 
-                ret = prepend_command_line(&cmdline_append, L"%s", cmdline16);
+                ret = append_command_line(cmdline, L"%s", cmdline_append);
+                if (ret == EFI_INVALID_PARAMETER)
+                        goto out;
                 if (EFI_ERROR(ret)) {
-                        error(L"couldn't prepend to command line");
-                        FreePool(cmdline_append);
-                } else {
-                        FreePool(cmdline16);
-                        cmdline16 = cmdline_append;
+                        error(L"couldn't append to command line");
+                        ret = EFI_SUCCESS;
                 }
         }
 
@@ -917,7 +1142,16 @@ static CHAR16 *get_command_line(IN struct boot_img_hdr *aosp_header,
                 pause(1);
 #endif
 
-        return cmdline16;
+out:
+#ifndef USER
+        if (cmdline_prepend)
+                FreePool(cmdline_prepend);
+        if (cmdline_append)
+                FreePool(cmdline_append);
+#endif
+        if (EFI_ERROR(ret))
+                cmdline_free(cmdline);
+        return ret;
 }
 
 EFI_STATUS get_bootimage_2nd(VOID *bootimage, VOID **second, UINT32 *size)
@@ -973,15 +1207,15 @@ EFI_STATUS get_bootimage_blob(VOID *bootimage, enum blobtype btype, VOID **blob,
  * trusted */
 static EFI_STATUS parse_bootvars_line(char *line, VOID *ctx)
 {
-        CHAR16 **cmdline16 = (CHAR16 **)ctx;
+        struct cmdline *cmdline = (struct cmdline *)ctx;
 
         if (strlen((CHAR8 *)line) == 0 || line[0] == '#')
                 return EFI_SUCCESS;
 
-        return prepend_command_line(cmdline16, L"%a", line);
+        return prepend_command_line_str(cmdline, (CHAR8 *)line);
 }
 
-static EFI_STATUS add_bootvars(VOID *bootimage, CHAR16 **cmdline16)
+static EFI_STATUS add_bootvars(VOID *bootimage, struct cmdline *cmdline)
 {
         VOID *bootvars;
         UINT32 bvsize;
@@ -999,7 +1233,7 @@ static EFI_STATUS add_bootvars(VOID *bootimage, CHAR16 **cmdline16)
         }
 
         return parse_text_buffer(bootvars, bvsize, parse_bootvars_line,
-                                 cmdline16);
+                                 cmdline);
 }
 #endif
 
@@ -1016,7 +1250,7 @@ static EFI_STATUS setup_command_line(
                 IN VBDATA *vb_data
                 )
 {
-        CHAR16 *cmdline16 = NULL;
+        struct cmdline line = { 0 };
         char   *serialno = NULL;
         CHAR16 *serialport = NULL;
         CHAR16 *bootreason = NULL;
@@ -1030,7 +1264,6 @@ static EFI_STATUS setup_command_line(
         struct boot_params *buf;
         struct boot_img_hdr *aosp_header;
         CHAR8 time_str8[128] = {0};
-        CHAR16 *time_str16 = NULL;
         EFI_GUID *swap_guid = NULL;
         CHAR8 *abl_cmd_line = NULL;
         BOOLEAN is_uefi = TRUE;
@@ -1047,21 +1280,21 @@ static EFI_STATUS setup_command_line(
         }
 
         aosp_header = (struct boot_img_hdr *)bootimage;
-        cmdline16 = get_command_line(aosp_header, boot_target);
-        if (!cmdline16) {
-                ret = EFI_OUT_OF_RESOURCES;
+        ret = get_command_line(aosp_header, boot_target, &line);
+        if (EFI_ERROR(ret))
                 goto out;
-        }
 
         if (aosp_header->header_version >= BOOT_HEADER_V3) {
             struct vendor_boot_img_hdr_v3 *v3 = (struct vendor_boot_img_hdr_v3 *)vendorbootimage;
-            ret = prepend_command_line(&cmdline16, L"%a", v3->cmdline);
+            ret = prepend_command_line_str(&line, v3->cmdline);
+            if (EFI_ERROR(ret))
+                    goto out;
         }
 
         /* Append serial number from DMI */
         serialno = get_serial_number();
         if (serialno) {
-                ret = prepend_command_line(&cmdline16,
+                ret = prepend_command_line(&line,
                                 L"androidboot.serialno=%a g_ffs.iSerialNumber=%a",
                                 serialno, serialno);
                 if (EFI_ERROR(ret))
@@ -1069,7 +1302,7 @@ static EFI_STATUS setup_command_line(
         }
 
         if (boot_target == CHARGER) {
-                ret = prepend_command_line(&cmdline16,
+                ret = prepend_command_line(&line,
                                 L"androidboot.mode=charger");
                 if (EFI_ERROR(ret))
                         goto out;
@@ -1085,17 +1318,17 @@ static EFI_STATUS setup_command_line(
                 goto out;
         }
 
-        ret = prepend_command_line(&cmdline16, L"androidboot.bootreason=%s", bootreason);
+        ret = prepend_command_line(&line, L"androidboot.bootreason=%s", bootreason);
         if (EFI_ERROR(ret))
                 goto out;
 
-        ret = prepend_command_line(&cmdline16, L"androidboot.verifiedbootstate=%s",
+        ret = prepend_command_line(&line, L"androidboot.verifiedbootstate=%s",
                                    boot_state_to_string(boot_state));
         if (EFI_ERROR(ret))
                 goto out;
 
         if (swap_guid) {
-                ret = prepend_command_line(&cmdline16, L"resume=PARTUUID=%g",
+                ret = prepend_command_line(&line, L"resume=PARTUUID=%g",
                         swap_guid);
                 if (EFI_ERROR(ret))
                         goto out;
@@ -1103,14 +1336,14 @@ static EFI_STATUS setup_command_line(
 
         serialport = get_serial_port();
         if (serialport) {
-                ret = prepend_command_line(&cmdline16, L"console=%s", serialport);
+                ret = prepend_command_line(&line, L"console=%s", serialport);
                 if (EFI_ERROR(ret))
                         goto out;
         }
 
 #ifndef USER
         if (get_disable_watchdog()) {
-                ret = prepend_command_line(&cmdline16, CONVERT_TO_WIDE(TCO_OPT_DISABLED));
+                ret = prepend_command_line(&line, CONVERT_TO_WIDE(TCO_OPT_DISABLED));
                 if (EFI_ERROR(ret))
                         goto out;
         }
@@ -1125,7 +1358,7 @@ static EFI_STATUS setup_command_line(
                 diskbus = PoolPrint(L"%a", (CHAR8 *)PREDEF_DISK_BUS);
 #endif
                 StrToLower(diskbus);
-                ret = prepend_command_line(&cmdline16,
+                ret = prepend_command_line(&line,
                                            (aosp_header->header_version < 2)
                                            ? L"androidboot.diskbus=%s"
                                            : L"androidboot.boot_devices=pci0000:00/0000:00:%s",
@@ -1136,7 +1369,7 @@ static EFI_STATUS setup_command_line(
         } else
                 error(L"Boot device not found, diskbus parameter not set in the commandline!");
 
-        ret = prepend_command_line(&cmdline16, L"androidboot.bootloader=%a",
+        ret = prepend_command_line(&line, L"androidboot.bootloader=%a",
                                    get_property_bootloader());
         if (EFI_ERROR(ret))
                 goto out;
@@ -1145,23 +1378,23 @@ static EFI_STATUS setup_command_line(
         //containing the recovery’s ramdisk. command line "androidboot.force_normal_boot=1" is
         //mandatory for normal boot.
         if(boot_target == NORMAL_BOOT) {
-                ret = prepend_command_line(&cmdline16, L"androidboot.force_normal_boot=1");
+                ret = prepend_command_line(&line, L"androidboot.force_normal_boot=1");
                 if (EFI_ERROR(ret))
                         goto out;
         }
 #endif
-        ret = prepend_command_line(&cmdline16, L"androidboot.acpi_idx=%a ",
+        ret = prepend_command_line(&line, L"androidboot.acpi_idx=%a ",
                                    acpi_loaded_table_idx_to_string(BOOT_ACPI));
         if (EFI_ERROR(ret))
                 goto out;
 
-        ret = prepend_command_line(&cmdline16, L"androidboot.acpio_idx=%a ",
+        ret = prepend_command_line(&line, L"androidboot.acpio_idx=%a ",
                                    acpi_loaded_table_idx_to_string(ACPIO));
         if (EFI_ERROR(ret))
                 goto out;
 
 #ifdef HAL_AUTODETECT
-        ret = prepend_command_line(&cmdline16, L"androidboot.brand=%a "
+        ret = prepend_command_line(&line, L"androidboot.brand=%a "
                                    "androidboot.name=%a androidboot.device=%a "
                                    "androidboot.model=%a", get_property_brand(),
                                    get_property_name(), get_property_device(),
@@ -1169,23 +1402,26 @@ static EFI_STATUS setup_command_line(
         if (EFI_ERROR(ret))
                 goto out;
 
-        ret = add_bootvars(bootimage, &cmdline16);
+        ret = add_bootvars(bootimage, &line);
         if (EFI_ERROR(ret))
                 goto out;
 #endif
 
-        ret = prepend_slot_command_line(&cmdline16, boot_target, vb_data);
+        ret = prepend_slot_command_line(&line, boot_target, vb_data);
         if (EFI_ERROR(ret))
                 goto out;
         /* append stages boottime */
         set_boottime_stamp(TM_JMP_KERNEL);
         construct_stages_boottime(time_str8, sizeof(time_str8));
-        time_str16 = stra_to_str(time_str8);
-        if (time_str16) {
-                ret = prepend_command_line(&cmdline16, L"androidboot.boottime=%s", time_str16);
-                if (EFI_ERROR(ret))
-                        goto out;
+        ret = prepend_command_line(&line, L"androidboot.boottime=%a", time_str8);
+        if (EFI_ERROR(ret))
+                goto out;
+#ifndef USER
+        if (line.reference) {
+                cmdline_reference = line.reference;
+                line.reference = NULL;
         }
+#endif
 
         if(boot_target != MEMORY)
                 vb_cmdlen = get_vb_cmdlen(vb_data);
@@ -1195,7 +1431,7 @@ static EFI_STATUS setup_command_line(
              * anywhere between the end of the setup heap and 0xA0000" */
             cmdline_addr = 0xA0000;
 
-            cmdlen = StrLen(cmdline16);
+            cmdlen = cmdline_len(&line);
             cmdsize = cmdlen + 1 + vb_cmdlen + 1;
             ret = allocate_pages(AllocateMaxAddress, EfiLoaderData,
                                  EFI_SIZE_TO_PAGES(cmdsize),
@@ -1204,7 +1440,7 @@ static EFI_STATUS setup_command_line(
                     goto out;
         } else {
         /*TBD- unify cmdline buffer allocation in ABL with UEFI */
-            cmdlen = StrLen(cmdline16);
+            cmdlen = cmdline_len(&line);
             /* +256: for extra cmd line*/
             cmdsize = cmdlen + vb_cmdlen + abl_cmd_len + 256;
             cmdline_addr = (EFI_PHYSICAL_ADDRESS)((UINTN)AllocatePool(cmdsize));
@@ -1215,9 +1451,8 @@ static EFI_STATUS setup_command_line(
         }
 
         cmdline = (CHAR8 *)(UINTN)cmdline_addr;
-        ret = str_to_stra(cmdline, cmdline16, cmdlen + 1);
+        ret = memcpy_s(cmdline, cmdsize, cmdline_str(&line), cmdlen + 1);
         if (EFI_ERROR(ret)) {
-                error(L"Non-ascii characters in command line");
                 free_pages(cmdline_addr, EFI_SIZE_TO_PAGES(cmdsize));
                 goto out;
         }
@@ -1252,15 +1487,67 @@ static EFI_STATUS setup_command_line(
         buf->hdr.cmd_line_ptr = (UINT32)(UINTN)cmdline;
         ret = EFI_SUCCESS;
 out:
-        FreePool(cmdline16);
+        cmdline_free(&line);
         if (serialport)
                 FreePool(serialport);
-        if (time_str16)
-                FreePool(time_str16);
 
         return ret;
 }
 
+#ifndef USER
+EFI_STATUS android_check_command_line(IN UINT8 *bootimage,
+                                      IN UINT8 *vendorbootimage,
+                                      IN enum boot_target boot_target,
+                                      OUT CHAR8 **cmdline,
+                                      OUT CHAR16 **reference)
+{
+        EFI_STATUS ret;
+        CHAR8 *line;
+        UINTN size;
+
+        if (!bootimage || !cmdline || !reference)
+                return EFI_INVALID_PARAMETER;
+
+        cmdline_build_reference = TRUE;
+        ret = setup_command_line(bootimage, vendorbootimage, boot_target,
+                                 NULL, BOOT_STATE_GREEN, NULL);
+        cmdline_build_reference = FALSE;
+        *reference = cmdline_reference;
+        cmdline_reference = NULL;
+        if (EFI_ERROR(ret)) {
+                if (*reference)
+                        FreePool(*reference);
+                *reference = NULL;
+                return ret;
+        }
+
+        line = (CHAR8 *)(UINTN)get_boot_param_hdr(bootimage)->hdr.cmd_line_ptr;
+        size = strlen(line) + 1;
+        *cmdline = AllocatePool(size);
+        if (*cmdline)
+                ret = memcpy_s(*cmdline, size, line, size);
+        else
+                ret = EFI_OUT_OF_RESOURCES;
+
+        /* Same size as allocated by setup_command_line() without any
+         * verified boot command line */
+        if (is_UEFI())
+                free_pages((EFI_PHYSICAL_ADDRESS)(UINTN)line,
+                           EFI_SIZE_TO_PAGES(size + 1));
+        else
+                FreePool(line);
+
+        if (EFI_ERROR(ret)) {
+                if (*cmdline)
+                        FreePool(*cmdline);
+                *cmdline = NULL;
+                FreePool(*reference);
+                *reference = NULL;
+        }
+        return ret;
+}
+#endif
+
 extern EFI_GUID GraphicsOutputProtocol;
 #define VIDEO_TYPE_EFI 0x70
 
@@ -1713,6 +2000,16 @@ EFI_STATUS read_bcb(
         struct gpt_partition_interface gpart;
         UINT64 partition_start;
 
+        if (!StrCmp(label, MISC_LABEL)) {
+                debug(L"Reading BCB from the misc cache");
+                ret = misc_cache_read(0, bcb, sizeof(*bcb));
+                if (EFI_ERROR(ret)) {
+                        efi_perror(ret, L"Failed to read BCB from misc");
+                        return ret;
+                }
+                goto out;
+        }
+
         debug(L"Locating BCB");
         ret = gpt_get_partition_by_label(label, &gpart, LOGICAL_UNIT_USER);
         if (EFI_ERROR(ret))
@@ -1727,6 +2024,8 @@ EFI_STATUS read_bcb(
                 efi_perror(ret, L"ReadDisk (bcb)");
                 return ret;
         }
+
+out:
         bcb->command[31] = '\0';
         bcb->status[31] = '\0';
         dump_bcb(bcb);
@@ -1744,6 +2043,17 @@ EFI_STATUS write_bcb(
         struct gpt_partition_interface gpart;
         UINT64 partition_start;
 
+        /* Served by the write-through misc cache */
+        if (!StrCmp(label, MISC_LABEL)) {
+                ret = misc_cache_write(0, bcb, sizeof(*bcb));
+                if (EFI_ERROR(ret)) {
+                        efi_perror(ret, L"Failed to write BCB to misc");
+                        return ret;
+                }
+                dump_bcb(bcb);
+                return EFI_SUCCESS;
+        }
+
         debug(L"Locating BCB");
         ret = gpt_get_partition_by_label(label, &gpart, LOGICAL_UNIT_USER);
         if (EFI_ERROR(ret))
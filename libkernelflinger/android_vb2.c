@@ -87,7 +87,7 @@ bool avb_update_stored_rollback_indexes_for_slot(AvbOps* ops, AvbSlotVerifyData*
 #define DISABLE_AVB_ROOTFS_PREFIX L" root="
 
 static EFI_STATUS avb_prepend_command_line_rootfs(
-                __attribute__((__unused__)) OUT CHAR16 **cmdline16,
+                __attribute__((__unused__)) OUT struct cmdline *cmdline,
                 IN enum boot_target boot_target)
 {
         EFI_STATUS ret = EFI_SUCCESS;
@@ -96,7 +96,7 @@ static EFI_STATUS avb_prepend_command_line_rootfs(
                 return ret;
 
         if (use_slot()) {
-                ret = prepend_command_line(cmdline16, AVB_ROOTFS_PREFIX);
+                ret = prepend_command_line(cmdline, AVB_ROOTFS_PREFIX);
                 if (EFI_ERROR(ret)) {
                         efi_perror(ret, L"Failed to add AVB rootfs prefix");
                         return ret;
@@ -105,7 +105,7 @@ static EFI_STATUS avb_prepend_command_line_rootfs(
         return ret;
 }
 
-EFI_STATUS prepend_slot_command_line(CHAR16 **cmdline16,
+EFI_STATUS prepend_slot_command_line(struct cmdline *cmdline,
         enum boot_target boot_target,
         VBDATA *vb_data)
 {
@@ -114,11 +114,11 @@ EFI_STATUS prepend_slot_command_line(CHAR16 **cmdline16,
         EFI_GUID system_uuid;
 #endif
 
-        avb_prepend_command_line_rootfs(cmdline16, boot_target);
+        avb_prepend_command_line_rootfs(cmdline, boot_target);
 
         if (use_slot()) {
                 if (slot_get_active()) {
-                        ret = prepend_command_line(cmdline16,
+                        ret = prepend_command_line(cmdline,
                                 L"androidboot.slot_suffix=%a",
                                 slot_get_active());
                         if (EFI_ERROR(ret))
@@ -138,7 +138,7 @@ EFI_STATUS prepend_slot_command_line(CHAR16 **cmdline16,
                                 return ret;
                         }
 
-                        ret = prepend_command_line(cmdline16,
+                        ret = prepend_command_line(cmdline,
                                 DISABLE_AVB_ROOTFS_PREFIX "PARTUUID=%g",
                                 &system_uuid);
                         if (EFI_ERROR(ret))
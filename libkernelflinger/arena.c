@@ -0,0 +1,136 @@
+/*
+ * Copyright (c) 2020, Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#include <efi.h>
+#include <efilib.h>
+#include <lib.h>
+
+#include "arena.h"
+
+#define ARENA_SIZE	(64 * 1024)
+#define ARENA_ALIGN	16
+
+static struct {
+	CHAR8 *base;
+	UINTN used;
+	UINTN depth;
+	struct arena_stats stats;
+} arena;
+
+arena_mark_t arena_push(void)
+{
+	if (!arena.base) {
+		arena.base = AllocatePool(ARENA_SIZE);
+		if (!arena.base)
+			error(L"Failed to allocate the arena");
+	}
+
+	arena.depth++;
+	return arena.used;
+}
+
+void arena_pop(arena_mark_t mark)
+{
+	if (!arena.depth || mark > arena.used) {
+		error(L"Unbalanced arena scope");
+		return;
+	}
+
+	arena.depth--;
+	arena.used = mark;
+}
+
+VOID *arena_alloc(UINTN size)
+{
+	UINTN start;
+
+	start = (arena.used + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+	if (!arena.base || !arena.depth || size > ARENA_SIZE - start) {
+		arena.stats.failures++;
+		return NULL;
+	}
+
+	arena.used = start + size;
+	arena.stats.peak = max(arena.stats.peak, arena.used);
+	arena.stats.allocs++;
+
+	return &arena.base[start];
+}
+
+CHAR16 *arena_stra_to_str(const CHAR8 *stra)
+{
+	UINTN len, i;
+	CHAR16 *str;
+
+	len = strlena(stra);
+	str = arena_alloc((len + 1) * sizeof(CHAR16));
+	if (!str)
+		return NULL;
+
+	for (i = 0; i < len; i++)
+		str[i] = (CHAR16)stra[i];
+	str[i] = 0;
+
+	return str;
+}
+
+CHAR8 *arena_str_to_stra(const CHAR16 *str)
+{
+	UINTN len;
+	CHAR8 *stra;
+
+	len = StrLen(str);
+	stra = arena_alloc(len + 1);
+	if (!stra)
+		return NULL;
+
+	if (EFI_ERROR(str_to_stra(stra, str, len + 1)))
+		return NULL;
+
+	return stra;
+}
+
+void arena_get_stats(struct arena_stats *stats)
+{
+	*stats = arena.stats;
+	stats->size = arena.base ? ARENA_SIZE : 0;
+	stats->used = arena.used;
+}
+
+void arena_free(void)
+{
+	if (arena.depth)
+		error(L"Freeing the arena with %d open scope(s)", arena.depth);
+
+	if (arena.base)
+		FreePool(arena.base);
+	ZeroMem(&arena, sizeof(arena));
+}
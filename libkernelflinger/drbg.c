@@ -0,0 +1,189 @@
+/*
+ * Copyright (c) 2020, Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#include <efi.h>
+#include <efilib.h>
+#include <lib.h>
+#include <openssl/evp.h>
+
+#include "drbg.h"
+
+#define DRBG_KEY_SIZE	32
+#define DRBG_IV_SIZE	16
+#define DRBG_SEED_SIZE	(DRBG_KEY_SIZE + DRBG_IV_SIZE)
+/* Output generated with a seed before fetching a new one */
+#define DRBG_RESEED_INTERVAL	(1ULL << 32)
+/* EVP_EncryptUpdate() takes an int length */
+#define DRBG_MAX_REQUEST	(1U << 30)
+
+#define CPUID_7_EBX_RDSEED	(1 << 18)
+#define RDSEED_RETRY		1024
+
+static struct drbg {
+	EVP_CIPHER_CTX *ctx;
+	UINT64 generated;
+} drbg;
+
+static BOOLEAN rdseed_supported(void)
+{
+	UINT32 reg[4];
+
+	cpuid(0, reg);
+	if (reg[0] < 7)
+		return FALSE;
+
+	cpuid_count(7, 0, reg);
+	return !!(reg[1] & CPUID_7_EBX_RDSEED);
+}
+
+static EFI_STATUS rdseed(UINT32 *value)
+{
+	UINTN i;
+	UINT8 ok;
+
+	/* RDSEED fails when the entropy source is temporarily
+	   exhausted, retry for a while.  */
+	for (i = 0; i < RDSEED_RETRY; i++) {
+		asm volatile("rdseed %0; setc %1"
+			     : "=r" (*value), "=qm" (ok) : : "cc");
+		if (ok)
+			return EFI_SUCCESS;
+		asm volatile("pause");
+	}
+
+	return EFI_NOT_READY;
+}
+
+static EFI_STATUS get_seed(UINT8 seed[DRBG_SEED_SIZE])
+{
+	EFI_STATUS ret;
+	UINT32 value;
+	UINTN i;
+
+	if (!rdseed_supported())
+		return generate_random_numbers((CHAR8 *)seed, DRBG_SEED_SIZE);
+
+	for (i = 0; i < DRBG_SEED_SIZE; i += sizeof(value)) {
+		ret = rdseed(&value);
+		if (EFI_ERROR(ret))
+			return ret;
+		memcpy_s(seed + i, DRBG_SEED_SIZE - i, &value, sizeof(value));
+	}
+
+	return EFI_SUCCESS;
+}
+
+static EFI_STATUS drbg_set_key(UINT8 seed[DRBG_SEED_SIZE])
+{
+	if (!EVP_EncryptInit_ex(drbg.ctx, EVP_aes_256_ctr(), NULL,
+				seed, seed + DRBG_KEY_SIZE))
+		return EFI_DEVICE_ERROR;
+
+	return EFI_SUCCESS;
+}
+
+static EFI_STATUS drbg_keystream(UINT8 *data, UINTN size)
+{
+	int len;
+
+	ZeroMem(data, size);
+	if (!EVP_EncryptUpdate(drbg.ctx, data, &len, data, size) ||
+	    (UINTN)len != size)
+		return EFI_DEVICE_ERROR;
+
+	drbg.generated += size;
+	return EFI_SUCCESS;
+}
+
+static EFI_STATUS drbg_reseed(void)
+{
+	EFI_STATUS ret;
+	UINT8 seed[DRBG_SEED_SIZE];
+
+	if (!drbg.ctx) {
+		drbg.ctx = EVP_CIPHER_CTX_new();
+		if (!drbg.ctx)
+			return EFI_OUT_OF_RESOURCES;
+	}
+
+	ret = get_seed(seed);
+	if (EFI_ERROR(ret)) {
+		efi_perror(ret, L"Failed to get a DRBG seed");
+		goto out;
+	}
+
+	ret = drbg_set_key(seed);
+	drbg.generated = 0;
+
+out:
+	ZeroMem(seed, sizeof(seed));
+	return ret;
+}
+
+EFI_STATUS drbg_generate(CHAR8 *data, UINTN size)
+{
+	EFI_STATUS ret;
+	UINT8 seed[DRBG_SEED_SIZE];
+	UINTN len;
+
+	if (!data)
+		return EFI_INVALID_PARAMETER;
+
+	if (!drbg.ctx || drbg.generated >= DRBG_RESEED_INTERVAL) {
+		ret = drbg_reseed();
+		if (EFI_ERROR(ret))
+			return ret;
+	}
+
+	for (; size; size -= len, data += len) {
+		len = min(size, (UINTN)DRBG_MAX_REQUEST);
+		ret = drbg_keystream((UINT8 *)data, len);
+		if (EFI_ERROR(ret))
+			return ret;
+	}
+
+	/* Replace the key so that the data returned so far cannot be
+	   recomputed from the generator state.  */
+	ret = drbg_keystream(seed, sizeof(seed));
+	if (!EFI_ERROR(ret))
+		ret = drbg_set_key(seed);
+	ZeroMem(seed, sizeof(seed));
+
+	return ret;
+}
+
+void drbg_free(void)
+{
+	if (drbg.ctx)
+		EVP_CIPHER_CTX_free(drbg.ctx);
+	drbg.ctx = NULL;
+	drbg.generated = 0;
+}
@@ -249,21 +249,48 @@ static EFI_STATUS gpt_list_partition_on_disk(struct gpt_disk *disk)
 	return EFI_SUCCESS;
 }
 
+static EFI_STATUS gpt_cache_disk(EFI_HANDLE handle, logical_unit_t log_unit)
+{
+	EFI_STATUS ret;
+
+	/* Check if the logical unit match the requested one */
+	ret = storage_check_logical_unit(DevicePathFromHandle(handle), log_unit);
+	if (EFI_ERROR(ret))
+		return ret;
+
+	ZeroMem(&sdisk, sizeof(sdisk));
+	ret = gpt_prepare_disk(handle, &sdisk);
+	if (EFI_ERROR(ret) && ret != EFI_COMPROMISED_DATA)
+		return ret;
+
+	sdisk.handle = handle;
+	sdisk.log_unit = log_unit;
+	return EFI_SUCCESS;
+}
+
 /* Given the logical unit, find the disk and caches
  * information into the global sdisk variable */
 static EFI_STATUS gpt_cache_partition(logical_unit_t log_unit)
 {
 	EFI_STATUS ret;
 	EFI_HANDLE *handles;
+	EFI_HANDLE hint = NULL;
 	UINTN nb_handle = 0;
 	UINTN i;
 	BOOLEAN found = FALSE;
-	EFI_DEVICE_PATH *device_path;
 
 	/* if  already cached, return */
 	if (sdisk.dio && sdisk.log_unit == log_unit)
 		return EFI_SUCCESS;
 
+	/* Try the disk used by the previous boot first */
+	if (log_unit == LOGICAL_UNIT_USER && get_boot_device())
+		hint = storage_get_boot_device_hint();
+	if (hint && !EFI_ERROR(gpt_cache_disk(hint, log_unit))) {
+		debug(L"Found disk from the boot device hint for logical unit %d", log_unit);
+		goto list_partitions;
+	}
+
 	ret = uefi_call_wrapper(BS->LocateHandleBuffer, 5, ByProtocol, &BlockIoProtocol, NULL, &nb_handle, &handles);
 	if (EFI_ERROR(ret)) {
 		efi_perror(ret, L"Failed to locate Block IO Protocol");
@@ -272,38 +299,33 @@ static EFI_STATUS gpt_cache_partition(logical_unit_t log_unit)
 	debug(L"Found %d block io protocols", nb_handle);
 
 	for (i = 0; i < nb_handle && !found; i++) {
-		/* Check if the logical unit match the requested one */
-		device_path = DevicePathFromHandle(handles[i]);
-		ret = storage_check_logical_unit(device_path, log_unit);
-		if (EFI_ERROR(ret))
+		if (handles[i] == hint)
 			continue;
 
-		ZeroMem(&sdisk, sizeof(sdisk));
-		ret = gpt_prepare_disk(handles[i], &sdisk);
-		if (EFI_ERROR(ret) && ret != EFI_COMPROMISED_DATA)
+		ret = gpt_cache_disk(handles[i], log_unit);
+		if (EFI_ERROR(ret))
 			continue;
 		debug(L"Found disk as block io %d for logical unit %d", i, log_unit);
-
-		sdisk.handle = handles[i];
-		sdisk.log_unit = log_unit;
 		found = TRUE;
 	}
+	FreePool(handles);
+
 	if (!found) {
 		error(L"No disk found for logical unit %d", log_unit);
-		ret = EFI_NOT_FOUND;
-		goto free_handles;
+		return EFI_NOT_FOUND;
 	}
 
+	if (log_unit == LOGICAL_UNIT_USER)
+		storage_save_boot_device_hint(sdisk.handle);
+
+list_partitions:
 	ret = gpt_list_partition_on_disk(&sdisk);
 	/* ignore if there are no gpt partition on the system disk */
 	if (EFI_ERROR(ret)) {
 		ZeroMem(&sdisk.gpt_hd, sizeof(struct gpt_header));
 	}
-	ret = EFI_SUCCESS;
 
-free_handles:
-	FreePool(handles);
-	return ret;
+	return EFI_SUCCESS;
 }
 
 void gpt_free_cache(void)
@@ -590,7 +612,7 @@ static VOID gpt_fill_entries(UINTN part_count, struct gpt_bin_part *gbp, struct
 	}
 }
 
-static EFI_STATUS gpt_write_mbr(void)
+static EFI_STATUS gpt_write_mbr(UINT64 *written)
 {
 	struct mbr mbr;
 	EFI_STATUS ret;
@@ -609,18 +631,54 @@ static EFI_STATUS gpt_write_mbr(void)
 				440, sizeof(struct mbr), &mbr);
 	if (EFI_ERROR(ret))
 		error(L"Couldn't write MBR");
+	else
+		*written += sizeof(struct mbr);
 
 	return ret;
 }
 
-static EFI_STATUS gpt_write_table_to_disk(struct gpt_header *gh)
+/* Adds the number of bytes written to WRITTEN. */
+static EFI_STATUS gpt_write_table_to_disk(struct gpt_header *gh, UINT64 *written)
 {
-	UINT64 entries_offset, header_offset, entries_size;
+	UINT64 entries_offset, header_offset, entries_size, block_size;
+	UINT8 *buf, *header, *entries;
 	EFI_STATUS ret;
 
+	block_size = sdisk.bio->Media->BlockSize;
 	entries_size = gh->number_of_entries * gh->size_of_entry;
-	header_offset = gh->my_lba * sdisk.bio->Media->BlockSize;
-	entries_offset = gh->entries_lba * sdisk.bio->Media->BlockSize;
+	header_offset = gh->my_lba * block_size;
+	entries_offset = gh->entries_lba * block_size;
+
+	/* The header and the entries array are adjacent, right after
+	   the protective MBR for the primary table and right before
+	   the last block for the backup one.  Write them in a single
+	   request, the header block being padded with zeros.  */
+	if (entries_size % block_size == 0 &&
+	    (entries_offset == header_offset + block_size ||
+	     entries_offset + entries_size == header_offset)) {
+		buf = AllocateZeroPool(block_size + entries_size);
+		if (!buf) {
+			error(L"Cannot allocate the GPT table buffer");
+			return EFI_OUT_OF_RESOURCES;
+		}
+
+		header = entries_offset > header_offset ? buf : buf + entries_size;
+		entries = entries_offset > header_offset ? buf + block_size : buf;
+		CopyMem(header, gh, sizeof(struct gpt_header));
+		CopyMem(entries, sdisk.partitions, entries_size);
+
+		ret = uefi_call_wrapper(sdisk.dio->WriteDisk, 5, sdisk.dio,
+					sdisk.bio->Media->MediaId,
+					min(header_offset, entries_offset),
+					block_size + entries_size, buf);
+		FreePool(buf);
+		if (EFI_ERROR(ret))
+			error(L"Couldn't write GPT header and entries array");
+		else
+			*written += block_size + entries_size;
+
+		return ret;
+	}
 
 	ret = uefi_call_wrapper(sdisk.dio->WriteDisk, 5, sdisk.dio, sdisk.bio->Media->MediaId,
 				header_offset, sizeof(struct gpt_header), gh);
@@ -628,20 +686,26 @@ static EFI_STATUS gpt_write_table_to_disk(struct gpt_header *gh)
 		error(L"Couldn't write GPT header");
 		return ret;
 	}
+	*written += sizeof(struct gpt_header);
 
 	ret = uefi_call_wrapper(sdisk.dio->WriteDisk, 5, sdisk.dio, sdisk.bio->Media->MediaId,
 				entries_offset, entries_size,
 				sdisk.partitions);
 	if (EFI_ERROR(ret))
 		error(L"Couldn't write GPT entries array");
+	else
+		*written += entries_size;
 
 	return ret;
 }
 
-static EFI_STATUS gpt_write_partition_tables(void)
+/* The protective MBR only depends on the disk size, WRITE_MBR can be
+   FALSE when only the partition entries changed.  If WRITTEN is not
+   NULL, it is set to the number of bytes written.  */
+static EFI_STATUS gpt_write_partition_tables(BOOLEAN write_mbr, UINT64 *written)
 {
 	EFI_STATUS ret;
-	UINT64 entries_size;
+	UINT64 entries_size, bytes = 0;
 	struct gpt_header *gh;
 	struct gpt_header *gh_backup;
 	UINT32 crc;
@@ -664,7 +728,7 @@ static EFI_STATUS gpt_write_partition_tables(void)
 		return ret;
 
 	debug(L"Write first GPT Header at %d", gh->my_lba);
-	ret = gpt_write_table_to_disk(gh);
+	ret = gpt_write_table_to_disk(gh, &bytes);
 	if (EFI_ERROR(ret)) {
 		efi_perror(ret, L"Failed to write primary GPT header");
 		return ret;
@@ -687,16 +751,22 @@ static EFI_STATUS gpt_write_partition_tables(void)
 		return ret;
 
 	debug(L"Write alternate GPT Header at %d", gh_backup->my_lba);
-	ret = gpt_write_table_to_disk(gh_backup);
+	ret = gpt_write_table_to_disk(gh_backup, &bytes);
 	FreePool(gh_backup);
 	if (EFI_ERROR(ret)) {
 		efi_perror(ret, L"Failed to write alternate GPT header");
 		return ret;
 	}
-	debug(L"Write protective MBR");
-	ret = gpt_write_mbr();
-	if (EFI_ERROR(ret))
-		return ret;
+
+	if (write_mbr) {
+		debug(L"Write protective MBR");
+		ret = gpt_write_mbr(&bytes);
+		if (EFI_ERROR(ret))
+			return ret;
+	}
+
+	if (written)
+		*written = bytes;
 
 	return gpt_refresh();
 }
@@ -746,7 +816,7 @@ EFI_STATUS gpt_create(struct gpt_header *gh, UINTN gh_size,
 
 out:
 	sdisk.label_prefix_removed = FALSE;
-	return gpt_write_partition_tables();
+	return gpt_write_partition_tables(TRUE, NULL);
 }
 
 static EFI_STATUS get_partition_guid(const CHAR16 *label, EFI_GUID *guid,
@@ -783,7 +853,8 @@ EFI_STATUS gpt_get_partition_uuid(const CHAR16 *label, EFI_GUID *uuid, logical_u
 	return get_partition_guid(label, uuid, log_unit, TRUE);
 }
 
-EFI_STATUS gpt_swap_partition(const CHAR16 *label1, const CHAR16 *label2, logical_unit_t log_unit)
+EFI_STATUS gpt_swap_partition(const CHAR16 *label1, const CHAR16 *label2, logical_unit_t log_unit,
+			      UINT64 *written)
 {
 	EFI_STATUS ret;
 	struct gpt_partition *part1, *part2, save1;
@@ -816,7 +887,7 @@ EFI_STATUS gpt_swap_partition(const CHAR16 *label1, const CHAR16 *label2, logica
 	part2->starting_lba = save1.starting_lba;
 	part2->ending_lba = save1.ending_lba;
 
-	return gpt_write_partition_tables();
+	return gpt_write_partition_tables(FALSE, written);
 }
 
 static HARDDRIVE_DEVICE_PATH *get_hd_device_path(EFI_DEVICE_PATH *p)
@@ -917,6 +988,60 @@ EFI_STATUS gpt_get_partitions(struct gpt_partition **partitions, UINTN *size, lo
 	return memcpy_s(*partitions, *size, sdisk.partitions, *size);
 }
 
+EFI_STATUS gpt_get_cache(EFI_HANDLE *disk, struct gpt_header **header,
+			 struct gpt_partition **partitions, UINTN *count)
+{
+	if (!disk || !header || !partitions || !count)
+		return EFI_INVALID_PARAMETER;
+
+	if (!sdisk.dio || sdisk.log_unit != LOGICAL_UNIT_USER)
+		return EFI_NOT_FOUND;
+
+	*disk = sdisk.handle;
+	*header = &sdisk.gpt_hd;
+	*partitions = sdisk.partitions;
+	*count = is_gpt_device(&sdisk.gpt_hd) ? sdisk.gpt_hd.number_of_entries : 0;
+
+	return EFI_SUCCESS;
+}
+
+EFI_STATUS gpt_set_cache(EFI_HANDLE disk, struct gpt_header *header,
+			 struct gpt_partition *partitions, UINTN count)
+{
+	EFI_STATUS ret;
+
+	if (!disk || !header || (count && !partitions) || count > GPT_ENTRIES)
+		return EFI_INVALID_PARAMETER;
+
+	ZeroMem(&sdisk, sizeof(sdisk));
+	ret = uefi_call_wrapper(BS->HandleProtocol, 3, disk, &BlockIoProtocol, (VOID *)&sdisk.bio);
+	if (EFI_ERROR(ret))
+		goto err;
+
+	ret = uefi_call_wrapper(BS->HandleProtocol, 3, disk, &DiskIoProtocol, (VOID *)&sdisk.dio);
+	if (EFI_ERROR(ret))
+		goto err;
+
+	ret = memcpy_s(&sdisk.gpt_hd, sizeof(sdisk.gpt_hd), header, sizeof(*header));
+	if (EFI_ERROR(ret))
+		goto err;
+
+	if (count) {
+		ret = memcpy_s(sdisk.partitions, sizeof(sdisk.partitions),
+			       partitions, count * sizeof(*partitions));
+		if (EFI_ERROR(ret))
+			goto err;
+	}
+
+	sdisk.handle = disk;
+	sdisk.log_unit = LOGICAL_UNIT_USER;
+	return EFI_SUCCESS;
+
+err:
+	ZeroMem(&sdisk, sizeof(sdisk));
+	return ret;
+}
+
 UINT64 get_partition_start(struct gpt_partition_interface *gparti)
 {
 	if (gparti == NULL)
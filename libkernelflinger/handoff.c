@@ -0,0 +1,242 @@
+/*
+ * Copyright (c) 2020, Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#include <efi.h>
+#include <efilib.h>
+#include <lib.h>
+#include "gpt.h"
+#include "storage.h"
+#include "misc_cache.h"
+#include "uefi_utils.h"
+#include "handoff.h"
+
+static EFI_GUID handoff_guid = KFLD_HANDOFF_GUID;
+
+static EFI_STATUS handoff_crc32(struct kfld_handoff *handoff, UINT32 *crc)
+{
+	EFI_STATUS ret;
+	UINT32 saved_crc = handoff->crc32;
+
+	handoff->crc32 = 0;
+	ret = uefi_call_wrapper(BS->CalculateCrc32, 3, handoff,
+				handoff->size, crc);
+	handoff->crc32 = saved_crc;
+
+	return ret;
+}
+
+EFI_STATUS handoff_publish(void)
+{
+	EFI_STATUS ret;
+	struct kfld_handoff *handoff;
+	enum storage_type type;
+	EFI_HANDLE disk;
+	struct gpt_header *header;
+	struct gpt_partition *partitions;
+	EFI_DEVICE_PATH *path;
+	const VOID *misc;
+	UINTN count, misc_size, path_size, parts_size, size;
+	UINT8 *data;
+
+	ret = get_boot_device_type(&type);
+	if (EFI_ERROR(ret))
+		return ret;
+
+	ret = gpt_get_cache(&disk, &header, &partitions, &count);
+	if (EFI_ERROR(ret))
+		return ret;
+
+	ret = misc_cache_get(&misc, &misc_size);
+	if (EFI_ERROR(ret))
+		return ret;
+
+	path = DevicePathFromHandle(disk);
+	if (!path)
+		return EFI_NOT_FOUND;
+
+	path_size = DevicePathSize(path);
+	parts_size = count * sizeof(*partitions);
+	size = sizeof(*handoff) + parts_size + misc_size + path_size;
+
+	handoff = AllocateZeroPool(size);
+	if (!handoff)
+		return EFI_OUT_OF_RESOURCES;
+
+	handoff->magic = KFLD_HANDOFF_MAGIC;
+	handoff->version = KFLD_HANDOFF_VERSION;
+	handoff->size = size;
+	handoff->storage_type = type;
+	handoff->nb_partitions = count;
+	handoff->misc_size = misc_size;
+	handoff->device_path_size = path_size;
+	handoff->disk = disk;
+	CopyMem(&handoff->gpt_hd, header, sizeof(*header));
+
+	data = handoff->data;
+	CopyMem(data, partitions, parts_size);
+	data += parts_size;
+	CopyMem(data, misc, misc_size);
+	data += misc_size;
+	CopyMem(data, path, path_size);
+
+	ret = handoff_crc32(handoff, &handoff->crc32);
+	if (EFI_ERROR(ret))
+		goto err;
+
+	ret = uefi_call_wrapper(BS->InstallConfigurationTable, 2,
+				&handoff_guid, handoff);
+	if (EFI_ERROR(ret))
+		goto err;
+
+	debug(L"Boot handoff published, %d partitions", count);
+	return EFI_SUCCESS;
+
+err:
+	FreePool(handoff);
+	return ret;
+}
+
+static struct kfld_handoff *handoff_take(void)
+{
+	EFI_STATUS ret;
+	struct kfld_handoff *handoff;
+
+	ret = LibGetSystemConfigurationTable(&handoff_guid, (VOID **)&handoff);
+	if (EFI_ERROR(ret) || !handoff)
+		return NULL;
+
+	/* Whoever takes the handoff owns it, it must not reach the OS. */
+	ret = uefi_call_wrapper(BS->InstallConfigurationTable, 2,
+				&handoff_guid, NULL);
+	if (EFI_ERROR(ret)) {
+		efi_perror(ret, L"Failed to remove the boot handoff");
+		return NULL;
+	}
+
+	return handoff;
+}
+
+void handoff_withdraw(void)
+{
+	struct kfld_handoff *handoff = handoff_take();
+
+	if (handoff)
+		FreePool(handoff);
+}
+
+static EFI_STATUS handoff_check(struct kfld_handoff *handoff, EFI_HANDLE device)
+{
+	EFI_STATUS ret;
+	EFI_DEVICE_PATH *path, *disk_path;
+	UINT32 crc;
+	UINT64 size;
+
+	if (handoff->magic != KFLD_HANDOFF_MAGIC ||
+	    handoff->version != KFLD_HANDOFF_VERSION ||
+	    handoff->storage_type >= STORAGE_ALL ||
+	    handoff->nb_partitions > GPT_ENTRIES)
+		return EFI_INCOMPATIBLE_VERSION;
+
+	size = sizeof(*handoff) +
+		(UINT64)handoff->nb_partitions * sizeof(struct gpt_partition) +
+		handoff->misc_size + handoff->device_path_size;
+	if (handoff->size != size)
+		return EFI_COMPROMISED_DATA;
+
+	ret = handoff_crc32(handoff, &crc);
+	if (EFI_ERROR(ret))
+		return ret;
+	if (crc != handoff->crc32)
+		return EFI_CRC_ERROR;
+
+	/* The disk handle is only trusted if it still describes the
+	 * handed over device path and holds the image partition. */
+	path = (EFI_DEVICE_PATH *)(handoff->data +
+				   handoff->nb_partitions * sizeof(struct gpt_partition) +
+				   handoff->misc_size);
+	if (uefi_device_path_size(path, handoff->device_path_size) !=
+	    handoff->device_path_size)
+		return EFI_COMPROMISED_DATA;
+
+	disk_path = DevicePathFromHandle(handoff->disk);
+	if (!disk_path || DevicePathSize(disk_path) != handoff->device_path_size ||
+	    CompareMem(disk_path, path, handoff->device_path_size))
+		return EFI_NOT_FOUND;
+
+	if (!is_same_device(DevicePathFromHandle(device), disk_path))
+		return EFI_NOT_FOUND;
+
+	return EFI_SUCCESS;
+}
+
+EFI_STATUS handoff_adopt(EFI_HANDLE device)
+{
+	EFI_STATUS ret;
+	struct kfld_handoff *handoff;
+	struct gpt_partition *partitions;
+	UINT8 *misc;
+
+	handoff = handoff_take();
+	if (!handoff)
+		return EFI_NOT_FOUND;
+
+	ret = handoff_check(handoff, device);
+	if (EFI_ERROR(ret)) {
+		efi_perror(ret, L"Ignoring the boot handoff");
+		goto out;
+	}
+
+	ret = storage_adopt_boot_device(device, handoff->storage_type);
+	if (EFI_ERROR(ret))
+		goto out;
+
+	partitions = (struct gpt_partition *)handoff->data;
+	ret = gpt_set_cache(handoff->disk, &handoff->gpt_hd, partitions,
+			    handoff->nb_partitions);
+	if (EFI_ERROR(ret)) {
+		efi_perror(ret, L"Failed to adopt the partition table");
+		goto out;
+	}
+
+	misc = (UINT8 *)(partitions + handoff->nb_partitions);
+	ret = misc_cache_set(misc, handoff->misc_size);
+	if (EFI_ERROR(ret)) {
+		efi_perror(ret, L"Failed to adopt the misc partition content");
+		gpt_free_cache();
+		goto out;
+	}
+
+	debug(L"Boot handoff adopted");
+
+out:
+	FreePool(handoff);
+	return ret;
+}
@@ -1471,25 +1471,30 @@ UINT64 efi_time_to_ctime(EFI_TIME *time)
                 (UINT64)time->Second;
 }
 
-VOID cpuid(UINT32 op, UINT32 reg[4])
+VOID cpuid_count(UINT32 op, UINT32 count, UINT32 reg[4])
 {
 #if __LP64__
         asm volatile("xchg{q}\t{%%}rbx, %q1\n\t"
                      "cpuid\n\t"
                      "xchg{q}\t{%%}rbx, %q1\n\t"
                      : "=a" (reg[0]), "=&r" (reg[1]), "=c" (reg[2]), "=d" (reg[3])
-                     : "a" (op));
+                     : "a" (op), "c" (count));
 #else
         asm volatile("pushl %%ebx      \n\t" /* save %ebx */
                      "cpuid            \n\t"
                      "movl %%ebx, %1   \n\t" /* save what cpuid just put in %ebx */
                      "popl %%ebx       \n\t" /* restore the old %ebx */
                      : "=a"(reg[0]), "=r"(reg[1]), "=c"(reg[2]), "=d"(reg[3])
-                     : "a"(op)
+                     : "a"(op), "c"(count)
                      : "cc");
 #endif
 }
 
+VOID cpuid(UINT32 op, UINT32 reg[4])
+{
+        cpuid_count(op, 0, reg);
+}
+
 EFI_STATUS generate_random_numbers(CHAR8 *data, UINTN size)
 {
 #define RDRAND_SUPPORT (1 << 30)
@@ -0,0 +1,231 @@
+/*
+ * Copyright (c) 2020, Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#include <efi.h>
+#include <efilib.h>
+#include <lib.h>
+#include <vars.h>
+#include "gpt.h"
+#include "uefi_utils.h"
+#include "android.h"
+#include "misc_cache.h"
+
+/* BCB and A/B metadata */
+#define MISC_CACHE_SIZE sizeof(struct bootloader_message_ab)
+
+static struct misc_cache {
+	struct gpt_partition_interface gparti;
+	UINT8 *data;
+	UINTN size;
+	UINTN dirty_start;
+	UINTN dirty_end;
+} cache;
+
+static EFI_STATUS misc_cache_load(void)
+{
+	EFI_STATUS ret;
+	UINT64 part_size;
+	UINTN size;
+
+	if (cache.data)
+		return EFI_SUCCESS;
+
+	ret = gpt_get_partition_by_label(MISC_LABEL, &cache.gparti,
+					 LOGICAL_UNIT_USER);
+	if (EFI_ERROR(ret)) {
+		efi_perror(ret, L"Failed to get the misc partition");
+		return ret;
+	}
+
+	part_size = get_partition_size(&cache.gparti);
+	size = ALIGN(MISC_CACHE_SIZE, cache.gparti.bio->Media->BlockSize);
+	if (size > part_size)
+		size = part_size;
+
+	cache.data = AllocatePool(size);
+	if (!cache.data)
+		return EFI_OUT_OF_RESOURCES;
+
+	ret = uefi_call_wrapper(cache.gparti.dio->ReadDisk, 5, cache.gparti.dio,
+				cache.gparti.bio->Media->MediaId,
+				get_partition_start(&cache.gparti),
+				size, cache.data);
+	if (EFI_ERROR(ret)) {
+		efi_perror(ret, L"Failed to read the misc partition");
+		FreePool(cache.data);
+		cache.data = NULL;
+		return ret;
+	}
+
+	cache.size = size;
+	cache.dirty_start = cache.dirty_end = 0;
+
+	return EFI_SUCCESS;
+}
+
+BOOLEAN misc_cache_covers(UINT64 offset, UINT64 size)
+{
+	if (EFI_ERROR(misc_cache_load()))
+		return FALSE;
+
+	return offset < cache.size && size <= cache.size - offset;
+}
+
+EFI_STATUS misc_cache_get(const VOID **data, UINTN *size)
+{
+	EFI_STATUS ret;
+
+	if (!data || !size)
+		return EFI_INVALID_PARAMETER;
+
+	ret = misc_cache_load();
+	if (EFI_ERROR(ret))
+		return ret;
+
+	*data = cache.data;
+	*size = cache.size;
+	return EFI_SUCCESS;
+}
+
+EFI_STATUS misc_cache_set(const VOID *data, UINTN size)
+{
+	EFI_STATUS ret;
+	UINTN expected;
+
+	if (!data)
+		return EFI_INVALID_PARAMETER;
+
+	misc_cache_invalidate();
+	ret = gpt_get_partition_by_label(MISC_LABEL, &cache.gparti,
+					 LOGICAL_UNIT_USER);
+	if (EFI_ERROR(ret))
+		return ret;
+
+	expected = min(ALIGN(MISC_CACHE_SIZE, cache.gparti.bio->Media->BlockSize),
+		       get_partition_size(&cache.gparti));
+	if (size != expected)
+		return EFI_INVALID_PARAMETER;
+
+	cache.data = AllocatePool(size);
+	if (!cache.data)
+		return EFI_OUT_OF_RESOURCES;
+
+	ret = memcpy_s(cache.data, size, data, size);
+	if (EFI_ERROR(ret)) {
+		misc_cache_invalidate();
+		return ret;
+	}
+
+	cache.size = size;
+	return EFI_SUCCESS;
+}
+
+EFI_STATUS misc_cache_read(UINTN offset, VOID *data, UINTN size)
+{
+	EFI_STATUS ret;
+
+	if (!data)
+		return EFI_INVALID_PARAMETER;
+
+	ret = misc_cache_load();
+	if (EFI_ERROR(ret))
+		return ret;
+
+	if (offset > cache.size || size > cache.size - offset)
+		return EFI_INVALID_PARAMETER;
+
+	return memcpy_s(data, size, cache.data + offset, size);
+}
+
+static EFI_STATUS misc_cache_flush(void)
+{
+	EFI_STATUS ret;
+	UINTN block_size, start, end;
+
+	if (!cache.data || cache.dirty_start == cache.dirty_end)
+		return EFI_SUCCESS;
+
+	block_size = cache.gparti.bio->Media->BlockSize;
+	start = ALIGN_DOWN(cache.dirty_start, block_size);
+	end = min(ALIGN(cache.dirty_end, block_size), cache.size);
+
+	ret = uefi_call_wrapper(cache.gparti.dio->WriteDisk, 5, cache.gparti.dio,
+				cache.gparti.bio->Media->MediaId,
+				get_partition_start(&cache.gparti) + start,
+				end - start, cache.data + start);
+	if (EFI_ERROR(ret)) {
+		efi_perror(ret, L"Failed to write the misc partition");
+		return ret;
+	}
+
+	cache.dirty_start = cache.dirty_end = 0;
+
+	return EFI_SUCCESS;
+}
+
+EFI_STATUS misc_cache_write(UINTN offset, const VOID *data, UINTN size)
+{
+	EFI_STATUS ret;
+
+	if (!data)
+		return EFI_INVALID_PARAMETER;
+
+	ret = misc_cache_load();
+	if (EFI_ERROR(ret))
+		return ret;
+
+	if (offset > cache.size || size > cache.size - offset)
+		return EFI_INVALID_PARAMETER;
+
+	ret = memcpy_s(cache.data + offset, cache.size - offset, data, size);
+	if (EFI_ERROR(ret))
+		return ret;
+
+	if (cache.dirty_start == cache.dirty_end) {
+		cache.dirty_start = offset;
+		cache.dirty_end = offset + size;
+	} else {
+		cache.dirty_start = min(cache.dirty_start, offset);
+		cache.dirty_end = max(cache.dirty_end, offset + size);
+	}
+
+	/* The A/B metadata and the BCB must survive a halt or a reset
+	   on any error path, write them through.  A failed write-back
+	   is retried on the next write.  */
+	return misc_cache_flush();
+}
+
+void misc_cache_invalidate(void)
+{
+	if (cache.data)
+		FreePool(cache.data);
+	ZeroMem(&cache, sizeof(cache));
+}
@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) 2020, Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#include <efi.h>
+#include <efilib.h>
+#include <lib.h>
+
+#include "protocol/MpService.h"
+#include "mp.h"
+
+static EFI_STATUS find_ap(EFI_MP_SERVICES_PROTOCOL *mp, UINTN *number)
+{
+	EFI_STATUS ret;
+	EFI_PROCESSOR_INFORMATION info;
+	UINTN count, enabled, i;
+
+	ret = uefi_call_wrapper(mp->GetNumberOfProcessors, 3, mp,
+				&count, &enabled);
+	if (EFI_ERROR(ret))
+		return ret;
+
+	for (i = 0; i < count; i++) {
+		ret = uefi_call_wrapper(mp->GetProcessorInfo, 3, mp, i, &info);
+		if (EFI_ERROR(ret))
+			continue;
+
+		if (!(info.StatusFlag & PROCESSOR_AS_BSP_BIT) &&
+		    (info.StatusFlag & PROCESSOR_ENABLED_BIT) &&
+		    (info.StatusFlag & PROCESSOR_HEALTH_STATUS_BIT)) {
+			*number = i;
+			return EFI_SUCCESS;
+		}
+	}
+
+	return EFI_UNSUPPORTED;
+}
+
+EFI_STATUS mp_start_on_ap(mp_procedure_t procedure, VOID *argument,
+			  EFI_EVENT *done)
+{
+	EFI_GUID guid = EFI_MP_SERVICES_PROTOCOL_GUID;
+	EFI_MP_SERVICES_PROTOCOL *mp;
+	EFI_STATUS ret;
+	UINTN number;
+
+	ret = LibLocateProtocol(&guid, (VOID **)&mp);
+	if (EFI_ERROR(ret) || !mp)
+		return EFI_UNSUPPORTED;
+
+	ret = find_ap(mp, &number);
+	if (EFI_ERROR(ret))
+		return ret;
+
+	ret = uefi_call_wrapper(BS->CreateEvent, 5, 0, 0, NULL, NULL, done);
+	if (EFI_ERROR(ret)) {
+		efi_perror(ret, L"Failed to create the AP completion event");
+		return ret;
+	}
+
+	ret = uefi_call_wrapper(mp->StartupThisAP, 7, mp, procedure, number,
+				*done, 0, argument, NULL);
+	if (EFI_ERROR(ret)) {
+		uefi_call_wrapper(BS->CloseEvent, 1, *done);
+		*done = NULL;
+		return ret;
+	}
+
+	return EFI_SUCCESS;
+}
@@ -40,12 +40,34 @@ enum vartype {
 	VAR_TYPE_BLOB
 };
 
+#define OEMVAR_BUCKETS 64
+
+/* The variables are written in file order: time based authenticated
+   writes, like the Secure Boot PK, KEK and db, depend on it.  */
+struct oemvar {
+	struct oemvar *next;
+	/* Next variable of the same hash bucket */
+	struct oemvar *hnext;
+	EFI_GUID guid;
+	CHAR16 *name;
+	UINT32 attributes;
+	/* Set again later in the file */
+	BOOLEAN overridden;
+	UINTN size;
+	CHAR8 data[];
+};
+
 typedef struct oemvars_ctx {
 	EFI_GUID guid;
 	const EFI_GUID *restricted_guid;
 	BOOLEAN silent_write_error;
+	struct oemvar *vars;
+	struct oemvar **last;
+	struct oemvar *buckets[OEMVAR_BUCKETS];
 } oemvars_ctx_t;
 
+static struct oemvars_stats stats;
+
 static BOOLEAN parse_oemvar_guid_line(char *line, EFI_GUID *g)
 {
 	EFI_STATUS ret;
@@ -165,12 +187,47 @@ static int parse_oemvar_attributes(char **linep, uint32_t *attributesp, enum var
 	return 0;
 }
 
+static unsigned int oemvar_hash(struct oemvar *var)
+{
+	unsigned int hash_val;
+	CHAR16 *c;
+
+	/* based on libcutils hashmapHash() algorithm */
+	for (hash_val = var->guid.Data1, c = var->name; *c; c++)
+		hash_val = hash_val * 31 + *c;
+	return hash_val % OEMVAR_BUCKETS;
+}
+
+/* Mark the previous setting of VAR as overridden.  Time based
+   authenticated writes are never dropped: each one is checked by the
+   firmware against the state left by the previous ones.  */
+static void track_override(oemvars_ctx_t *ctx, struct oemvar *var)
+{
+	struct oemvar **prev;
+
+	if (var->attributes & EFI_VARIABLE_TIME_BASED_AUTHENTICATED_WRITE_ACCESS)
+		return;
+
+	prev = &ctx->buckets[oemvar_hash(var)];
+	for (; *prev; prev = &(*prev)->hnext)
+		if (!memcmp(&(*prev)->guid, &var->guid, sizeof(var->guid)) &&
+		    !StrCmp((*prev)->name, var->name)) {
+			(*prev)->overridden = TRUE;
+			var->hnext = (*prev)->hnext;
+			*prev = var;
+			return;
+		}
+
+	*prev = var;
+}
+
 static EFI_STATUS parse_line(char *line, VOID *context)
 {
 	EFI_STATUS ret;
 	uint32_t attributes = 0;
 	enum vartype type;
 	CHAR16 *varname;
+	struct oemvar *oemvar;
 	UINTN vallen;
 	char  *var, *val, *p;
 	oemvars_ctx_t *ctx = (oemvars_ctx_t *)context;
@@ -223,35 +280,126 @@ static EFI_STATUS parse_line(char *line, VOID *context)
 		vallen = 0;
 	}
 
+	if (!memcmp(&ctx->guid, &fastboot_guid, sizeof(ctx->guid))) {
+		error(L"fastboot GUID is reserved for Kernelflinger use");
+		return EFI_ACCESS_DENIED;
+	}
+
 	varname = stra_to_str((CHAR8 *)var);
 	if (!varname) {
 		error(L"Failed to convert varname string.");
 		return EFI_INVALID_PARAMETER;
 	}
 
-	if (!memcmp(&ctx->guid, &fastboot_guid, sizeof(ctx->guid))) {
-		error(L"fastboot GUID is reserved for Kernelflinger use");
-		return EFI_ACCESS_DENIED;
+	oemvar = AllocatePool(sizeof(*oemvar) + vallen);
+	if (!oemvar) {
+		FreePool(varname);
+		return EFI_OUT_OF_RESOURCES;
+	}
+
+	oemvar->next = NULL;
+	oemvar->hnext = NULL;
+	oemvar->guid = ctx->guid;
+	oemvar->name = varname;
+	oemvar->attributes = attributes;
+	oemvar->overridden = FALSE;
+	oemvar->size = vallen;
+	ret = memcpy_s(oemvar->data, vallen, val, vallen);
+	if (EFI_ERROR(ret)) {
+		FreePool(varname);
+		FreePool(oemvar);
+		return ret;
 	}
 
-	debug(L"Setting oemvar: %a", var);
-	ret = uefi_call_wrapper(RT->SetVariable, 5, varname,
-				&ctx->guid, attributes,
-				vallen, val);
-	FreePool(varname);
-	/* Delete a non-existent variable is permitted.  */
-	if (EFI_ERROR(ret) && !(ret == EFI_NOT_FOUND && vallen == 0)) {
-		if (!ctx->silent_write_error) {
-			efi_perror(ret, L"EFI variable setting failed");
-			return ret;
+	track_override(ctx, oemvar);
+	*ctx->last = oemvar;
+	ctx->last = &oemvar->next;
+
+	return EFI_SUCCESS;
+}
+
+static BOOLEAN oemvar_is_unchanged(struct oemvar *var)
+{
+	EFI_STATUS ret;
+	UINT32 attributes;
+	UINTN size = 0;
+	CHAR8 *data;
+	BOOLEAN same;
+
+	/* The payload of a time based authenticated write is not the
+	   value that ends up in the variable, it cannot be compared.  */
+	if (var->attributes & EFI_VARIABLE_TIME_BASED_AUTHENTICATED_WRITE_ACCESS)
+		return FALSE;
+
+	ret = uefi_call_wrapper(RT->GetVariable, 5, var->name, &var->guid,
+				&attributes, &size, NULL);
+	if (ret == EFI_NOT_FOUND)
+		return !var->size;
+	if (ret != EFI_BUFFER_TOO_SMALL || !var->size)
+		return FALSE;
+	if (size != var->size || attributes != var->attributes)
+		return FALSE;
+
+	data = AllocatePool(size);
+	if (!data)
+		return FALSE;
+
+	ret = uefi_call_wrapper(RT->GetVariable, 5, var->name, &var->guid,
+				&attributes, &size, data);
+	same = !EFI_ERROR(ret) && size == var->size &&
+		!memcmp(data, var->data, size);
+	FreePool(data);
+
+	return same;
+}
+
+static EFI_STATUS apply_oemvars(oemvars_ctx_t *ctx)
+{
+	EFI_STATUS ret;
+	struct oemvar *var;
+
+	for (var = ctx->vars; var; var = var->next) {
+		if (var->overridden)
+			continue;
+
+		if (oemvar_is_unchanged(var)) {
+			stats.unchanged++;
+			continue;
 		}
-		debug(L"EFI variable setting failed: %r", ret);
-		debug(L"silent error is on, continue anyway");
+
+		debug(L"Setting oemvar: %s", var->name);
+		ret = uefi_call_wrapper(RT->SetVariable, 5, var->name,
+					&var->guid, var->attributes,
+					var->size, var->data);
+		/* Delete a non-existent variable is permitted.  */
+		if (EFI_ERROR(ret) && !(ret == EFI_NOT_FOUND && var->size == 0)) {
+			if (!ctx->silent_write_error) {
+				efi_perror(ret, L"EFI variable setting failed");
+				return ret;
+			}
+			debug(L"EFI variable setting failed: %r", ret);
+			debug(L"silent error is on, continue anyway");
+			continue;
+		}
+		stats.written++;
 	}
 
 	return EFI_SUCCESS;
 }
 
+static void free_oemvars(oemvars_ctx_t *ctx)
+{
+	struct oemvar *var, *next;
+
+	for (var = ctx->vars; var; var = next) {
+		next = var->next;
+		FreePool(var->name);
+		FreePool(var);
+	}
+	ctx->vars = NULL;
+	ctx->last = &ctx->vars;
+}
+
 /*
  * GMIN OEM variables are stored as EFI variables. By default, they
  * are under the fastboot GUID.
@@ -287,19 +435,41 @@ static EFI_STATUS parse_line(char *line, VOID *context)
  *   GUID = xxxxxxxx-xxxx-xxxx-xxxx-xxxxxxxxxxxx
  *
  * will change the GUID used for subsequent lines.
+ *
+ * The whole file is parsed before the variables are written in file
+ * order.  Variables which already have the requested value and
+ * attributes are not written again, and when a variable is set
+ * several times only the last value is written, unless it is a time
+ * based authenticated write.
  */
 static EFI_STATUS _flash_oemvars(VOID *data, UINTN size,
 				 const EFI_GUID *restricted_guid,
 				 BOOLEAN silent_error)
 {
+	EFI_STATUS ret;
 	oemvars_ctx_t ctx = {
 		.guid = loader_guid,
 		.restricted_guid = restricted_guid,
 		.silent_write_error = silent_error
 	};
 
+	ctx.last = &ctx.vars;
+	ZeroMem(&stats, sizeof(stats));
+
 	debug(L"Parsing and setting values from oemvars file");
-	return parse_text_buffer(data, size, parse_line, &ctx);
+	ret = parse_text_buffer(data, size, parse_line, &ctx);
+	if (!EFI_ERROR(ret))
+		ret = apply_oemvars(&ctx);
+
+	free_oemvars(&ctx);
+	debug(L"oemvars: %d written, %d unchanged", stats.written, stats.unchanged);
+
+	return ret;
+}
+
+void oemvars_get_stats(struct oemvars_stats *s)
+{
+	*s = stats;
 }
 
 EFI_STATUS flash_oemvars_silent_write_error(VOID *data, UINTN size,
@@ -29,48 +29,318 @@
  */
 
 #include <efi.h>
+#include <lib.h>
+#include "acpi.h"
 #include "log.h"
 #include "pci.h"
 #include "protocol.h"
 
-PCI_DEVICE_PATH* get_pci_device_path(EFI_DEVICE_PATH *p)
+#define PCI_CONFIG_SIZE			4096
+#define PCI_HEADER_TYPE_MASK		0x7F
+#define PCI_HEADER_TYPE_DEVICE		0x00
+#define PCI_HEADER_TYPE_BRIDGE		0x01
+#define PCI_HEADER_MULTI_FUNCTION	0x80
+#define PCI_BRIDGE_BAR			2
+#define PCI_MAX_DEVICE			32
+#define PCI_MAX_FUNCTION		8
+
+#define ECAM_ADDRESS(base, bus, dev, fn) \
+	((base) + ((UINT64)(bus) << 20) + ((dev) << 15) + ((fn) << 12))
+
+/* Standard part of the configuration space header. */
+typedef struct {
+	UINT16 vendor_id;
+	UINT16 device_id;
+	UINT16 command;
+	UINT16 status;
+	UINT8 revision;
+	pci_class_code_t class;
+	UINT8 cache_line_size;
+	UINT8 latency_timer;
+	UINT8 header_type;
+	UINT8 bist;
+	UINT32 bar[PCI_MAX_BAR];
+} __attribute__((packed)) pci_header_t;
+
+static pci_device_t *inventory;
+static UINTN inventory_count, inventory_capacity;
+static BOOLEAN inventory_ready;
+
+static UINT32 location(const pci_device_t *dev)
 {
-	if (!p)
-		return NULL;
+	return (UINT32)dev->segment << 16 | dev->bus << 8 |
+		dev->device << 3 | dev->function;
+}
 
-	while (!IsDevicePathEndType(p)) {
-		if (DevicePathType(p) == HARDWARE_DEVICE_PATH
-		    && DevicePathSubType(p) == HW_PCI_DP)
-			return (PCI_DEVICE_PATH *)p;
-		p = NextDevicePathNode(p);
+static int compare_location(const void *a, const void *b)
+{
+	UINT32 la = location(a), lb = location(b);
+
+	return la < lb ? -1 : la > lb;
+}
+
+static pci_device_t *find_location(UINT32 loc, UINTN count)
+{
+	UINTN low = 0, high = count, mid;
+
+	while (low < high) {
+		mid = low + (high - low) / 2;
+		if (location(&inventory[mid]) == loc)
+			return &inventory[mid];
+		if (location(&inventory[mid]) < loc)
+			low = mid + 1;
+		else
+			high = mid;
 	}
 	return NULL;
 }
 
-EFI_STATUS get_pci_device(IN EFI_DEVICE_PATH *p, OUT EFI_PCI_IO **p_pciio)
+static BOOLEAN is_present(UINT32 id)
+{
+	return id != 0xffffffff && id != 0x00000000 &&
+		id != 0x0000ffff && id != 0xffff0000;
+}
+
+static EFI_STATUS add_device(pci_device_t *dev, pci_header_t *header)
+{
+	pci_device_t *new;
+	UINTN capacity, bars;
+
+	if (inventory_count == inventory_capacity) {
+		capacity = inventory_capacity ? inventory_capacity * 2 : 32;
+		new = ReallocatePool(inventory,
+				     inventory_capacity * sizeof(*inventory),
+				     capacity * sizeof(*inventory));
+		if (!new)
+			return EFI_OUT_OF_RESOURCES;
+		inventory = new;
+		inventory_capacity = capacity;
+	}
+
+	dev->ids.vendor_id = header->vendor_id;
+	dev->ids.device_id = header->device_id;
+	dev->revision = header->revision;
+	dev->class = header->class;
+
+	switch (header->header_type & PCI_HEADER_TYPE_MASK) {
+	case PCI_HEADER_TYPE_DEVICE:
+		bars = PCI_MAX_BAR;
+		break;
+	case PCI_HEADER_TYPE_BRIDGE:
+		bars = PCI_BRIDGE_BAR;
+		break;
+	default:
+		bars = 0;
+	}
+	ZeroMem(dev->bar, sizeof(dev->bar));
+	CopyMem(dev->bar, header->bar, bars * sizeof(*dev->bar));
+
+	inventory[inventory_count++] = *dev;
+	return EFI_SUCCESS;
+}
+
+static void ecam_read(UINT64 addr, VOID *buf, UINTN size)
+{
+	UINTN i;
+
+	for (i = 0; i < size; i += sizeof(UINT32))
+		*(UINT32 *)((UINT8 *)buf + i) =
+			*(volatile UINT32 *)(UINTN)(addr + i);
+}
+
+static EFI_STATUS ecam_enumerate(struct MCFG_TABLE *mcfg)
 {
 	EFI_STATUS ret;
-	EFI_HANDLE pci_handle;
-	EFI_DEVICE_PATH *tmp_path = p;
+	struct MCFG_ALLOCATION *alloc;
+	pci_device_t dev;
+	pci_header_t header;
+	UINTN i, nb, bus, device, function;
+	UINT32 id;
 
-	if (!p || !p_pciio)
-		return EFI_INVALID_PARAMETER;
+	nb = (mcfg->header.length - sizeof(*mcfg)) / sizeof(*alloc);
+	for (i = 0; i < nb; i++) {
+		alloc = &mcfg->allocation[i];
+		for (bus = alloc->start_bus; bus <= alloc->end_bus; bus++) {
+			for (device = 0; device < PCI_MAX_DEVICE; device++) {
+				for (function = 0; function < PCI_MAX_FUNCTION; function++) {
+					ZeroMem(&dev, sizeof(dev));
+					dev.ecam = ECAM_ADDRESS(alloc->base, bus, device, function);
+					ecam_read(dev.ecam, &id, sizeof(id));
+					if (!is_present(id)) {
+						if (function == 0)
+							break;
+						continue;
+					}
 
-	ret = locate_device_path(&PciIoProtocol, &tmp_path, &pci_handle);
-	if (EFI_ERROR(ret)) {
-		efi_perror(ret, L"Failed to locate handle for EFI_PCI_IO_PROTOCOL");
-		return ret;
+					ecam_read(dev.ecam, &header, sizeof(header));
+					dev.segment = alloc->segment;
+					dev.bus = bus;
+					dev.device = device;
+					dev.function = function;
+					ret = add_device(&dev, &header);
+					if (EFI_ERROR(ret))
+						return ret;
+
+					if (function == 0 &&
+					    !(header.header_type & PCI_HEADER_MULTI_FUNCTION))
+						break;
+				}
+			}
+		}
 	}
 
-	ret = handle_protocol(pci_handle, &PciIoProtocol, (void**)p_pciio);
-	if (EFI_ERROR(ret)) {
-		efi_perror(ret, L"Failed to open PciIoProtocol");
+	return EFI_SUCCESS;
+}
+
+/* Binds the EFI_PCI_IO_PROTOCOL handles to the inventory entries,
+ * adding the functions the ECAM windows do not cover.  */
+static EFI_STATUS attach_handles(void)
+{
+	EFI_STATUS ret;
+	EFI_HANDLE *handles;
+	EFI_PCI_IO *pciio;
+	pci_device_t dev, *entry;
+	pci_header_t header;
+	UINTN i, nb_handle = 0, sorted = inventory_count;
+	UINTN segment, bus, device, function;
+
+	ret = uefi_call_wrapper(BS->LocateHandleBuffer, 5, ByProtocol,
+				&PciIoProtocol, NULL, &nb_handle, &handles);
+	if (ret == EFI_NOT_FOUND)
+		return EFI_SUCCESS;
+	if (EFI_ERROR(ret))
 		return ret;
+
+	for (i = 0; i < nb_handle; i++) {
+		ret = handle_protocol(handles[i], &PciIoProtocol, (VOID **)&pciio);
+		if (EFI_ERROR(ret))
+			continue;
+
+		ret = uefi_call_wrapper(pciio->GetLocation, 5, pciio, &segment,
+					&bus, &device, &function);
+		if (EFI_ERROR(ret))
+			continue;
+
+		ZeroMem(&dev, sizeof(dev));
+		dev.segment = segment;
+		dev.bus = bus;
+		dev.device = device;
+		dev.function = function;
+		dev.handle = handles[i];
+		dev.pciio = pciio;
+
+		entry = find_location(location(&dev), sorted);
+		if (entry) {
+			entry->handle = dev.handle;
+			entry->pciio = dev.pciio;
+			continue;
+		}
+
+		ret = uefi_call_wrapper(pciio->Pci.Read, 5, pciio,
+					EfiPciIoWidthUint32, 0,
+					sizeof(header) / sizeof(UINT32), &header);
+		if (EFI_ERROR(ret))
+			continue;
+
+		ret = add_device(&dev, &header);
+		if (EFI_ERROR(ret)) {
+			FreePool(handles);
+			return ret;
+		}
 	}
 
+	FreePool(handles);
+	if (inventory_count != sorted)
+		qsort(inventory, inventory_count, sizeof(*inventory),
+		      compare_location);
 	return EFI_SUCCESS;
 }
 
+EFI_STATUS pci_get_inventory(OUT pci_device_t **devices, OUT UINTN *count)
+{
+	EFI_STATUS ret;
+	struct MCFG_TABLE *mcfg;
+
+	if (!devices || !count)
+		return EFI_INVALID_PARAMETER;
+
+	if (!inventory_ready) {
+		inventory_count = 0;
+		ret = get_acpi_table((CHAR8 *)"MCFG", (VOID **)&mcfg);
+		if (!EFI_ERROR(ret)) {
+			ret = ecam_enumerate(mcfg);
+			if (EFI_ERROR(ret)) {
+				efi_perror(ret, L"Failed to enumerate the PCI devices");
+				return ret;
+			}
+			qsort(inventory, inventory_count, sizeof(*inventory),
+			      compare_location);
+		}
+
+		ret = attach_handles();
+		if (EFI_ERROR(ret)) {
+			efi_perror(ret, L"Failed to bind the PCI handles");
+			return ret;
+		}
+
+		debug(L"%d PCI functions found", inventory_count);
+		inventory_ready = TRUE;
+	}
+
+	*devices = inventory;
+	*count = inventory_count;
+	return EFI_SUCCESS;
+}
+
+pci_device_t *pci_find_device(IN EFI_HANDLE handle)
+{
+	pci_device_t *devices;
+	UINTN i, count;
+
+	if (!handle || EFI_ERROR(pci_get_inventory(&devices, &count)))
+		return NULL;
+
+	for (i = 0; i < count; i++)
+		if (devices[i].handle == handle)
+			return &devices[i];
+
+	return NULL;
+}
+
+EFI_STATUS pci_read_config(IN pci_device_t *dev, IN UINT16 offset,
+			   OUT VOID *buf, IN UINTN size)
+{
+	if (!dev || !buf || offset % sizeof(UINT32) || size % sizeof(UINT32) ||
+	    offset + size > PCI_CONFIG_SIZE)
+		return EFI_INVALID_PARAMETER;
+
+	if (dev->ecam) {
+		ecam_read(dev->ecam + offset, buf, size);
+		return EFI_SUCCESS;
+	}
+
+	if (!dev->pciio)
+		return EFI_UNSUPPORTED;
+
+	return uefi_call_wrapper(dev->pciio->Pci.Read, 5, dev->pciio,
+				 EfiPciIoWidthUint32, offset,
+				 size / sizeof(UINT32), buf);
+}
+
+PCI_DEVICE_PATH* get_pci_device_path(EFI_DEVICE_PATH *p)
+{
+	if (!p)
+		return NULL;
+
+	while (!IsDevicePathEndType(p)) {
+		if (DevicePathType(p) == HARDWARE_DEVICE_PATH
+		    && DevicePathSubType(p) == HW_PCI_DP)
+			return (PCI_DEVICE_PATH *)p;
+		p = NextDevicePathNode(p);
+	}
+	return NULL;
+}
+
 EFI_STATUS get_pci_ids(IN EFI_PCI_IO *pciio, OUT pci_device_ids_t *ids)
 {
 	if (!pciio || !ids)
@@ -79,3 +349,12 @@ EFI_STATUS get_pci_ids(IN EFI_PCI_IO *pciio, OUT pci_device_ids_t *ids)
 	return uefi_call_wrapper(pciio->Pci.Read, 5, pciio, EfiPciIoWidthUint16,
 				 0, 2, ids);
 }
+
+EFI_STATUS get_pci_class(IN EFI_PCI_IO *pciio, OUT pci_class_code_t *class)
+{
+	if (!pciio || !class)
+		return EFI_INVALID_PARAMETER;
+
+	return uefi_call_wrapper(pciio->Pci.Read, 5, pciio, EfiPciIoWidthUint8,
+				 0x09, sizeof(*class), class);
+}
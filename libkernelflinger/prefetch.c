@@ -0,0 +1,215 @@
+/*
+ * Copyright (c) 2020, Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#include <efi.h>
+#include <efilib.h>
+#include <lib.h>
+
+#include "vars.h"
+#include "gpt.h"
+#include "gpt_bin.h"
+#include "timer.h"
+#include "prefetch.h"
+
+#define PREFETCH_MAX_RANGES	32
+#define PREFETCH_LABEL_LEN	36
+/* Reads closer than this are merged in a single range */
+#define PREFETCH_MERGE_GAP	(64 * 1024)
+#define PREFETCH_MAX_BYTES	(256 * MiB)
+
+struct prefetch_range {
+	CHAR16 label[PREFETCH_LABEL_LEN];
+	UINT64 offset;
+	UINT64 length;
+};
+
+static struct prefetch_range trace[PREFETCH_MAX_RANGES];
+static UINTN trace_count;
+
+static struct prefetch_range *plan;
+static VOID *plan_data[PREFETCH_MAX_RANGES];
+static UINTN plan_count;
+
+void prefetch_record(const CHAR16 *label, UINT64 offset, UINT64 length)
+{
+	struct prefetch_range *r;
+	UINT64 end = offset + length;
+	UINTN i;
+
+	for (i = 0; i < trace_count; i++) {
+		r = &trace[i];
+		if (StrCmp(r->label, (CHAR16 *)label) ||
+		    offset > r->offset + r->length + PREFETCH_MERGE_GAP ||
+		    end + PREFETCH_MERGE_GAP < r->offset)
+			continue;
+
+		end = max(end, r->offset + r->length);
+		r->offset = min(r->offset, offset);
+		r->length = end - r->offset;
+		return;
+	}
+
+	if (trace_count == PREFETCH_MAX_RANGES ||
+	    StrLen(label) >= PREFETCH_LABEL_LEN)
+		return;
+
+	r = &trace[trace_count++];
+	ZeroMem(r, sizeof(*r));
+	StrCpy(r->label, (CHAR16 *)label);
+	r->offset = offset;
+	r->length = length;
+}
+
+static EFI_STATUS prefetch_range(struct prefetch_range *r, VOID **data)
+{
+	EFI_STATUS ret;
+	struct gpt_partition_interface gpart;
+	UINT64 part_size;
+
+	r->label[PREFETCH_LABEL_LEN - 1] = 0;
+	ret = gpt_get_partition_by_label(r->label, &gpart, LOGICAL_UNIT_USER);
+	if (EFI_ERROR(ret))
+		return ret;
+
+	part_size = (gpart.part.ending_lba - gpart.part.starting_lba + 1) *
+		gpart.bio->Media->BlockSize;
+	if (r->offset > part_size || r->length > part_size - r->offset)
+		return EFI_INVALID_PARAMETER;
+
+	*data = AllocatePool(r->length);
+	if (!*data)
+		return EFI_OUT_OF_RESOURCES;
+
+	ret = uefi_call_wrapper(gpart.dio->ReadDisk, 5, gpart.dio,
+				gpart.bio->Media->MediaId,
+				gpart.part.starting_lba * gpart.bio->Media->BlockSize +
+				r->offset, r->length, *data);
+	if (EFI_ERROR(ret)) {
+		FreePool(*data);
+		*data = NULL;
+	}
+
+	return ret;
+}
+
+EFI_STATUS prefetch_start(void)
+{
+	EFI_STATUS ret;
+	UINTN size, i;
+	UINT64 total = 0;
+	uint32_t start;
+
+	prefetch_free();
+
+	ret = get_efi_variable(&loader_guid, PREFETCH_PLAN_VAR, &size,
+			       (VOID **)&plan, NULL);
+	if (EFI_ERROR(ret))
+		return ret;
+
+	if (size % sizeof(*plan) || size / sizeof(*plan) > PREFETCH_MAX_RANGES) {
+		error(L"Invalid prefetch plan");
+		prefetch_free();
+		return EFI_COMPROMISED_DATA;
+	}
+	plan_count = size / sizeof(*plan);
+
+	start = boottime_in_msec();
+	for (i = 0; i < plan_count; i++) {
+		if (plan[i].length > PREFETCH_MAX_BYTES - total)
+			continue;
+
+		ret = prefetch_range(&plan[i], &plan_data[i]);
+		if (EFI_ERROR(ret)) {
+			debug(L"Failed to prefetch %s, %r", plan[i].label, ret);
+			continue;
+		}
+		total += plan[i].length;
+	}
+
+	debug(L"Prefetched %ld bytes in %d ms", total, boottime_in_msec() - start);
+	return EFI_SUCCESS;
+}
+
+BOOLEAN prefetch_read(const CHAR16 *label, UINT64 offset, UINTN size, VOID *buf)
+{
+	struct prefetch_range *r;
+	UINTN i;
+
+	for (i = 0; i < plan_count; i++) {
+		r = &plan[i];
+		if (!plan_data[i] || StrCmp(r->label, (CHAR16 *)label) ||
+		    offset < r->offset || offset - r->offset > r->length ||
+		    size > r->length - (offset - r->offset))
+			continue;
+
+		return !EFI_ERROR(memcpy_s(buf, size,
+					   (CHAR8 *)plan_data[i] + (offset - r->offset),
+					   size));
+	}
+
+	return FALSE;
+}
+
+EFI_STATUS prefetch_save(void)
+{
+	EFI_STATUS ret;
+
+	if (!trace_count)
+		return EFI_SUCCESS;
+
+	if (plan && plan_count == trace_count &&
+	    !memcmp(plan, trace, trace_count * sizeof(*trace)))
+		return EFI_SUCCESS;
+
+	ret = set_efi_variable(&loader_guid, PREFETCH_PLAN_VAR,
+			       trace_count * sizeof(*trace), trace, TRUE, FALSE);
+	if (EFI_ERROR(ret))
+		efi_perror(ret, L"Failed to save the prefetch plan");
+
+	return ret;
+}
+
+void prefetch_free(void)
+{
+	UINTN i;
+
+	for (i = 0; i < plan_count; i++)
+		if (plan_data[i]) {
+			FreePool(plan_data[i]);
+			plan_data[i] = NULL;
+		}
+
+	if (plan) {
+		FreePool(plan);
+		plan = NULL;
+	}
+	plan_count = 0;
+}
@@ -36,6 +36,7 @@
 #include <android.h>
 #include <slot.h>
 #include <endian.h>
+#include <misc_cache.h>
 
 /* Constants.  */
 const CHAR16 *SLOT_STORAGE_PART = MISC_LABEL;
@@ -116,21 +117,12 @@ static UINTN get_part_nb_slot(const CHAR16 *label)
 
 static inline EFI_STATUS sync_boot_ctrl(BOOLEAN out)
 {
-	EFI_STATUS ret;
-	struct gpt_partition_interface gparti;
-	UINT64 offset;
-
-	ret = gpt_get_partition_by_label(SLOT_STORAGE_PART, &gparti, LOGICAL_UNIT_USER);
-	if (EFI_ERROR(ret))
-		return ret;
+	UINTN offset = offsetof(struct bootloader_message_ab, slot_suffix);
 
-	offset = gparti.part.starting_lba * gparti.bio->Media->BlockSize +
-		offsetof(struct bootloader_message_ab, slot_suffix);
+	if (out)
+		return misc_cache_read(offset, &boot_ctrl, sizeof(boot_ctrl));
 
-	return uefi_call_wrapper((out ? gparti.dio->ReadDisk : gparti.dio->WriteDisk),
-				 5, gparti.dio,
-				 gparti.bio->Media->MediaId,
-				 offset, sizeof(boot_ctrl), &boot_ctrl);
+	return misc_cache_write(offset, &boot_ctrl, sizeof(boot_ctrl));
 }
 
 static EFI_STATUS read_boot_ctrl(void)
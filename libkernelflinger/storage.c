@@ -35,6 +35,8 @@
 #include "storage.h"
 #include "gpt.h"
 #include "pci.h"
+#include "vars.h"
+#include "uefi_utils.h"
 #include "protocol/EraseBlock.h"
 #include "timer.h"
 
@@ -48,6 +50,18 @@ static EFI_DEVICE_PATH *exclude_device = NULL;
 // It maybe a handle to a partition of the kernelflinger loaded.
 static EFI_HANDLE boot_device_handle;
 
+/* Boot device selected by a previous boot: the storage type and the
+ * device path of the disk of the user logical unit.  */
+struct boot_device_hint {
+	UINT32 type;
+	UINT8 path[];
+};
+
+// The disk described by the boot device hint variable.
+static EFI_HANDLE hint_disk;
+// The hint is only maintained when the boot device is looked up.
+static BOOLEAN hint_enabled;
+
 static BOOLEAN is_boot_device(EFI_DEVICE_PATH *p)
 {
 	PCI_DEVICE_PATH *pci;
@@ -143,6 +157,122 @@ BOOLEAN is_same_device(EFI_DEVICE_PATH *p, EFI_DEVICE_PATH *e)
 	return TRUE;
 }
 
+static BOOLEAN is_same_pci_device(PCI_DEVICE_PATH *a, PCI_DEVICE_PATH *b)
+{
+	return a->Function == b->Function && a->Device == b->Device &&
+		a->Header.Type == b->Header.Type &&
+		a->Header.SubType == b->Header.SubType;
+}
+
+/* The hint can only be trusted if no other PCI device exposes a disk.
+ * Otherwise, the storage type priority and the ambiguity check of
+ * identify_boot_device() must decide as they would on a cold boot. */
+static BOOLEAN is_single_candidate(PCI_DEVICE_PATH *hint_pci)
+{
+	EFI_STATUS ret;
+	EFI_HANDLE *handles;
+	UINTN nb_handle = 0;
+	UINTN i;
+	EFI_DEVICE_PATH *device_path;
+	PCI_DEVICE_PATH *pci;
+	EFI_BLOCK_IO *bio;
+	BOOLEAN single = TRUE;
+
+	ret = uefi_call_wrapper(BS->LocateHandleBuffer, 5, ByProtocol,
+				&BlockIoProtocol, NULL, &nb_handle, &handles);
+	if (EFI_ERROR(ret))
+		return FALSE;
+
+	for (i = 0; i < nb_handle && single; i++) {
+		device_path = DevicePathFromHandle(handles[i]);
+		if (!device_path)
+			continue;
+
+		pci = get_pci_device_path(device_path);
+		if (!pci || is_same_device(device_path, exclude_device))
+			continue;
+
+		ret = uefi_call_wrapper(BS->HandleProtocol, 3, handles[i],
+					&BlockIoProtocol, (VOID **)&bio);
+		if (EFI_ERROR(ret) || bio->Media->LogicalPartition)
+			continue;
+
+		single = is_same_pci_device(pci, hint_pci);
+	}
+
+	FreePool(handles);
+	return single;
+}
+
+static EFI_STATUS identify_boot_device_from_hint(void)
+{
+	EFI_STATUS ret;
+	struct boot_device_hint *hint;
+	EFI_DEVICE_PATH *path, *device_path;
+	EFI_HANDLE handle;
+	PCI_DEVICE_PATH *pci;
+	struct storage *storage;
+	enum storage_type type;
+	UINTN size;
+
+	ret = get_efi_variable(&loader_guid, BOOT_DEVICE_HINT_VAR, &size,
+			       (VOID **)&hint, NULL);
+	if (EFI_ERROR(ret))
+		return ret;
+
+	ret = EFI_NOT_FOUND;
+	if (size <= sizeof(*hint) || hint->type >= STORAGE_ALL)
+		goto out;
+
+	path = (EFI_DEVICE_PATH *)hint->path;
+	size -= sizeof(*hint);
+	if (uefi_device_path_size(path, size) != size)
+		goto out;
+
+	ret = uefi_call_wrapper(BS->LocateDevicePath, 3, &BlockIoProtocol,
+				&path, &handle);
+	if (EFI_ERROR(ret) || !IsDevicePathEnd(path)) {
+		ret = EFI_NOT_FOUND;
+		goto out;
+	}
+
+	device_path = DevicePathFromHandle(handle);
+	pci = get_pci_device_path(device_path);
+	if (!pci || is_same_device(device_path, exclude_device)) {
+		ret = EFI_NOT_FOUND;
+		goto out;
+	}
+
+	if (!is_single_candidate(pci)) {
+		debug(L"Several storage devices, boot device hint ignored");
+		ret = EFI_NOT_FOUND;
+		goto out;
+	}
+
+	/* Same type selection as the full scan */
+	ret = identify_storage(device_path, STORAGE_ALL, &storage, &type);
+	if (EFI_ERROR(ret))
+		goto out;
+	if (type != hint->type) {
+		ret = EFI_NOT_FOUND;
+		goto out;
+	}
+
+	ret = memcpy_s(&boot_device, sizeof(boot_device), pci, sizeof(*pci));
+	if (EFI_ERROR(ret))
+		goto out;
+
+	cur_storage = storage;
+	boot_device_type = type;
+	boot_device_handle = handle;
+	hint_disk = handle;
+	debug(L"%s storage selected from the boot device hint", cur_storage->name);
+
+out:
+	FreePool(hint);
+	return ret;
+}
+
 EFI_STATUS identify_boot_device(enum storage_type filter)
 {
 	EFI_STATUS ret;
@@ -157,6 +287,12 @@ EFI_STATUS identify_boot_device(enum storage_type filter)
 	PCI_DEVICE_PATH new_boot_device = { .Function = -1, .Device = -1 };
 	enum storage_type new_boot_device_type;
 	struct storage *new_storage;
+	EFI_BLOCK_IO *bio;
+
+	hint_disk = NULL;
+	hint_enabled = filter == STORAGE_ALL && !exclude_device;
+	if (hint_enabled && !EFI_ERROR(identify_boot_device_from_hint()))
+		return EFI_SUCCESS;
 
 	new_storage = NULL;
 	ret = uefi_call_wrapper(BS->LocateHandleBuffer, 5, ByProtocol,
@@ -179,10 +315,13 @@ EFI_STATUS identify_boot_device(enum storage_type filter)
 		if (is_same_device(device_path, exclude_device))
 			continue;
 
-		if (new_boot_device.Function == pci->Function &&
-				new_boot_device.Device == pci->Device &&
-				new_boot_device.Header.Type == pci->Header.Type &&
-				new_boot_device.Header.SubType == pci->Header.SubType)
+		/* Partitions belong to the device of their parent disk. */
+		ret = uefi_call_wrapper(BS->HandleProtocol, 3, handles[i],
+					&BlockIoProtocol, (VOID **)&bio);
+		if (EFI_ERROR(ret) || bio->Media->LogicalPartition)
+			continue;
+
+		if (is_same_pci_device(&new_boot_device, pci))
 			continue;
 
 		ret = identify_storage(device_path, filter, &storage, &type);
@@ -239,15 +378,12 @@ static BOOLEAN valid_storage(void)
 	return boot_device.Header.Type && cur_storage;
 }
 
-static EFI_STATUS media_erase_blocks(EFI_HANDLE handle, EFI_BLOCK_IO *bio, EFI_LBA start, EFI_LBA end)
+static EFI_STATUS get_erase_block_protocol(EFI_HANDLE handle, EFI_ERASE_BLOCK_PROTOCOL **erase_blockp)
 {
 	EFI_DEVICE_PATH *dev_path;
 	EFI_GUID guid = EFI_ERASE_BLOCK_PROTOCOL_GUID;
-	EFI_ERASE_BLOCK_PROTOCOL *erase_blockp;
-	UINTN size, erase_granularity;
 	EFI_STATUS ret;
 	EFI_HANDLE storage_handle = NULL;
-	EFI_LBA left;
 
 	dev_path = DevicePathFromHandle(handle);
 	if (!dev_path) {
@@ -261,10 +397,24 @@ static EFI_STATUS media_erase_blocks(EFI_HANDLE handle, EFI_BLOCK_IO *bio, EFI_L
 		return EFI_UNSUPPORTED;
 
 	ret = uefi_call_wrapper(BS->HandleProtocol, 3,
-			storage_handle, &guid, (void **)&erase_blockp);
+			storage_handle, &guid, (void **)erase_blockp);
 	if (EFI_ERROR(ret))
 		return EFI_UNSUPPORTED;
 
+	return EFI_SUCCESS;
+}
+
+static EFI_STATUS media_erase_blocks(EFI_HANDLE handle, EFI_BLOCK_IO *bio, EFI_LBA start, EFI_LBA end)
+{
+	EFI_ERASE_BLOCK_PROTOCOL *erase_blockp;
+	UINTN size, erase_granularity;
+	EFI_STATUS ret;
+	EFI_LBA left;
+
+	ret = get_erase_block_protocol(handle, &erase_blockp);
+	if (EFI_ERROR(ret))
+		return ret;
+
 	erase_granularity = erase_blockp->EraseLengthGranularity;
 
 	/* check if space to be erased is lesser than group size
@@ -335,8 +485,38 @@ EFI_STATUS storage_erase_blocks(EFI_HANDLE handle, EFI_BLOCK_IO *bio, EFI_LBA st
 	return cur_storage->erase_blocks(handle, bio, start, end);
 }
 
-EFI_STATUS fill_with(EFI_BLOCK_IO *bio, EFI_LBA start, EFI_LBA end,
-			    VOID *pattern, UINTN pattern_blocks)
+EFI_STATUS storage_discard_blocks(EFI_HANDLE handle, EFI_BLOCK_IO *bio, EFI_LBA start, EFI_LBA end)
+{
+	EFI_ERASE_BLOCK_PROTOCOL *erase_blockp;
+	UINTN erase_granularity;
+	EFI_STATUS ret;
+
+	ret = get_erase_block_protocol(handle, &erase_blockp);
+	if (EFI_ERROR(ret))
+		return ret;
+
+	/* Only the erase groups fully covered by the range can be
+	 * discarded, the partial ones are left untouched. */
+	erase_granularity = erase_blockp->EraseLengthGranularity;
+	if (erase_granularity == 0)
+		return EFI_UNSUPPORTED;
+
+	start = (start + erase_granularity - 1) / erase_granularity * erase_granularity;
+	end = (end + 1) / erase_granularity * erase_granularity;
+	if (end <= start)
+		return EFI_SUCCESS;
+
+	ret = uefi_call_wrapper(erase_blockp->EraseBlocks, 5, erase_blockp, bio->Media->MediaId,
+			start, NULL, (end - start) * bio->Media->BlockSize);
+	if (EFI_ERROR(ret))
+		error(L"EFI_ERASE_BLOCK_PROTOCOL failed to discard blocks");
+
+	return ret;
+}
+
+static EFI_STATUS fill_with_generator(EFI_BLOCK_IO *bio, EFI_LBA start, EFI_LBA end,
+				      VOID *pattern, UINTN pattern_blocks,
+				      EFI_STATUS (*generate)(CHAR8 *data, UINTN size))
 {
 	EFI_LBA lba;
 	UINT64 size;
@@ -357,6 +537,14 @@ EFI_STATUS fill_with(EFI_BLOCK_IO *bio, EFI_LBA start, EFI_LBA end,
 		else
 			size = pattern_blocks;
 
+		if (generate) {
+			ret = generate(pattern, bio->Media->BlockSize * size);
+			if (EFI_ERROR(ret)) {
+				efi_perror(ret, L"Failed to generate the pattern");
+				return ret;
+			}
+		}
+
 		ret = uefi_call_wrapper(bio->WriteBlocks, 5, bio, bio->Media->MediaId, lba,
 				bio->Media->BlockSize * size, pattern);
 		if (EFI_ERROR(ret)) {
@@ -372,6 +560,22 @@ EFI_STATUS fill_with(EFI_BLOCK_IO *bio, EFI_LBA start, EFI_LBA end,
 	return EFI_SUCCESS;
 }
 
+EFI_STATUS fill_with(EFI_BLOCK_IO *bio, EFI_LBA start, EFI_LBA end,
+		     VOID *pattern, UINTN pattern_blocks)
+{
+	return fill_with_generator(bio, start, end, pattern, pattern_blocks, NULL);
+}
+
+EFI_STATUS fill_with_random(EFI_BLOCK_IO *bio, EFI_LBA start, EFI_LBA end,
+			    VOID *buffer, UINTN buffer_blocks,
+			    EFI_STATUS (*generate)(CHAR8 *data, UINTN size))
+{
+	if (!generate)
+		return EFI_INVALID_PARAMETER;
+
+	return fill_with_generator(bio, start, end, buffer, buffer_blocks, generate);
+}
+
 EFI_STATUS fill_zero(EFI_BLOCK_IO *bio, EFI_LBA start, EFI_LBA end)
 {
 	EFI_STATUS ret;
@@ -391,7 +595,7 @@ EFI_STATUS fill_zero(EFI_BLOCK_IO *bio, EFI_LBA start, EFI_LBA end)
 	return ret;
 }
 
-EFI_STATUS storage_set_boot_device(EFI_HANDLE device)
+static EFI_STATUS set_boot_device(EFI_HANDLE device, enum storage_type filter)
 {
 	EFI_DEVICE_PATH *device_path  = DevicePathFromHandle(device);
 	PCI_DEVICE_PATH *pci;
@@ -409,7 +613,7 @@ EFI_STATUS storage_set_boot_device(EFI_HANDLE device)
 		return EFI_UNSUPPORTED;
 	}
 
-	ret = identify_storage(device_path, STORAGE_ALL, &cur_storage,
+	ret = identify_storage(device_path, filter, &cur_storage,
 			       &boot_device_type);
 	if (EFI_ERROR(ret)) {
 		error(L"Boot device unsupported");
@@ -428,11 +632,62 @@ EFI_STATUS storage_set_boot_device(EFI_HANDLE device)
 	return EFI_SUCCESS;
 }
 
+EFI_STATUS storage_set_boot_device(EFI_HANDLE device)
+{
+	return set_boot_device(device, STORAGE_ALL);
+}
+
+EFI_STATUS storage_adopt_boot_device(EFI_HANDLE device, enum storage_type type)
+{
+	if (type >= STORAGE_ALL)
+		return EFI_INVALID_PARAMETER;
+
+	return set_boot_device(device, type);
+}
+
 EFI_HANDLE get_boot_device_handle(void)
 {
 	return boot_device_handle;
 }
 
+EFI_HANDLE storage_get_boot_device_hint(void)
+{
+	return hint_disk;
+}
+
+void storage_save_boot_device_hint(EFI_HANDLE disk)
+{
+	EFI_STATUS ret;
+	EFI_DEVICE_PATH *path;
+	struct boot_device_hint *hint;
+	UINTN path_size, size;
+
+	if (!hint_enabled || disk == hint_disk || !cur_storage)
+		return;
+
+	path = DevicePathFromHandle(disk);
+	if (!path)
+		return;
+
+	path_size = DevicePathSize(path);
+	size = sizeof(*hint) + path_size;
+	hint = AllocatePool(size);
+	if (!hint)
+		return;
+
+	hint->type = boot_device_type;
+	ret = memcpy_s(hint->path, path_size, path, path_size);
+	if (!EFI_ERROR(ret))
+		ret = set_efi_variable(&loader_guid, BOOT_DEVICE_HINT_VAR,
+				       size, hint, TRUE, FALSE);
+	if (EFI_ERROR(ret))
+		efi_perror(ret, L"Failed to save the boot device hint");
+	else
+		hint_disk = disk;
+
+	FreePool(hint);
+}
+
 const char *get_boot_device_var(void)
 {
 	static char boot_device_var[64]; // MAX_VARIABLE_LENGTH
@@ -91,13 +91,24 @@ uint32_t get_cpu_freq(void)
 	return cpu_freq;
 }
 
+/* The frequency does not change, read the MSR only once */
+static uint32_t get_cached_cpu_freq(void)
+{
+	static uint32_t cpu_freq;
+
+	if (cpu_freq == 0)
+		cpu_freq = get_cpu_freq();
+
+	return cpu_freq;
+}
+
 uint32_t boottime_in_msec(void)
 {
 	uint64_t tick;
 	uint32_t bt_us, bt_ms;
 	uint32_t cpu_freq;
 
-	cpu_freq = get_cpu_freq();
+	cpu_freq = get_cached_cpu_freq();
 	if (cpu_freq == 0) {
 		 time_stamp = FALSE;
 		 return 0;
@@ -110,6 +121,25 @@ uint32_t boottime_in_msec(void)
 	return bt_ms;
 }
 
+uint64_t boottime_in_usec(void)
+{
+	static uint32_t mult;
+	uint32_t cpu_freq;
+
+	/* tick / cpu_freq is computed as a multiplication by the 2^32
+	   scaled inverse of the frequency, without any 64 bits
+	   division.  The tick is shifted first so that the product
+	   does not overflow for days.  */
+	if (mult == 0) {
+		cpu_freq = get_cached_cpu_freq();
+		if (cpu_freq == 0)
+			return 0;
+		mult = 0xFFFFFFFFU / cpu_freq;
+	}
+
+	return ((__RDTSC() >> 10) * mult) >> 22;
+}
+
 void set_boottime_stamp(int num)
 {
 	if ((num < 0) || (num >= TM_POINT_LAST) || (time_stamp == FALSE))
@@ -554,6 +554,7 @@ EFI_STATUS uefi_enter_binary(EFI_HANDLE part_handle, CHAR16 *path,
 		loaded_image->LoadOptionsSize = load_options_size;
 		loaded_image->LoadOptions = load_options;
 	}
+
 	ret = uefi_call_wrapper(BS->StartImage, 3, image, NULL, NULL);
 
 out:
@@ -687,3 +688,24 @@ EFI_STATUS uefi_check_upgrade(EFI_LOADED_IMAGE *loaded_image,
 out:
 	return ret;
 }
+
+UINTN uefi_device_path_size(EFI_DEVICE_PATH *path, UINTN max_size)
+{
+	EFI_DEVICE_PATH *node = path;
+	UINTN size = 0, len;
+
+	for (;;) {
+		if (max_size - size < sizeof(*node))
+			return 0;
+
+		len = DevicePathNodeLength(node);
+		if (len < sizeof(*node) || len > max_size - size)
+			return 0;
+
+		size += len;
+		if (IsDevicePathEnd(node))
+			return size;
+
+		node = NextDevicePathNode(node);
+	}
+}
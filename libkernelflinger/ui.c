@@ -36,6 +36,9 @@
 #include <efilib.h>
 #include <lib.h>
 #include <ui.h>
+#include <upng.h>
+
+#include "mp.h"
 
 #define NOT_READY_USECS	(100 * 1000)
 
@@ -183,9 +186,28 @@ EFI_STATUS ui_init(UINTN *width_p, UINTN *height_p)
 	return EFI_SUCCESS;
 }
 
+static void vendor_splash_geometry(UINTN img_width, UINTN img_height,
+				   UINTN *x, UINTN *y,
+				   UINTN *width, UINTN *height)
+{
+	UINTN max_size;
+
+	max_size = min(graphic.width, graphic.height) / 3;
+	if (img_width > img_height) {
+		*width = max_size;
+		*height = img_height * *width / img_width;
+	} else {
+		*height = max_size;
+		*width = img_width * *height / img_height;
+	}
+
+	*x = (graphic.width / 2) - (*width / 2);
+	*y = (graphic.height / 2) - (*height / 2);
+}
+
 EFI_STATUS ui_display_vendor_splash(VOID)
 {
-	UINTN width, height, x, y, max_size;
+	UINTN width, height, x, y;
 	ui_image_t *vendor;
 
 	if (!ui_is_ready())
@@ -207,19 +229,144 @@ EFI_STATUS ui_display_vendor_splash(VOID)
 		return EFI_UNSUPPORTED;
 	}
 
-	max_size = min(graphic.width, graphic.height) / 3;
-	if (vendor->width > vendor->height) {
-		width = max_size;
-		height = vendor->height * width / vendor->width;
-	} else {
-		height = max_size;
-		width = vendor->width * height / vendor->height;
+	vendor_splash_geometry(vendor->width, vendor->height,
+			       &x, &y, &width, &height);
+
+	return ui_image_draw_scale(vendor, x, y , width, height);
+}
+
+static struct vendor_splash {
+	ui_image_t *image;
+	upng_job_t *job;
+	EFI_GRAPHICS_OUTPUT_BLT_PIXEL *blt;
+	EFI_GRAPHICS_OUTPUT_BLT_PIXEL *scaled;
+	UINTN width, height;
+	UINTN x, y, dst_width, dst_height;
+	EFI_STATUS status;
+	EFI_EVENT done;
+} splash;
+
+/* Runs on an application processor: no EFI service can be used. */
+static VOID EFIAPI vendor_splash_decode(VOID *arg)
+{
+	struct vendor_splash *s = arg;
+
+	s->status = upng_finish(s->job, &s->blt);
+	if (EFI_ERROR(s->status) || !s->scaled)
+		return;
+
+	ui_bilinear_scale((unsigned char *)s->blt, (unsigned char *)s->scaled,
+			  s->width, s->height, s->dst_width, s->dst_height,
+			  sizeof(EFI_GRAPHICS_OUTPUT_BLT_PIXEL));
+}
+
+EFI_STATUS ui_vendor_splash_start(VOID)
+{
+	EFI_STATUS ret;
+	UINTN width, height;
+	ui_image_t *vendor;
+
+	if (!ui_is_ready())
+		return EFI_UNSUPPORTED;
+
+	vendor = ui_image_find(VENDOR_IMG_NAME);
+	if (!vendor) {
+		efi_perror(EFI_UNSUPPORTED, L"Unable to get '%a' image",
+			   VENDOR_IMG_NAME);
+		return EFI_UNSUPPORTED;
 	}
 
-	x = (graphic.width / 2) - (width / 2);
-	y = (graphic.height / 2) - (height / 2);
+	/* Already decoded, nothing to overlap */
+	if (vendor->blt)
+		return ui_display_vendor_splash();
 
-	return ui_image_draw_scale(vendor, x, y , width, height);
+	ret = upng_prepare((const char *)vendor->data, vendor->size,
+			   &splash.job, &splash.width, &splash.height);
+	if (EFI_ERROR(ret)) {
+		efi_perror(ret, L"Failed to load image %a", VENDOR_IMG_NAME);
+		return ret;
+	}
+
+	if (!splash.width || !splash.height) {
+		efi_perror(EFI_UNSUPPORTED, L"'%a' image has invalid dimensions",
+			   VENDOR_IMG_NAME);
+		ret = EFI_UNSUPPORTED;
+		goto err;
+	}
+
+	splash.image = vendor;
+	vendor_splash_geometry(splash.width, splash.height,
+			       &splash.x, &splash.y, &width, &height);
+	ui_get_scaled_dimension(splash.width, splash.height, width, height,
+				&splash.dst_width, &splash.dst_height);
+	if (splash.dst_width != splash.width ||
+	    splash.dst_height != splash.height) {
+		splash.scaled = AllocatePool(ui_get_blt_size(splash.dst_width,
+							     splash.dst_height));
+		if (!splash.scaled) {
+			ret = EFI_OUT_OF_RESOURCES;
+			efi_perror(ret, L"Failed to allocate buffer");
+			goto err;
+		}
+	}
+
+	ui_clear_screen();
+
+	ret = mp_start_on_ap(vendor_splash_decode, &splash, &splash.done);
+	if (EFI_ERROR(ret)) {
+		debug(L"Decoding the vendor splash on the BSP, %r", ret);
+		vendor_splash_decode(&splash);
+	}
+
+	return EFI_SUCCESS;
+
+err:
+	upng_job_free(splash.job);
+	ZeroMem(&splash, sizeof(splash));
+	return ret;
+}
+
+EFI_STATUS ui_vendor_splash_finish(VOID)
+{
+	EFI_STATUS ret;
+	UINTN index;
+
+	if (!splash.job)
+		return EFI_NOT_STARTED;
+
+	if (splash.done) {
+		ret = uefi_call_wrapper(BS->WaitForEvent, 3, 1, &splash.done, &index);
+		uefi_call_wrapper(BS->CloseEvent, 1, splash.done);
+		if (EFI_ERROR(ret)) {
+			/* The AP may still use the buffers, leave them */
+			efi_perror(ret, L"Failed to wait for the vendor splash");
+			ZeroMem(&splash, sizeof(splash));
+			return ret;
+		}
+	}
+
+	upng_job_free(splash.job);
+	ret = splash.status;
+	if (EFI_ERROR(ret)) {
+		efi_perror(ret, L"Failed to load image %a", VENDOR_IMG_NAME);
+		goto out;
+	}
+
+	/* Keep the decoded image for the next displays */
+	splash.image->blt = splash.blt;
+	splash.image->width = splash.width;
+	splash.image->height = splash.height;
+
+	ret = ui_draw_blt(splash.scaled ? splash.scaled : splash.blt,
+			  splash.x, splash.y, splash.dst_width, splash.dst_height);
+	if (EFI_ERROR(ret))
+		efi_perror(ret, L"Failed to display image %a", VENDOR_IMG_NAME);
+
+out:
+	if (splash.scaled)
+		FreePool(splash.scaled);
+	ZeroMem(&splash, sizeof(splash));
+	return ret;
 }
 
 void ui_free(void)
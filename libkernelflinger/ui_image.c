@@ -40,19 +40,26 @@
 
 #include "res/img_res.h"
 
-ui_image_t *ui_image_get(const char *name)
+ui_image_t *ui_image_find(const char *name)
 {
 	unsigned int i;
-	EFI_STATUS ret;
-	ui_image_t *img = NULL;
 
 	for (i = 0 ; i < ARRAY_SIZE(ui_images) ; i++)
 		if (!strcmp((CHAR8 *)ui_images[i].name, (CHAR8 *)name))
-			break;
-	if (i == ARRAY_SIZE(ui_images))
+			return &ui_images[i];
+
+	return NULL;
+}
+
+ui_image_t *ui_image_get(const char *name)
+{
+	EFI_STATUS ret;
+	ui_image_t *img;
+
+	img = ui_image_find(name);
+	if (!img)
 		return NULL;
 
-	img = &ui_images[i];
 	if (!img->blt) {
 		ret = upng_load(img->data, img->size,
 				&img->blt, &img->width, &img->height);
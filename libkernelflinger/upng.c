@@ -1119,15 +1119,22 @@ static EFI_STATUS upng_header(upng_t* upng)
 	return upng->error;
 }
 
-/* Read a PNG, the result will be in the same color type as the PNG
- * (hence "generic") */
-static EFI_STATUS upng_decode(upng_t* upng)
+struct upng_job {
+	upng_t upng;
+	unsigned char *compressed;
+	unsigned long compressed_size;
+	unsigned char *inflated;
+	unsigned long inflated_size;
+};
+
+/* Parse a PNG and allocate all the buffers needed to decode it, the
+ * result will be in the same color type as the PNG (hence
+ * "generic") */
+static EFI_STATUS upng_decode_prepare(struct upng_job *job)
 {
+	upng_t *upng = &job->upng;
 	const unsigned char *chunk;
-	unsigned char* compressed;
-	unsigned char* inflated;
 	unsigned long compressed_size = 0, compressed_index = 0;
-	unsigned long inflated_size;
 	EFI_STATUS error;
 
 	/* If we have an error state, bail now */
@@ -1204,8 +1211,8 @@ static EFI_STATUS upng_decode(upng_t* upng)
 
 	/* Allocate enough space for the (compressed and filtered)
 	 * image data */
-	compressed = (unsigned char*)AllocatePool(compressed_size);
-	if (compressed == NULL) {
+	job->compressed = (unsigned char*)AllocatePool(compressed_size);
+	if (job->compressed == NULL) {
 		SET_ERROR(upng, EFI_OUT_OF_RESOURCES);
 		return upng->error;
 	}
@@ -1223,10 +1230,10 @@ static EFI_STATUS upng_decode(upng_t* upng)
 
 		/* Parse chunks */
 		if (upng_chunk_type(chunk) == CHUNK_IDAT) {
-			error = memcpy_s(compressed + compressed_index, compressed_size, data, length);
+			error = memcpy_s(job->compressed + compressed_index, compressed_size, data, length);
 			if (EFI_ERROR(error)) {
-				FreePool(compressed);
-			    return error;
+				SET_ERROR(upng, error);
+				return error;
 			}
 			compressed_index += length;
 		} else if (upng_chunk_type(chunk) == CHUNK_IEND) {
@@ -1236,47 +1243,47 @@ static EFI_STATUS upng_decode(upng_t* upng)
 		chunk += upng_chunk_length(chunk) + 12;
 	}
 
+	job->compressed_size = compressed_size;
+
 	/* Allocate space to store inflated (but still filtered)
 	 * data */
-	inflated_size = ((upng->width * (upng->height * upng_get_bpp(upng) + 7)) / 8) +
+	job->inflated_size = ((upng->width * (upng->height * upng_get_bpp(upng) + 7)) / 8) +
 		upng->height;
-	inflated = (unsigned char*)AllocatePool(inflated_size);
-	if (inflated == NULL) {
-		FreePool(compressed);
+	job->inflated = (unsigned char*)AllocatePool(job->inflated_size);
+	if (job->inflated == NULL) {
 		SET_ERROR(upng, EFI_OUT_OF_RESOURCES);
 		return upng->error;
 	}
 
-	/* Decompress image data */
-	error = uz_inflate(upng, inflated, inflated_size, compressed, compressed_size);
-	if (error != EFI_SUCCESS) {
-		FreePool(compressed);
-		FreePool(inflated);
-		return upng->error;
-	}
-
-	/* Free the compressed data */
-	FreePool(compressed);
-
 	/* Allocate final image buffer */
 	upng->size = (upng->height * upng->width * upng_get_bpp(upng) + 7) / 8;
 	upng->buffer = (unsigned char*)AllocatePool(upng->size);
 	if (upng->buffer == NULL) {
-		FreePool(inflated);
 		upng->size = 0;
 		SET_ERROR(upng, EFI_OUT_OF_RESOURCES);
 		return upng->error;
 	}
 
-	/* Unfilter scanlines */
-	post_process_scanlines(upng, upng->buffer, inflated, upng);
-	FreePool(inflated);
+	return upng->error;
+}
 
-	if (upng->error != EFI_SUCCESS) {
-		FreePool(upng->buffer);
-		upng->buffer = NULL;
-		upng->size = 0;
-	} else {
+/* Decode the image data in the buffers allocated by
+ * upng_decode_prepare().  No EFI service is used. */
+static EFI_STATUS upng_decode_buffers(struct upng_job *job)
+{
+	upng_t *upng = &job->upng;
+	EFI_STATUS error;
+
+	/* Decompress image data */
+	error = uz_inflate(upng, job->inflated, job->inflated_size,
+			   job->compressed, job->compressed_size);
+	if (error != EFI_SUCCESS) {
+		return upng->error;
+	}
+
+	/* Unfilter scanlines */
+	post_process_scanlines(upng, upng->buffer, job->inflated, upng);
+	if (upng->error == EFI_SUCCESS) {
 		upng->state = UPNG_DECODED;
 	}
 
@@ -1294,31 +1301,81 @@ swap_color(EFI_GRAPHICS_OUTPUT_BLT_PIXEL color)
 	return swapped;
 }
 
-EFI_STATUS upng_load(const char *data, UINTN size,
-		     EFI_GRAPHICS_OUTPUT_BLT_PIXEL **blt,
-		     UINTN *width, UINTN *height)
+EFI_STATUS upng_prepare(const char *data, UINTN size, upng_job_t **job,
+		       UINTN *width, UINTN *height)
+{
+	upng_job_t *new;
+	EFI_STATUS ret;
+
+	new = AllocateZeroPool(sizeof(*new));
+	if (!new)
+		return EFI_OUT_OF_RESOURCES;
+
+	new->upng.color_type = UPNG_RGBA;
+	new->upng.color_depth = 8;
+	new->upng.format = UPNG_RGBA8;
+	new->upng.state = UPNG_NEW;
+	new->upng.error = EFI_SUCCESS;
+	new->upng.source.buffer = (const unsigned char *)data;
+	new->upng.source.size = size;
+
+	ret = upng_decode_prepare(new);
+	if (EFI_ERROR(ret)) {
+		upng_job_free(new);
+		return ret;
+	}
+
+	*job = new;
+	*width = new->upng.width;
+	*height = new->upng.height;
+
+	return EFI_SUCCESS;
+}
+
+EFI_STATUS upng_finish(upng_job_t *job, EFI_GRAPHICS_OUTPUT_BLT_PIXEL **blt)
 {
-	upng_t upng = {
-		.color_type = UPNG_RGBA,
-		.color_depth = 8,
-		.format = UPNG_RGBA8,
-		.state = UPNG_NEW,
-		.error = EFI_SUCCESS,
-		.source.buffer = data,
-		.source.size = size
-	};
 	EFI_STATUS ret;
 	UINTN i;
 
-	ret = upng_decode(&upng);
+	ret = upng_decode_buffers(job);
 	if (EFI_ERROR(ret))
 		return ret;
 
-	*blt = (EFI_GRAPHICS_OUTPUT_BLT_PIXEL *)upng.buffer;
-	*width = upng.width;
-	*height = upng.height;
-	for (i = 0; i < *width * *height; i++)
+	*blt = (EFI_GRAPHICS_OUTPUT_BLT_PIXEL *)job->upng.buffer;
+	for (i = 0; i < (UINTN)job->upng.width * job->upng.height; i++)
 		(*blt)[i] = swap_color((*blt)[i]);
 
+	/* The image buffer now belongs to the caller */
+	job->upng.buffer = NULL;
+	job->upng.size = 0;
+
 	return EFI_SUCCESS;
 }
+
+void upng_job_free(upng_job_t *job)
+{
+	if (job->compressed)
+		FreePool(job->compressed);
+	if (job->inflated)
+		FreePool(job->inflated);
+	if (job->upng.buffer)
+		FreePool(job->upng.buffer);
+	FreePool(job);
+}
+
+EFI_STATUS upng_load(const char *data, UINTN size,
+		     EFI_GRAPHICS_OUTPUT_BLT_PIXEL **blt,
+		     UINTN *width, UINTN *height)
+{
+	upng_job_t *job;
+	EFI_STATUS ret;
+
+	ret = upng_prepare(data, size, &job, width, height);
+	if (EFI_ERROR(ret))
+		return ret;
+
+	ret = upng_finish(job, blt);
+	upng_job_free(job);
+
+	return ret;
+}
@@ -39,22 +39,12 @@
 #include "protocol/ufs.h"
 #include "UsbMassBot.h"
 
-#define EFI_SCSI_OP_WRITE_10      0x2A
+#define EFI_SCSI_OP_WRITE_16      0x8A
 EFI_GUID
 gEfiUsbIoProtocolGuid =
   { 0x2B2F68D6, 0x0CD2, 0x44CF, { 0x8E, 0x8B, 0xBB, 0xA2, 0x0B, 0x1B, 0x5B, 0x75 }};
 VOID *Context = NULL;
 
-typedef struct {
-	UINT8            OpCode;
-	UINT8            Lun;
-	INT8             Lba[4];
-	INT8             Reserved0;
-	UINT8            TransferLen[2];
-	UINT8            Reserverd1;
-	UINT8            Pad[2];
-} USB_BOOT_WRITE10_CMD;
-
 typedef struct {
 	UINT8             OpCode;
 	UINT8             Lun;            ///< Lun (High 3 bits)
@@ -77,6 +67,41 @@ typedef struct {
 } USB_BOOT_REQUEST_SENSE_DATA;
 #define USB_REQUEST_SENSE_OPCODE (0x03)
 #define USB_WRITE_SAME16_OPCODE (0x93)
+#define USB_INQUIRY_OPCODE (0x12)
+#define USB_VPD_BLOCK_LIMITS (0xB0)
+
+/* SBC-3 Block Limits VPD page, all fields big-endian. */
+struct block_limits_vpd {
+	UINT8 peripheral;
+	UINT8 page_code;
+	UINT16 page_length;
+	UINT8 wsnz;
+	UINT8 max_compare_write;
+	UINT16 optimal_granularity;
+	UINT32 max_transfer;		/* in blocks, 0 if not reported */
+	UINT32 optimal_transfer;	/* in blocks, 0 if not reported */
+	UINT32 max_prefetch;
+	UINT32 max_unmap_lba;		/* in blocks, 0 if UNMAP unsupported */
+	UINT32 max_unmap_desc;
+	UINT32 unmap_granularity;
+	UINT32 unmap_alignment;
+	UINT64 max_write_same;		/* in blocks, 0 if not reported */
+	UINT8 reserved[20];
+} __attribute__((packed));
+
+/* Device transfer limits in blocks, 0 means no limit reported. */
+static struct {
+	UINT32 max_transfer;
+	UINT32 optimal_transfer;
+	UINT32 max_unmap;
+	UINT64 max_write_same;
+} limits;
+
+/* Per-command latency statistics of the last erase operation. */
+static struct usb_erase_stats stats;
+
+/* Upper bound of the zero-filled buffer used by the WRITE(16) fallback. */
+#define CLEAN_BUFFER_SIZE (8 * 1024 * 1024)
 
 static USB_DEVICE_PATH *get_usb_device_path(EFI_DEVICE_PATH *p)
 {
@@ -88,12 +113,36 @@ static USB_DEVICE_PATH *get_usb_device_path(EFI_DEVICE_PATH *p)
 	return NULL;
 }
 
+static EFI_STATUS scsi_exec(VOID *cmd, UINT8 cmd_len,
+			    EFI_USB_DATA_DIRECTION dir,
+			    VOID *data, UINT32 data_len,
+			    UINT32 *cmd_status)
+{
+	EFI_STATUS status;
+	UINT64 start, elapsed;
+
+	start = boottime_in_usec();
+	status = UsbBotExecCommandWithRetry(Context, cmd, cmd_len, dir, data,
+					    data_len, 0, USB_BOOT_GENERAL_CMD_TIMEOUT,
+					    cmd_status);
+	elapsed = boottime_in_usec() - start;
+
+	stats.count++;
+	stats.total_usec += elapsed;
+	stats.max_usec = max(stats.max_usec, elapsed);
+	if (EFI_ERROR(status) || *cmd_status)
+		stats.errors++;
+	else
+		stats.bytes += data_len;
+
+	return status;
+}
+
 static EFI_STATUS scsi_request_sense(void)
 {
 	USB_BOOT_REQUEST_SENSE_CMD  SenseCmd;
 	USB_BOOT_REQUEST_SENSE_DATA SenseData;
 	UINT32 cmd_status;
-	UINT32 timeout = USB_BOOT_GENERAL_CMD_TIMEOUT;
 
 	ZeroMem(&SenseCmd, sizeof (USB_BOOT_REQUEST_SENSE_CMD));
 	ZeroMem(&SenseData, sizeof (USB_BOOT_REQUEST_SENSE_DATA));
@@ -101,15 +150,8 @@ static EFI_STATUS scsi_request_sense(void)
 	SenseCmd.OpCode   = USB_REQUEST_SENSE_OPCODE;
 	SenseCmd.Lun      = 0;
 	SenseCmd.AllocLen = (UINT8) sizeof (USB_BOOT_REQUEST_SENSE_DATA);
-	UsbBotExecCommandWithRetry(Context,
-				   &SenseCmd,
-				   sizeof(USB_BOOT_REQUEST_SENSE_CMD),
-				   EfiUsbDataIn,
-				   &SenseData,
-				   sizeof(USB_BOOT_REQUEST_SENSE_DATA),
-				   0,
-				   timeout,
-				   &cmd_status);
+	scsi_exec(&SenseCmd, sizeof(USB_BOOT_REQUEST_SENSE_CMD), EfiUsbDataIn,
+		  &SenseData, sizeof(USB_BOOT_REQUEST_SENSE_DATA), &cmd_status);
 
 	if (SenseData.SenseKey)
 		return EFI_UNSUPPORTED;
@@ -117,11 +159,58 @@ static EFI_STATUS scsi_request_sense(void)
 	return EFI_SUCCESS;
 }
 
+static void scsi_read_block_limits(void)
+{
+	EFI_STATUS status;
+	UINT8 inquiry[6];
+	struct block_limits_vpd vpd;
+	UINT32 cmd_status;
+
+	ZeroMem(&limits, sizeof(limits));
+	ZeroMem(&vpd, sizeof(vpd));
+	ZeroMem(inquiry, sizeof(inquiry));
+	inquiry[0] = USB_INQUIRY_OPCODE;
+	inquiry[1] = 0x1;	/* EVPD */
+	inquiry[2] = USB_VPD_BLOCK_LIMITS;
+	*((UINT16 *)&(inquiry[3])) = htobe16(sizeof(vpd));
+
+	status = scsi_exec(inquiry, sizeof(inquiry), EfiUsbDataIn,
+			   &vpd, sizeof(vpd), &cmd_status);
+	if (EFI_ERROR(status) || cmd_status ||
+	    vpd.page_code != USB_VPD_BLOCK_LIMITS) {
+		/* Optional page, clear the pending sense data if any. */
+		if (!EFI_ERROR(status) && cmd_status)
+			scsi_request_sense();
+		debug(L"Block Limits VPD page not available");
+		return;
+	}
+
+	limits.max_transfer = be32toh(vpd.max_transfer);
+	limits.optimal_transfer = be32toh(vpd.optimal_transfer);
+	limits.max_unmap = be32toh(vpd.max_unmap_lba);
+	limits.max_write_same = be64toh(vpd.max_write_same);
+	debug(L"Block limits: transfer %d/%d, unmap %d, write same %ld",
+	      limits.max_transfer, limits.optimal_transfer,
+	      limits.max_unmap, limits.max_write_same);
+}
+
+/* Largest number of blocks a single command may address. */
+static UINT32 batch_blocks(EFI_LBA start, EFI_LBA end, UINT64 limit)
+{
+	UINT64 count = end - start + 1;
+
+	if (limit && limit < count)
+		count = limit;
+	return min(count, (UINT64)0xFFFFFFFF);
+}
+
 static EFI_STATUS scsi_unmap(EFI_LBA start, EFI_LBA end)
 {
 	EFI_STATUS status;
 	struct command_descriptor_block_unmap cdb;
 	struct unmap_parameter unmap;
+	UINT32 cmd_status;
+	UINT32 count;
 
 	ZeroMem(&cdb, sizeof(cdb));
 	cdb.op_code = UFS_UNMAP;
@@ -130,25 +219,22 @@ static EFI_STATUS scsi_unmap(EFI_LBA start, EFI_LBA end)
 	ZeroMem(&unmap, sizeof(unmap));
 	unmap.data_length = htobe16(sizeof(unmap) - sizeof(unmap.data_length));
 	unmap.block_desc_length = htobe16(sizeof(unmap.block_desc));
-	unmap.block_desc.lba = htobe64(start);
-	unmap.block_desc.count = htobe32(end - start + 1);
 
-	UINT32 timeout = USB_BOOT_GENERAL_CMD_TIMEOUT;
-	UINT32 cmd_status;
-	status = UsbBotExecCommandWithRetry(Context,
-					    &cdb,
-					    sizeof(cdb),
-					    EfiUsbDataOut,
-					    &unmap,
-					    sizeof(unmap),
-					    0,
-					    timeout,
-					    &cmd_status);
-	if (EFI_ERROR (status))
-		return status;
+	for (; start <= end; start += count) {
+		count = batch_blocks(start, end, limits.max_unmap);
+		unmap.block_desc.lba = htobe64(start);
+		unmap.block_desc.count = htobe32(count);
+
+		status = scsi_exec(&cdb, sizeof(cdb), EfiUsbDataOut,
+				   &unmap, sizeof(unmap), &cmd_status);
+		if (EFI_ERROR (status))
+			return status;
 
-	if (cmd_status) {
-		return scsi_request_sense();
+		if (cmd_status) {
+			status = scsi_request_sense();
+			if (EFI_ERROR(status))
+				return status;
+		}
 	}
 	return EFI_SUCCESS;
 }
@@ -159,12 +245,12 @@ static EFI_STATUS scsi_write_same16(EFI_BLOCK_IO *bio,
 				    UINTN block_size,
 				    BOOLEAN unmap)
 {
-	EFI_STATUS              status;
+	EFI_STATUS              status = EFI_SUCCESS;
 	UINT32 cmd_status;
 	UINT8 write_same[16];
-	UINT32 timeout = USB_BOOT_GENERAL_CMD_TIMEOUT;
 	VOID *emptyblock;
 	VOID *aligned_emptyblock;
+	UINT32 count;
 
 	status = alloc_aligned (&emptyblock,
 				&aligned_emptyblock,
@@ -180,50 +266,58 @@ static EFI_STATUS scsi_write_same16(EFI_BLOCK_IO *bio,
 	write_same[0] = USB_WRITE_SAME16_OPCODE;
 	if (unmap)
 		write_same[1] = 0x1 << 3; //set UNMAP bit to perform an unmap operation
-	*((UINT64 *)&(write_same[2])) = htobe64(start);
-	*((UINT32 *)&(write_same[10])) = htobe32(end - start + 1);
-	status = UsbBotExecCommandWithRetry (Context,
-					     write_same,
-					     sizeof(write_same),
-					     EfiUsbDataOut,
-					     aligned_emptyblock,
-					     block_size,
-					     0,
-					     timeout,
-					     &cmd_status);
-	if (EFI_ERROR (status)) {
-		FreePool(emptyblock);
-		return status;
-	}
 
-	if (cmd_status) {
-		FreePool(emptyblock);
-		return scsi_request_sense();
+	for (; start <= end; start += count) {
+		count = batch_blocks(start, end, limits.max_write_same);
+		*((UINT64 *)&(write_same[2])) = htobe64(start);
+		*((UINT32 *)&(write_same[10])) = htobe32(count);
+		status = scsi_exec(write_same, sizeof(write_same), EfiUsbDataOut,
+				   aligned_emptyblock, block_size, &cmd_status);
+		if (EFI_ERROR (status))
+			break;
+
+		if (cmd_status) {
+			status = scsi_request_sense();
+			if (EFI_ERROR(status))
+				break;
+		}
 	}
 
 	FreePool(emptyblock);
-	return  EFI_SUCCESS;
+	return status;
 }
 
-#define BLOCKS (0x2000)
 static EFI_STATUS clean_blocks(EFI_BLOCK_IO *bio, EFI_LBA start, EFI_LBA end)
 {
 	EFI_STATUS              status;
 	VOID *emptyblock;
 	VOID *aligned_emptyblock;
+	UINT32 block_size = bio->Media->BlockSize;
+	UINT32 blocks;
 
 	status = scsi_write_same16 (bio,
 				    start,
 				    end,
-				    bio->Media->BlockSize,
+				    block_size,
 				    FALSE);
 	if (!EFI_ERROR(status))
 		return status;
 
+	/*
+	 * Issue the largest transfers the device accepts, rounded
+	 * down to a multiple of its optimal transfer length, so that the
+	 * per-command overhead is paid as few times as possible.
+	 */
+	blocks = CLEAN_BUFFER_SIZE / block_size;
+	if (limits.max_transfer)
+		blocks = min(blocks, limits.max_transfer);
+	if (limits.optimal_transfer && limits.optimal_transfer <= blocks)
+		blocks -= blocks % limits.optimal_transfer;
+
 	status = alloc_aligned (&emptyblock,
 				&aligned_emptyblock,
-				bio->Media->BlockSize * BLOCKS,
-				bio->Media->IoAlign);
+				(UINTN)block_size * blocks,
+				max(bio->Media->IoAlign, EFI_PAGE_SIZE));
 
 	if (EFI_ERROR(status)) {
 		debug(L"Can not alloc enough buffer");
@@ -231,34 +325,26 @@ static EFI_STATUS clean_blocks(EFI_BLOCK_IO *bio, EFI_LBA start, EFI_LBA end)
 	}
 
 	UINT32 cmd_status;
-	UINT32 timeout = USB_BOOT_GENERAL_CMD_TIMEOUT;
-	USB_BOOT_WRITE10_CMD  WriteCmd;
+	UINT8 WriteCmd[16];
 	EFI_LBA lba;
-	UINT32 size;
-	UINT32 blocks;
+	UINT64 size;
+	UINT32 count;
 
-	ZeroMem (&WriteCmd, sizeof (USB_BOOT_WRITE10_CMD));
-	WriteCmd.OpCode = EFI_SCSI_OP_WRITE_10;
-	WriteCmd.Lun    = 0;
-	*((UINT16 *) WriteCmd.TransferLen) = htobe16 (BLOCKS);
+	ZeroMem (WriteCmd, sizeof (WriteCmd));
+	WriteCmd[0] = EFI_SCSI_OP_WRITE_16;
 
-	lba = start;
 	size  =  end  - start + 1;
 
 	info_n(L"Erasing ");
 	uint32_t print_sec = boottime_in_msec() / 1000;
 	uint32_t print_prev = 0;
-	for(blocks =  size / BLOCKS; blocks > 0; blocks--) {
-		*((UINT32 *) WriteCmd.Lba) = htobe32 (lba);
-		status = UsbBotExecCommandWithRetry (Context,
-						     &WriteCmd,
-						     sizeof(WriteCmd),
-						     EfiUsbDataOut,
-						     aligned_emptyblock,
-						     bio->Media->BlockSize * BLOCKS,
-						     0,
-						     timeout,
-						     &cmd_status);
+	for (lba = start; lba <= end; lba += count) {
+		count = batch_blocks(lba, end, blocks);
+		*((UINT64 *)&(WriteCmd[2])) = htobe64(lba);
+		*((UINT32 *)&(WriteCmd[10])) = htobe32(count);
+		status = scsi_exec(WriteCmd, sizeof(WriteCmd), EfiUsbDataOut,
+				   aligned_emptyblock, block_size * count,
+				   &cmd_status);
 
 		if (EFI_ERROR(status)) {
 			FreePool(emptyblock);
@@ -266,27 +352,11 @@ static EFI_STATUS clean_blocks(EFI_BLOCK_IO *bio, EFI_LBA start, EFI_LBA end)
 		}
 
 		print_progress(lba - start, size, boottime_in_msec() / 1000, &print_sec, &print_prev);
-		lba += BLOCKS;
-	}
-
-	*((UINT32 *) WriteCmd.Lba) = htobe32 (lba);
-	*((UINT16 *) WriteCmd.TransferLen) = htobe16 (size % BLOCKS);
-	status = UsbBotExecCommandWithRetry (Context,
-					     &WriteCmd,
-					     sizeof(WriteCmd),
-					     EfiUsbDataOut,
-					     aligned_emptyblock,
-					     (bio->Media->BlockSize) * (size % BLOCKS),
-					     0,
-					     timeout,
-					     &cmd_status);
-	if (EFI_ERROR(status)) {
-		FreePool(emptyblock);
-		return status;
 	}
 	print_progress(size, size, boottime_in_msec() / 1000, &print_sec, &print_prev);
 	info_n(L"\n");
 
+	FreePool(emptyblock);
 	return EFI_SUCCESS;
 }
 
@@ -304,10 +374,16 @@ static EFI_STATUS usb_erase_blocks(__attribute__((unused)) EFI_HANDLE handle,
 				    &gEfiUsbIoProtocolGuid,
 				    (void **)&UsbIo
 				    );
+	if (EFI_ERROR(status))
+		return EFI_UNSUPPORTED;
+
 	UsbBotInit(UsbIo, &Context);
 	if (Context == NULL)
 		return EFI_UNSUPPORTED;
 
+	ZeroMem(&stats, sizeof(stats));
+	scsi_read_block_limits();
+
 	status = scsi_unmap(start, end);
 	if (status == EFI_UNSUPPORTED) {
 		status = scsi_write_same16 (bio,
@@ -327,6 +403,7 @@ static EFI_STATUS usb_erase_blocks(__attribute__((unused)) EFI_HANDLE handle,
 	 * even unmap failed, this can be a time-consumming operation.
 	 */
 	status =  clean_blocks(bio, start, end);
+
 	if (Context) {
 		FreePool(Context);
 		Context = NULL;
@@ -334,6 +411,11 @@ static EFI_STATUS usb_erase_blocks(__attribute__((unused)) EFI_HANDLE handle,
 	return status;
 }
 
+void usb_storage_get_erase_stats(struct usb_erase_stats *s)
+{
+	*s = stats;
+}
+
 static EFI_STATUS usb_check_logical_unit (__attribute__((unused)) EFI_DEVICE_PATH *p,
 					  logical_unit_t log_unit)
 {
@@ -23,10 +23,10 @@
  */
 
 #include <trusty/sysdeps.h>
-#include "log.h"
-#include "lib.h"
 #include <efi.h>
 #include <efilib.h>
+#include "log.h"
+#include "lib.h"
 
 #define UNUSED(x) (void)(x)
 
@@ -111,3 +111,11 @@ EFI_STATUS transport_write(void *buf, UINT32 size)
 {
 	return current ? current->write(buf, size) : EFI_NOT_STARTED;
 }
+
+UINTN transport_max_tx_inflight(void)
+{
+	if (!current || !current->max_tx_inflight)
+		return 1;
+
+	return current->max_tx_inflight;
+}
@@ -41,6 +41,11 @@
 #include "unittest.h"
 #include "blobstore.h"
 #include "watchdog.h"
+#include "fastboot.h"
+#include "android.h"
+#include "targets.h"
+#include "vars.h"
+#include "libavb_user/uefi_avb_bench.h"
 
 /*
  * This is the hardware second timeout value
@@ -107,6 +112,270 @@ static VOID test_ux(VOID)
 }
 #endif
 
+/* Reference implementation: the command line used to be rebuilt
+ * from scratch for every prepended fragment. */
+static CHAR16 *reference_prepend(CHAR16 *old, CHAR16 *fragment)
+{
+        CHAR16 *new = PoolPrint(L"%s %s", fragment, old);
+
+        FreePool(old);
+        return new;
+}
+
+/* The former implementation converted the CHAR16 line with
+ * str_to_stra() as a last step, rejecting any non-ASCII character. */
+static BOOLEAN cmdline_matches_str(CHAR8 *line, CHAR16 *reference)
+{
+        EFI_STATUS ret;
+        UINTN len = StrLen(reference);
+        CHAR8 *reference8;
+        BOOLEAN match;
+
+        reference8 = AllocatePool(len + 1);
+        if (!reference8)
+                return FALSE;
+
+        ret = str_to_stra(reference8, reference, len + 1);
+        match = !EFI_ERROR(ret) && !memcmp(line, reference8, len + 1);
+        FreePool(reference8);
+        return match;
+}
+
+static BOOLEAN cmdline_matches(struct cmdline *line, CHAR16 *reference)
+{
+        return cmdline_len(line) == StrLen(reference) &&
+                cmdline_matches_str(cmdline_str(line), reference);
+}
+
+static VOID test_cmdline_builder(VOID)
+{
+        static CHAR16 *FRAGMENTS[] = {
+                L"androidboot.serialno=0123456789 g_ffs.iSerialNumber=0123456789",
+                L"androidboot.mode=charger",
+                L"androidboot.bootreason=reboot",
+                L"androidboot.verifiedbootstate=green",
+                L"console=ttyS0,115200n8",
+                L"androidboot.acpi_idx=0 ",
+                L""
+        };
+        const UINTN rounds = 64; /* Enough to grow the buffer several times */
+        EFI_STATUS ret = EFI_SUCCESS;
+        struct cmdline line;
+        CHAR16 *reference, *appended;
+        UINTN i, j;
+
+        reference = stra_to_str((CHAR8 *)"init=/init quiet");
+        if (!reference || EFI_ERROR(cmdline_init(&line, (CHAR8 *)"init=/init quiet"))) {
+                Print(L"Initialization failed, test Failed\n");
+                return;
+        }
+
+        for (i = 0; i < rounds && !EFI_ERROR(ret) && reference; i++) {
+                for (j = 0; j < ARRAY_SIZE(FRAGMENTS); j++) {
+                        ret = prepend_command_line(&line, L"%s", FRAGMENTS[j]);
+                        reference = reference_prepend(reference, FRAGMENTS[j]);
+                        if (EFI_ERROR(ret) || !reference)
+                                break;
+                }
+
+                if (!EFI_ERROR(ret) && reference) {
+                        ret = append_command_line(&line, L"append=%d", i);
+                        appended = PoolPrint(L"%s append=%d", reference, i);
+                        FreePool(reference);
+                        reference = appended;
+                }
+        }
+
+        if (EFI_ERROR(ret) || !reference)
+                Print(L"Failed to build the command line, test Failed\n");
+        else if (!cmdline_matches(&line, reference))
+                Print(L"Command lines differ, test Failed\n");
+        else if (prepend_command_line_str(&line, (CHAR8 *)"bad=\xe9") != EFI_INVALID_PARAMETER)
+                Print(L"Non-ascii fragment accepted, test Failed\n");
+        else
+                Print(L"%d characters command line built, test passed\n",
+                      cmdline_len(&line));
+
+        if (reference)
+                FreePool(reference);
+        cmdline_free(&line);
+}
+
+static CHAR16 *CMDLINE_VARS[] = {
+        CMDLINE_REPLACE_VAR,
+        CMDLINE_PREPEND_VAR,
+        CMDLINE_APPEND_VAR
+};
+
+static const struct cmdline_vars_case {
+        CHAR16 *name;
+        CHAR8 *values[ARRAY_SIZE(CMDLINE_VARS)]; /* NULL if not set */
+        BOOLEAN rejected;
+} CMDLINE_VARS_CASES[] = {
+        { L"no variable", { NULL, NULL, NULL }, FALSE },
+        { L"replace", { (CHAR8 *)"console=ttyS2 replaced", NULL, NULL }, FALSE },
+        { L"prepend and append", { NULL, (CHAR8 *)"prepended=1",
+                                   (CHAR8 *)"appended=1 quiet" }, FALSE },
+        { L"replace, prepend and append", { (CHAR8 *)"replaced", (CHAR8 *)"prepended=1",
+                                            (CHAR8 *)"appended=1" }, FALSE },
+        { L"non-ascii append", { NULL, NULL, (CHAR8 *)"appended=\xe9" }, TRUE }
+};
+
+static const enum boot_target CMDLINE_TARGETS[] = {
+        NORMAL_BOOT, CHARGER, RECOVERY, MEMORY
+};
+
+static EFI_STATUS set_cmdline_vars(const struct cmdline_vars_case *c)
+{
+        EFI_STATUS ret;
+        UINTN i;
+
+        for (i = 0; i < ARRAY_SIZE(CMDLINE_VARS); i++) {
+                if (!c->values[i]) {
+                        ret = del_efi_variable(&loader_guid, CMDLINE_VARS[i]);
+                        if (ret == EFI_NOT_FOUND)
+                                ret = EFI_SUCCESS;
+                } else
+                        ret = set_efi_variable(&loader_guid, CMDLINE_VARS[i],
+                                               strlen(c->values[i]) + 1,
+                                               c->values[i], FALSE, FALSE);
+                if (EFI_ERROR(ret))
+                        return ret;
+        }
+
+        return EFI_SUCCESS;
+}
+
+/* Boot images with only what setup_command_line() reads: the header
+ * command lines and the boot parameters following the header. */
+static UINT8 *cmdline_test_image(UINT32 version, UINT8 **vendorbootimage)
+{
+        struct boot_img_hdr *hdr;
+        struct boot_img_hdr_v3 *hdr_v3;
+        struct vendor_boot_img_hdr_v3 *vendor;
+        UINT8 *image;
+
+        *vendorbootimage = NULL;
+        /* The boot parameters take the 4 KiB zero page */
+        image = AllocateZeroPool(BOOT_IMG_HEADER_SIZE_V3 + 4096);
+        if (!image)
+                return NULL;
+
+        if (version < BOOT_HEADER_V3) {
+                hdr = (struct boot_img_hdr *)image;
+                hdr->header_version = version;
+                hdr->page_size = BOOT_IMG_HEADER_SIZE_V3;
+                /* Fill the whole first part to exercise the join with
+                 * the extra command line */
+                SetMem(hdr->cmdline, sizeof(hdr->cmdline) - 1, 'a');
+                CopyMem(hdr->cmdline, "init=/init quiet ", 17);
+                CopyMem(hdr->extra_cmdline, "extra=1", 7);
+                return image;
+        }
+
+        vendor = AllocateZeroPool(sizeof(*vendor));
+        if (!vendor) {
+                FreePool(image);
+                return NULL;
+        }
+        hdr_v3 = (struct boot_img_hdr_v3 *)image;
+        hdr_v3->header_version = version;
+        CopyMem(hdr_v3->cmdline, "init=/init quiet", 16);
+        CopyMem(vendor->cmdline, "vendor=1 console=ttyS0", 22);
+        *vendorbootimage = (UINT8 *)vendor;
+        return image;
+}
+
+static BOOLEAN check_setup_command_line(UINT32 version, enum boot_target target,
+                                        const struct cmdline_vars_case *c)
+{
+        EFI_STATUS ret;
+        UINT8 *bootimage, *vendorbootimage;
+        CHAR8 *cmdline = NULL;
+        CHAR16 *reference = NULL;
+        BOOLEAN passed;
+
+        bootimage = cmdline_test_image(version, &vendorbootimage);
+        if (!bootimage)
+                return FALSE;
+
+        ret = android_check_command_line(bootimage, vendorbootimage, target,
+                                         &cmdline, &reference);
+        /* The variables only apply to the normal and memory boots */
+        if (c->rejected && (target == NORMAL_BOOT || target == MEMORY))
+                passed = ret == EFI_INVALID_PARAMETER;
+        else
+                passed = !EFI_ERROR(ret) && cmdline_matches_str(cmdline, reference);
+
+        if (!passed)
+                Print(L"v%d image, %s target, %s: command lines differ\n",
+                      version, boot_target_name(target), c->name);
+
+        if (cmdline)
+                FreePool(cmdline);
+        if (reference)
+                FreePool(reference);
+        if (vendorbootimage)
+                FreePool(vendorbootimage);
+        FreePool(bootimage);
+        return passed;
+}
+
+/* Runs the whole command line set up for each target, boot image
+ * header version and command line variables, and compares the
+ * result with the line the former implementation produced. */
+static VOID test_cmdline_setup(VOID)
+{
+        static const UINT32 VERSIONS[] = { 2, BOOT_HEADER_V3 };
+        EFI_STATUS ret;
+        VOID *saved[ARRAY_SIZE(CMDLINE_VARS)];
+        UINTN saved_size[ARRAY_SIZE(CMDLINE_VARS)];
+        UINT32 saved_flags[ARRAY_SIZE(CMDLINE_VARS)];
+        UINTN i, j, k, failed = 0, total = 0;
+
+        for (i = 0; i < ARRAY_SIZE(CMDLINE_VARS); i++)
+                if (EFI_ERROR(get_efi_variable(&loader_guid, CMDLINE_VARS[i],
+                                               &saved_size[i], &saved[i],
+                                               &saved_flags[i])))
+                        saved[i] = NULL;
+
+        for (i = 0; i < ARRAY_SIZE(CMDLINE_VARS_CASES); i++) {
+                ret = set_cmdline_vars(&CMDLINE_VARS_CASES[i]);
+                if (EFI_ERROR(ret)) {
+                        Print(L"Failed to set the %s variables, ", CMDLINE_VARS_CASES[i].name);
+                        failed++;
+                        continue;
+                }
+
+                for (j = 0; j < ARRAY_SIZE(VERSIONS); j++)
+                        for (k = 0; k < ARRAY_SIZE(CMDLINE_TARGETS); k++, total++)
+                                if (!check_setup_command_line(VERSIONS[j], CMDLINE_TARGETS[k],
+                                                              &CMDLINE_VARS_CASES[i]))
+                                        failed++;
+        }
+
+        for (i = 0; i < ARRAY_SIZE(CMDLINE_VARS); i++) {
+                del_efi_variable(&loader_guid, CMDLINE_VARS[i]);
+                if (!saved[i])
+                        continue;
+                uefi_call_wrapper(RT->SetVariable, 5, CMDLINE_VARS[i],
+                                  (EFI_GUID *)&loader_guid, saved_flags[i],
+                                  saved_size[i], saved[i]);
+                FreePool(saved[i]);
+        }
+
+        if (failed)
+                Print(L"%d/%d set ups failed, test Failed\n", failed, total);
+        else
+                Print(L"%d command line set ups checked, test passed\n", total);
+}
+
+static VOID test_cmdline(VOID)
+{
+        test_cmdline_builder();
+        test_cmdline_setup();
+}
+
 static struct test_suite {
         CHAR16 *name;
         VOID (*fun)(VOID);
@@ -115,6 +384,10 @@ static struct test_suite {
         { L"ux", test_ux },
 #endif
         { L"keys", test_keys },
+        { L"cmdline", test_cmdline },
+        { L"flash-bench", fastboot_flash_bench },
+        { L"dispatch-bench", fastboot_dispatch_bench },
+        { L"avb-bench", uefi_avb_bench },
         { L"watchdog", test_watchdog }
 };
 
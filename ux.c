@@ -601,3 +601,18 @@ VOID ux_display_vendor_splash(VOID) {
 		log(L"vendor splash shown\n");
 	}
 }
+
+VOID ux_start_vendor_splash(VOID) {
+
+	if (get_display_splash()) {
+		if (EFI_ERROR(ux_init_screen()))
+			return;
+		ui_vendor_splash_start();
+	}
+}
+
+VOID ux_finish_vendor_splash(VOID) {
+
+	if (!EFI_ERROR(ui_vendor_splash_finish()))
+		log(L"vendor splash shown\n");
+}
@@ -74,5 +74,9 @@ VOID ux_display_low_battery(UINTN delay);
 VOID ux_display_empty_battery(VOID);
 
 VOID ux_display_vendor_splash(VOID);
+/* Same as ux_display_vendor_splash() but the image decoding overlaps
+ * with the code executed between the two calls.  */
+VOID ux_start_vendor_splash(VOID);
+VOID ux_finish_vendor_splash(VOID);
 
 #endif